@@ -0,0 +1,82 @@
+#!/bin/bash
+
+# runs robot-util against a fake bluez on a private bus, once per device count, and keeps the stats
+# dumps. robot-util runs with --bench, which opens the bluetooth menu without a screen, so this
+# works unattended
+#
+# usage: scripts/bluez_bench.sh <robot-util binary> [device counts...]
+#
+# environment:
+#   CONFIG          base config. defaults to config/util.json, or an empty config if that is missing
+#   OUTDIR          where the logs go. defaults to bench-results
+#   SETTLE_SECONDS  time given to connect before the first stats dump. defaults to 5
+#   CHURN_SECONDS   time spent under churn and storms before robot-util exits with its final dump.
+#                   defaults to 10
+#   MOCK_ARGS       arguments for mock_bluez.py. defaults to rssi churn and a storm every 2 s
+
+BINARY=$(realpath $1)
+shift
+
+COUNTS=${@:-10 100 1000}
+
+SCRIPTDIR=$(realpath $(dirname $0))
+CONFIG=${CONFIG:-config/util.json}
+OUTDIR=$(realpath -m ${OUTDIR:-bench-results})
+SETTLE_SECONDS=${SETTLE_SECONDS:-5}
+CHURN_SECONDS=${CHURN_SECONDS:-10}
+MOCK_ARGS=${MOCK_ARGS:---churn-hz 50 --storm-interval 2}
+
+mkdir -p $OUTDIR
+
+WORKDIR=$(mktemp -d)
+trap "rm -rf $WORKDIR" EXIT
+
+if [[ -f $CONFIG ]]; then
+    BASE_CONFIG=$(cat $CONFIG)
+else
+    BASE_CONFIG="{}"
+fi
+
+for COUNT in $COUNTS; do
+    # a private bus, so that the fake can own org.bluez without touching the system
+    DAEMON_OUTPUT=$(dbus-daemon --session --fork --print-address=1 --print-pid=1)
+    ADDRESS=$(echo "$DAEMON_OUTPUT" | sed -n 1p)
+    DAEMON_PID=$(echo "$DAEMON_OUTPUT" | sed -n 2p)
+
+    READY_FILE=$WORKDIR/mock-ready
+    rm -f $READY_FILE
+
+    python3 $SCRIPTDIR/mock_bluez.py --address "$ADDRESS" --devices $COUNT \
+        --ready-file $READY_FILE $MOCK_ARGS 2> $OUTDIR/mock-$COUNT.log &
+    MOCK_PID=$!
+
+    while [[ ! -f $READY_FILE ]]; do
+        if ! kill -0 $MOCK_PID 2> /dev/null; then
+            echo "Mock BlueZ failed to start, see $OUTDIR/mock-$COUNT.log" >&2
+            kill $DAEMON_PID
+            exit 1
+        fi
+
+        sleep 0.1
+    done
+
+    # robot-util reads config/util.json from its working directory
+    mkdir -p $WORKDIR/config
+    echo "$BASE_CONFIG" | jq --arg address "$ADDRESS" '.bluetooth.bus_address = $address' \
+        > $WORKDIR/config/util.json
+
+    (cd $WORKDIR && exec $BINARY --bench $((SETTLE_SECONDS + CHURN_SECONDS))) \
+        > /dev/null 2> $OUTDIR/robot-util-$COUNT.log &
+    APP_PID=$!
+
+    # one dump after connecting. robot-util dumps again as it exits, after churn
+    sleep $SETTLE_SECONDS
+    kill -USR1 $APP_PID
+    wait $APP_PID
+
+    kill $MOCK_PID
+    wait $MOCK_PID 2> /dev/null
+    kill $DAEMON_PID
+
+    echo "$COUNT devices: $OUTDIR/robot-util-$COUNT.log"
+done
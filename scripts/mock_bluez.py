@@ -0,0 +1,305 @@
+#!/usr/bin/env python3
+
+# fake bluez for benchmarking robot-util's bluetooth layer on a private bus. exposes the object
+# manager, an adapter and n synthetic devices, with rssi churn and add/remove storms. needs pygobject
+
+import argparse
+import random
+import sys
+
+from gi.repository import Gio, GLib
+
+BUS_NAME = "org.bluez"
+ROOT_PATH = "/org/bluez"
+ADAPTER_PATH = "/org/bluez/hci0"
+
+OBJECT_MANAGER_INTERFACE = "org.freedesktop.DBus.ObjectManager"
+PROPERTIES_INTERFACE = "org.freedesktop.DBus.Properties"
+AGENT_MANAGER_INTERFACE = "org.bluez.AgentManager1"
+ADAPTER_INTERFACE = "org.bluez.Adapter1"
+DEVICE_INTERFACE = "org.bluez.Device1"
+
+INTROSPECTION = """
+<node>
+  <interface name="org.freedesktop.DBus.ObjectManager">
+    <method name="GetManagedObjects">
+      <arg name="objects" type="a{oa{sa{sv}}}" direction="out"/>
+    </method>
+    <signal name="InterfacesAdded">
+      <arg name="object" type="o"/>
+      <arg name="interfaces" type="a{sa{sv}}"/>
+    </signal>
+    <signal name="InterfacesRemoved">
+      <arg name="object" type="o"/>
+      <arg name="interfaces" type="as"/>
+    </signal>
+  </interface>
+  <interface name="org.bluez.AgentManager1">
+    <method name="RegisterAgent">
+      <arg name="agent" type="o" direction="in"/>
+      <arg name="capability" type="s" direction="in"/>
+    </method>
+    <method name="UnregisterAgent">
+      <arg name="agent" type="o" direction="in"/>
+    </method>
+    <method name="RequestDefaultAgent">
+      <arg name="agent" type="o" direction="in"/>
+    </method>
+  </interface>
+  <interface name="org.bluez.Adapter1">
+    <method name="StartDiscovery"/>
+    <method name="StopDiscovery"/>
+    <method name="SetDiscoveryFilter">
+      <arg name="filter" type="a{sv}" direction="in"/>
+    </method>
+    <method name="RemoveDevice">
+      <arg name="device" type="o" direction="in"/>
+    </method>
+    <property name="Address" type="s" access="read"/>
+    <property name="Discovering" type="b" access="read"/>
+  </interface>
+  <interface name="org.bluez.Device1">
+    <method name="Pair"/>
+    <method name="CancelPairing"/>
+    <method name="Connect"/>
+    <method name="Disconnect"/>
+    <property name="Name" type="s" access="read"/>
+    <property name="Address" type="s" access="read"/>
+    <property name="Adapter" type="o" access="read"/>
+    <property name="Paired" type="b" access="read"/>
+    <property name="Trusted" type="b" access="read"/>
+    <property name="Connected" type="b" access="read"/>
+    <property name="RSSI" type="n" access="read"/>
+  </interface>
+</node>
+"""
+
+PROPERTY_TYPES = {
+    "Name": "s",
+    "Address": "s",
+    "Adapter": "o",
+    "Paired": "b",
+    "Trusted": "b",
+    "Connected": "b",
+    "RSSI": "n",
+    "Discovering": "b",
+}
+
+
+class MockObject:
+    def __init__(self, path, interface, properties):
+        self.path = path
+        self.interface = interface
+        self.properties = properties
+        self.registration_ids = []
+
+    def variants(self):
+        return {name: GLib.Variant(PROPERTY_TYPES[name], value)
+                for name, value in self.properties.items()}
+
+
+class MockBluez:
+    def __init__(self, connection, args):
+        self.connection = connection
+        self.args = args
+        self.node_info = Gio.DBusNodeInfo.new_for_xml(INTROSPECTION)
+        self.random = random.Random(args.seed)
+
+        self.adapter = MockObject(ADAPTER_PATH, ADAPTER_INTERFACE, {
+            "Address": "00:00:00:00:00:00",
+            "Discovering": False,
+        })
+
+        self.devices = {}
+        self.next_device = 0
+
+        self.register(ROOT_PATH, [AGENT_MANAGER_INTERFACE], None)
+        self.register("/", [OBJECT_MANAGER_INTERFACE], None)
+        self.register(ADAPTER_PATH, [ADAPTER_INTERFACE], self.adapter)
+
+        for i in range(args.devices):
+            self.add_device(paired=i < args.paired, announce=False)
+
+    def interface_info(self, name):
+        return self.node_info.lookup_interface(name)
+
+    def register(self, path, interfaces, mock_object):
+        for name in interfaces:
+            registration_id = self.connection.register_object(
+                path, self.interface_info(name), self.method_call, self.get_property, None)
+
+            if mock_object:
+                mock_object.registration_ids.append(registration_id)
+
+    def add_device(self, paired, announce):
+        index = self.next_device
+        self.next_device += 1
+
+        address = ":".join("%02X" % ((index >> shift) & 0xFF) for shift in (40, 32, 24, 16, 8, 0))
+        path = "%s/dev_%s" % (ADAPTER_PATH, address.replace(":", "_"))
+
+        device = MockObject(path, DEVICE_INTERFACE, {
+            "Name": "Mock device %d" % index,
+            "Address": address,
+            "Adapter": ADAPTER_PATH,
+            "Paired": paired,
+            "Trusted": paired,
+            "Connected": False,
+            "RSSI": self.random.randint(-100, -30),
+        })
+
+        self.devices[path] = device
+        self.register(path, [DEVICE_INTERFACE], device)
+
+        if announce:
+            self.emit(OBJECT_MANAGER_INTERFACE, "/", "InterfacesAdded",
+                      GLib.Variant("(oa{sa{sv}})", (path, {DEVICE_INTERFACE: device.variants()})))
+
+    def remove_device(self, path):
+        device = self.devices.pop(path, None)
+        if not device:
+            return False
+
+        for registration_id in device.registration_ids:
+            self.connection.unregister_object(registration_id)
+
+        self.emit(OBJECT_MANAGER_INTERFACE, "/", "InterfacesRemoved",
+                  GLib.Variant("(oas)", (path, [DEVICE_INTERFACE])))
+
+        return True
+
+    def emit(self, interface, path, signal, parameters):
+        self.connection.emit_signal(None, path, interface, signal, parameters)
+
+    def set_property(self, mock_object, name, value):
+        mock_object.properties[name] = value
+        self.emit(PROPERTIES_INTERFACE, mock_object.path, "PropertiesChanged",
+                  GLib.Variant("(sa{sv}as)", (mock_object.interface, {
+                      name: GLib.Variant(PROPERTY_TYPES[name], value),
+                  }, [])))
+
+    def get_property(self, connection, sender, path, interface, name):
+        mock_object = self.adapter if path == ADAPTER_PATH else self.devices.get(path)
+        return GLib.Variant(PROPERTY_TYPES[name], mock_object.properties[name])
+
+    def method_call(self, connection, sender, path, interface, method, parameters, invocation):
+        if method == "GetManagedObjects":
+            objects = {
+                ROOT_PATH: {AGENT_MANAGER_INTERFACE: {}},
+                ADAPTER_PATH: {ADAPTER_INTERFACE: self.adapter.variants()},
+            }
+
+            for device in self.devices.values():
+                objects[device.path] = {DEVICE_INTERFACE: device.variants()}
+
+            invocation.return_value(GLib.Variant("(a{oa{sa{sv}}})", (objects,)))
+        elif method in ("StartDiscovery", "StopDiscovery"):
+            self.set_property(self.adapter, "Discovering", method == "StartDiscovery")
+            invocation.return_value(None)
+        elif method == "RemoveDevice":
+            if self.remove_device(parameters.unpack()[0]):
+                invocation.return_value(None)
+            else:
+                invocation.return_dbus_error("org.bluez.Error.DoesNotExist", "No such device")
+        elif method in ("Pair", "Connect"):
+            self.finish_later(invocation, self.devices.get(path), method)
+        elif method == "Disconnect" and path in self.devices:
+            self.set_property(self.devices[path], "Connected", False)
+            invocation.return_value(None)
+        else:
+            invocation.return_value(None)
+
+    # replies once the configured latency is over, failing some of the time
+    def finish_later(self, invocation, device, method):
+        def finish():
+            if device is None or self.random.random() < self.args.failure_rate:
+                invocation.return_dbus_error("org.bluez.Error.Failed", "Mock failure")
+                return GLib.SOURCE_REMOVE
+
+            if method == "Pair":
+                self.set_property(device, "Paired", True)
+                self.set_property(device, "Trusted", True)
+            else:
+                self.set_property(device, "Connected", True)
+
+            invocation.return_value(None)
+            return GLib.SOURCE_REMOVE
+
+        GLib.timeout_add(self.args.latency_ms, finish)
+
+    def churn(self):
+        if self.devices:
+            device = self.random.choice(list(self.devices.values()))
+            rssi = device.properties["RSSI"] + self.random.randint(-6, 6)
+            self.set_property(device, "RSSI", max(-100, min(-20, rssi)))
+
+        return GLib.SOURCE_CONTINUE
+
+    def storm(self):
+        paths = self.random.sample(list(self.devices), min(self.args.storm_size,
+                                                           len(self.devices)))
+
+        for path in paths:
+            self.remove_device(path)
+
+        for i in range(self.args.storm_size):
+            self.add_device(paired=False, announce=True)
+
+        return GLib.SOURCE_CONTINUE
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Fake BlueZ for benchmarking robot-util")
+    parser.add_argument("--address", help="bus address. defaults to the session bus")
+    parser.add_argument("--devices", type=int, default=100, help="synthetic devices at startup")
+    parser.add_argument("--paired", type=int, default=0,
+                        help="how many of them are paired and trusted")
+    parser.add_argument("--churn-hz", type=float, default=50,
+                        help="rssi changes per second. 0 disables churn")
+    parser.add_argument("--storm-interval", type=float, default=0,
+                        help="seconds between add/remove storms. 0 disables storms")
+    parser.add_argument("--storm-size", type=int, default=20,
+                        help="devices removed and added per storm")
+    parser.add_argument("--latency-ms", type=int, default=100,
+                        help="how long Pair and Connect take")
+    parser.add_argument("--failure-rate", type=float, default=0,
+                        help="fraction of Pair and Connect calls which fail")
+    parser.add_argument("--ready-file", help="created once the bus name is owned")
+    parser.add_argument("--seed", type=int, default=0)
+    args = parser.parse_args()
+
+    if args.address:
+        connection = Gio.DBusConnection.new_for_address_sync(
+            args.address, Gio.DBusConnectionFlags.AUTHENTICATION_CLIENT |
+            Gio.DBusConnectionFlags.MESSAGE_BUS_CONNECTION, None, None)
+    else:
+        connection = Gio.bus_get_sync(Gio.BusType.SESSION, None)
+
+    bluez = MockBluez(connection, args)
+    loop = GLib.MainLoop()
+
+    def name_acquired(connection, name):
+        if args.ready_file:
+            open(args.ready_file, "w").close()
+
+    def name_lost(connection, name):
+        print("Failed to own %s" % BUS_NAME, file=sys.stderr)
+        loop.quit()
+
+    Gio.bus_own_name_on_connection(connection, BUS_NAME, Gio.BusNameOwnerFlags.NONE,
+                                   name_acquired, name_lost)
+
+    if args.churn_hz > 0:
+        GLib.timeout_add(max(1, int(1000 / args.churn_hz)), bluez.churn)
+
+    if args.storm_interval > 0:
+        GLib.timeout_add(int(args.storm_interval * 1000), bluez.storm)
+
+    try:
+        loop.run()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
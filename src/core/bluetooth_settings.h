@@ -0,0 +1,30 @@
+#ifndef BLUETOOTH_SETTINGS_H
+#define BLUETOOTH_SETTINGS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct bluetooth_discovery_filter {
+    // "auto", "bredr" or "le". null leaves it to bluez
+    char* transport;
+
+    // devices weaker than this many dBm are not reported. 0 disables the threshold
+    int16_t rssi;
+
+    // only devices advertising one of these service uuids are reported. none matches any device
+    char** uuids;
+    size_t uuid_count;
+};
+
+struct bluetooth_reconnect_settings {
+    // connection attempts in flight at once
+    uint32_t max_concurrent;
+
+    // attempts per device before giving up. 0 disables reconnecting
+    uint32_t max_attempts;
+
+    // milliseconds before the first retry. doubles with every failed attempt after that
+    uint32_t retry_delay_ms;
+};
+
+#endif
@@ -9,18 +9,144 @@
 
 #include <sys/stat.h>
 
+void config_default_idle(struct idle_config* idle) {
+    idle->timeout_ms = 120000; // 2 minutes
+    idle->tick_interval_ms = 50;
+    idle->dim_backlight = 1;
+}
+
+void config_default_button(struct debounce_settings* button) {
+    button->window_us = 30 * 1000;
+    button->long_press_us = 800 * 1000;
+}
+
+void config_default_input_thread(struct encoder_thread_settings* input_thread) {
+    input_thread->enabled = 0;
+    input_thread->priority = 50;
+    input_thread->lock_memory = 1;
+    input_thread->cpu = -1;
+}
+
+void config_default_input_log(struct input_log_config* input_log) {
+    input_log->record_path = NULL;
+    input_log->replay_path = NULL;
+    input_log->replay_timing = INPUT_LOG_TIMING_ORIGINAL;
+}
+
+void config_default_bluetooth(struct bluetooth_config* bluetooth) {
+    bluetooth->bus_address = NULL;
+    bluetooth->cache_path = strdup("config/bluetooth.cache");
+
+    bluetooth->max_devices = 12;
+    bluetooth->stale_timeout_ms = 60000; // 1 minute
+
+    bluetooth->discovery.transport = NULL;
+    bluetooth->discovery.rssi = 0;
+    bluetooth->discovery.uuids = NULL;
+    bluetooth->discovery.uuid_count = 0;
+
+    bluetooth->reconnect.max_concurrent = 4;
+    bluetooth->reconnect.max_attempts = 5;
+    bluetooth->reconnect.retry_delay_ms = 1000;
+}
+
 void config_default(struct robot_util_config* config) {
     config->backend_name = NULL;
+    config->gpio_chip = NULL;
 
     config->encoder_pins.a = 17;
     config->encoder_pins.b = 27;
     config->encoder_pins.sw = 22;
+    config->encoder_settings.mode = ROTARY_ENCODER_MODE_EVENTS;
+    config->encoder_settings.resolution = QUADRATURE_RESOLUTION_1X;
+    config_default_button(&config->encoder_settings.button);
+    config_default_input_thread(&config->input_thread);
 
     config->lcd_address = 0x27;
 
+    config_default_idle(&config->idle);
+    config_default_input_log(&config->input_log);
+    config_default_bluetooth(&config->bluetooth);
+
     config->update_url = NULL;
 }
 
+struct encoder_mode_mapping {
+    const char* name;
+    rotary_encoder_mode mode;
+};
+
+static const struct encoder_mode_mapping encoder_modes[] = {
+    { "poll", ROTARY_ENCODER_MODE_POLL },
+    { "events", ROTARY_ENCODER_MODE_EVENTS },
+};
+
+int config_deserialize_encoder_mode(const cJSON* json, rotary_encoder_mode* mode) {
+    const char* name;
+    size_t i;
+
+    // edge events unless stated otherwise
+    if (!json) {
+        *mode = ROTARY_ENCODER_MODE_EVENTS;
+        return 1;
+    }
+
+    if (!cJSON_IsString(json)) {
+        fprintf(stderr, "Encoder mode must be a string!\n");
+        return 0;
+    }
+
+    name = json->valuestring;
+    for (i = 0; i < ARRAYSIZE(encoder_modes); i++) {
+        if (!strcmp(encoder_modes[i].name, name)) {
+            *mode = encoder_modes[i].mode;
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "Invalid encoder mode: %s\n", name);
+    return 0;
+}
+
+const char* config_serialize_encoder_mode(rotary_encoder_mode mode) {
+    size_t i;
+
+    for (i = 0; i < ARRAYSIZE(encoder_modes); i++) {
+        if (encoder_modes[i].mode == mode) {
+            return encoder_modes[i].name;
+        }
+    }
+
+    return NULL;
+}
+
+int config_deserialize_encoder_resolution(const cJSON* json, quadrature_resolution* resolution) {
+    int value;
+
+    // one step per detent unless stated otherwise
+    if (!json) {
+        *resolution = QUADRATURE_RESOLUTION_1X;
+        return 1;
+    }
+
+    if (!cJSON_IsNumber(json)) {
+        fprintf(stderr, "Encoder resolution must be a number!\n");
+        return 0;
+    }
+
+    value = (int)cJSON_GetNumberValue(json);
+    switch (value) {
+    case QUADRATURE_RESOLUTION_1X:
+    case QUADRATURE_RESOLUTION_2X:
+    case QUADRATURE_RESOLUTION_4X:
+        *resolution = (quadrature_resolution)value;
+        return 1;
+    default:
+        fprintf(stderr, "Invalid encoder resolution: %d. Must be 1, 2, or 4\n", value);
+        return 0;
+    }
+}
+
 struct pin_mapping {
     const char* name;
     unsigned int* ptr;
@@ -52,6 +178,199 @@ int config_deserialize_encoder_pins(const cJSON* json, struct rotary_encoder_pin
     return 1;
 }
 
+void config_deserialize_idle(const cJSON* json, struct idle_config* idle) {
+    const cJSON* node;
+
+    // older configs dont have idle settings. fill in whatever is missing
+    config_default_idle(idle);
+    if (!json || !cJSON_IsObject(json)) {
+        return;
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "timeout_ms");
+    if (node && cJSON_IsNumber(node)) {
+        idle->timeout_ms = (uint32_t)cJSON_GetNumberValue(node);
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "tick_interval_ms");
+    if (node && cJSON_IsNumber(node)) {
+        idle->tick_interval_ms = (uint32_t)cJSON_GetNumberValue(node);
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "dim_backlight");
+    if (node && cJSON_IsBool(node)) {
+        idle->dim_backlight = cJSON_IsTrue(node);
+    }
+}
+
+void config_deserialize_button(const cJSON* json, struct debounce_settings* button) {
+    const cJSON* node;
+
+    config_default_button(button);
+    if (!json || !cJSON_IsObject(json)) {
+        return;
+    }
+
+    // stored in milliseconds
+    node = cJSON_GetObjectItemCaseSensitive(json, "debounce_ms");
+    if (node && cJSON_IsNumber(node)) {
+        button->window_us = (uint32_t)(cJSON_GetNumberValue(node) * 1000);
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "long_press_ms");
+    if (node && cJSON_IsNumber(node)) {
+        button->long_press_us = (uint32_t)(cJSON_GetNumberValue(node) * 1000);
+    }
+}
+
+void config_deserialize_input_thread(const cJSON* json,
+                                     struct encoder_thread_settings* input_thread) {
+    const cJSON* node;
+
+    config_default_input_thread(input_thread);
+    if (!json || !cJSON_IsObject(json)) {
+        return;
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "enabled");
+    if (node && cJSON_IsBool(node)) {
+        input_thread->enabled = cJSON_IsTrue(node);
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "priority");
+    if (node && cJSON_IsNumber(node)) {
+        input_thread->priority = (int)cJSON_GetNumberValue(node);
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "lock_memory");
+    if (node && cJSON_IsBool(node)) {
+        input_thread->lock_memory = cJSON_IsTrue(node);
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "cpu");
+    if (node && cJSON_IsNumber(node)) {
+        input_thread->cpu = (int)cJSON_GetNumberValue(node);
+    }
+}
+
+void config_deserialize_input_log(const cJSON* json, struct input_log_config* input_log) {
+    const cJSON* node;
+
+    config_default_input_log(input_log);
+    if (!json || !cJSON_IsObject(json)) {
+        return;
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "record");
+    if (node && cJSON_IsString(node)) {
+        input_log->record_path = strdup(node->valuestring);
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "replay");
+    if (node && cJSON_IsString(node)) {
+        input_log->replay_path = strdup(node->valuestring);
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "replay_timing");
+    if (node && cJSON_IsString(node) && !strcmp(node->valuestring, "fast")) {
+        input_log->replay_timing = INPUT_LOG_TIMING_FAST;
+    }
+}
+
+void config_deserialize_discovery(const cJSON* json, struct bluetooth_discovery_filter* filter) {
+    const cJSON* node;
+    const cJSON* uuid;
+
+    if (!json || !cJSON_IsObject(json)) {
+        return;
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "transport");
+    if (node && cJSON_IsString(node)) {
+        filter->transport = strdup(node->valuestring);
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "rssi");
+    if (node && cJSON_IsNumber(node)) {
+        filter->rssi = (int16_t)cJSON_GetNumberValue(node);
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "uuids");
+    if (node && cJSON_IsArray(node) && cJSON_GetArraySize(node) > 0) {
+        filter->uuids = (char**)malloc(cJSON_GetArraySize(node) * sizeof(char*));
+
+        cJSON_ArrayForEach(uuid, node) {
+            if (cJSON_IsString(uuid)) {
+                filter->uuids[filter->uuid_count++] = strdup(uuid->valuestring);
+            }
+        }
+    }
+}
+
+void config_deserialize_reconnect(const cJSON* json,
+                                  struct bluetooth_reconnect_settings* reconnect) {
+    const cJSON* node;
+
+    if (!json || !cJSON_IsObject(json)) {
+        return;
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "max_concurrent");
+    if (node && cJSON_IsNumber(node)) {
+        reconnect->max_concurrent = (uint32_t)cJSON_GetNumberValue(node);
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "max_attempts");
+    if (node && cJSON_IsNumber(node)) {
+        reconnect->max_attempts = (uint32_t)cJSON_GetNumberValue(node);
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "retry_delay_ms");
+    if (node && cJSON_IsNumber(node)) {
+        reconnect->retry_delay_ms = (uint32_t)cJSON_GetNumberValue(node);
+    }
+}
+
+void config_deserialize_bluetooth(const cJSON* json, struct bluetooth_config* bluetooth) {
+    const cJSON* node;
+
+    config_default_bluetooth(bluetooth);
+    if (!json || !cJSON_IsObject(json)) {
+        return;
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "bus_address");
+    if (node && cJSON_IsString(node)) {
+        bluetooth->bus_address = strdup(node->valuestring);
+    }
+
+    // null turns the cache off, and leaving it out keeps the default
+    node = cJSON_GetObjectItemCaseSensitive(json, "cache_path");
+    if (node && cJSON_IsString(node)) {
+        free(bluetooth->cache_path);
+        bluetooth->cache_path = strdup(node->valuestring);
+    } else if (node && cJSON_IsNull(node)) {
+        free(bluetooth->cache_path);
+        bluetooth->cache_path = NULL;
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "max_devices");
+    if (node && cJSON_IsNumber(node)) {
+        bluetooth->max_devices = (uint32_t)cJSON_GetNumberValue(node);
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "stale_timeout_ms");
+    if (node && cJSON_IsNumber(node)) {
+        bluetooth->stale_timeout_ms = (uint32_t)cJSON_GetNumberValue(node);
+    }
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "discovery");
+    config_deserialize_discovery(node, &bluetooth->discovery);
+
+    node = cJSON_GetObjectItemCaseSensitive(json, "reconnect");
+    config_deserialize_reconnect(node, &bluetooth->reconnect);
+}
+
 int config_deserialize(const cJSON* json, struct robot_util_config* config) {
     const cJSON* node;
     const char* node_name;
@@ -65,6 +384,15 @@ int config_deserialize(const cJSON* json, struct robot_util_config* config) {
         config->backend_name = NULL;
     }
 
+    node_name = "gpio_chip";
+    node = cJSON_GetObjectItemCaseSensitive(json, node_name);
+
+    if (node && cJSON_IsString(node)) {
+        config->gpio_chip = strdup(node->valuestring);
+    } else {
+        config->gpio_chip = NULL;
+    }
+
     node_name = "lcd_address";
     node = cJSON_GetObjectItemCaseSensitive(json, node_name);
 
@@ -89,6 +417,28 @@ int config_deserialize(const cJSON* json, struct robot_util_config* config) {
         return 0;
     }
 
+    node_name = "encoder_mode";
+    node = cJSON_GetObjectItemCaseSensitive(json, node_name);
+
+    if (!config_deserialize_encoder_mode(node, &config->encoder_settings.mode)) {
+        return 0;
+    }
+
+    node_name = "encoder_resolution";
+    node = cJSON_GetObjectItemCaseSensitive(json, node_name);
+
+    if (!config_deserialize_encoder_resolution(node, &config->encoder_settings.resolution)) {
+        return 0;
+    }
+
+    node_name = "encoder_button";
+    node = cJSON_GetObjectItemCaseSensitive(json, node_name);
+    config_deserialize_button(node, &config->encoder_settings.button);
+
+    node_name = "input_thread";
+    node = cJSON_GetObjectItemCaseSensitive(json, node_name);
+    config_deserialize_input_thread(node, &config->input_thread);
+
     node_name = "update_url";
     node = cJSON_GetObjectItemCaseSensitive(json, node_name);
 
@@ -98,6 +448,18 @@ int config_deserialize(const cJSON* json, struct robot_util_config* config) {
         config->update_url = NULL;
     }
 
+    node_name = "idle";
+    node = cJSON_GetObjectItemCaseSensitive(json, node_name);
+    config_deserialize_idle(node, &config->idle);
+
+    node_name = "input_log";
+    node = cJSON_GetObjectItemCaseSensitive(json, node_name);
+    config_deserialize_input_log(node, &config->input_log);
+
+    node_name = "bluetooth";
+    node = cJSON_GetObjectItemCaseSensitive(json, node_name);
+    config_deserialize_bluetooth(node, &config->bluetooth);
+
     return 1;
 }
 
@@ -116,6 +478,173 @@ cJSON* config_serialize_encoder_pins(const struct rotary_encoder_pins* pins) {
     return node;
 }
 
+cJSON* config_serialize_idle(const struct idle_config* idle) {
+    cJSON* node;
+
+    node = cJSON_CreateObject();
+    if (!node) {
+        return NULL;
+    }
+
+    cJSON_AddNumberToObject(node, "timeout_ms", idle->timeout_ms);
+    cJSON_AddNumberToObject(node, "tick_interval_ms", idle->tick_interval_ms);
+    cJSON_AddBoolToObject(node, "dim_backlight", idle->dim_backlight);
+
+    return node;
+}
+
+cJSON* config_serialize_button(const struct debounce_settings* button) {
+    cJSON* node;
+
+    node = cJSON_CreateObject();
+    if (!node) {
+        return NULL;
+    }
+
+    cJSON_AddNumberToObject(node, "debounce_ms", button->window_us / 1000.0);
+    cJSON_AddNumberToObject(node, "long_press_ms", button->long_press_us / 1000.0);
+
+    return node;
+}
+
+cJSON* config_serialize_input_thread(const struct encoder_thread_settings* input_thread) {
+    cJSON* node;
+
+    node = cJSON_CreateObject();
+    if (!node) {
+        return NULL;
+    }
+
+    cJSON_AddBoolToObject(node, "enabled", input_thread->enabled);
+    cJSON_AddNumberToObject(node, "priority", input_thread->priority);
+    cJSON_AddBoolToObject(node, "lock_memory", input_thread->lock_memory);
+    cJSON_AddNumberToObject(node, "cpu", input_thread->cpu);
+
+    return node;
+}
+
+cJSON* config_serialize_input_log(const struct input_log_config* input_log) {
+    cJSON* node;
+    cJSON* child;
+
+    node = cJSON_CreateObject();
+    if (!node) {
+        return NULL;
+    }
+
+    if (input_log->record_path) {
+        child = cJSON_CreateString(input_log->record_path);
+    } else {
+        child = cJSON_CreateNull();
+    }
+
+    cJSON_AddItemToObject(node, "record", child);
+
+    if (input_log->replay_path) {
+        child = cJSON_CreateString(input_log->replay_path);
+    } else {
+        child = cJSON_CreateNull();
+    }
+
+    cJSON_AddItemToObject(node, "replay", child);
+
+    if (input_log->replay_timing == INPUT_LOG_TIMING_FAST) {
+        cJSON_AddStringToObject(node, "replay_timing", "fast");
+    } else {
+        cJSON_AddStringToObject(node, "replay_timing", "original");
+    }
+
+    return node;
+}
+
+cJSON* config_serialize_discovery(const struct bluetooth_discovery_filter* filter) {
+    cJSON* node;
+    cJSON* child;
+    size_t i;
+
+    node = cJSON_CreateObject();
+    if (!node) {
+        return NULL;
+    }
+
+    if (filter->transport) {
+        child = cJSON_CreateString(filter->transport);
+    } else {
+        child = cJSON_CreateNull();
+    }
+
+    cJSON_AddItemToObject(node, "transport", child);
+    cJSON_AddNumberToObject(node, "rssi", filter->rssi);
+
+    child = cJSON_AddArrayToObject(node, "uuids");
+    for (i = 0; i < filter->uuid_count; i++) {
+        cJSON_AddItemToArray(child, cJSON_CreateString(filter->uuids[i]));
+    }
+
+    return node;
+}
+
+cJSON* config_serialize_reconnect(const struct bluetooth_reconnect_settings* reconnect) {
+    cJSON* node;
+
+    node = cJSON_CreateObject();
+    if (!node) {
+        return NULL;
+    }
+
+    cJSON_AddNumberToObject(node, "max_concurrent", reconnect->max_concurrent);
+    cJSON_AddNumberToObject(node, "max_attempts", reconnect->max_attempts);
+    cJSON_AddNumberToObject(node, "retry_delay_ms", reconnect->retry_delay_ms);
+
+    return node;
+}
+
+cJSON* config_serialize_bluetooth(const struct bluetooth_config* bluetooth) {
+    cJSON* node;
+    cJSON* child;
+
+    node = cJSON_CreateObject();
+    if (!node) {
+        return NULL;
+    }
+
+    if (bluetooth->bus_address) {
+        child = cJSON_CreateString(bluetooth->bus_address);
+    } else {
+        child = cJSON_CreateNull();
+    }
+
+    cJSON_AddItemToObject(node, "bus_address", child);
+
+    if (bluetooth->cache_path) {
+        child = cJSON_CreateString(bluetooth->cache_path);
+    } else {
+        child = cJSON_CreateNull();
+    }
+
+    cJSON_AddItemToObject(node, "cache_path", child);
+    cJSON_AddNumberToObject(node, "max_devices", bluetooth->max_devices);
+    cJSON_AddNumberToObject(node, "stale_timeout_ms", bluetooth->stale_timeout_ms);
+
+    child = config_serialize_discovery(&bluetooth->discovery);
+    if (!child) {
+        cJSON_Delete(node);
+        return NULL;
+    }
+
+    cJSON_AddItemToObject(node, "discovery", child);
+
+    child = config_serialize_reconnect(&bluetooth->reconnect);
+    if (!child) {
+        cJSON_Delete(node);
+        return NULL;
+    }
+
+    cJSON_AddItemToObject(node, "reconnect", child);
+
+    return node;
+}
+
 cJSON* config_serialize(const struct robot_util_config* config) {
     cJSON* config_node;
     cJSON* child;
@@ -133,6 +662,14 @@ cJSON* config_serialize(const struct robot_util_config* config) {
 
     cJSON_AddItemToObject(config_node, "backend_name", child);
 
+    if (config->gpio_chip) {
+        child = cJSON_CreateString(config->gpio_chip);
+    } else {
+        child = cJSON_CreateNull();
+    }
+
+    cJSON_AddItemToObject(config_node, "gpio_chip", child);
+
     child = config_serialize_encoder_pins(&config->encoder_pins);
     if (!child) {
         cJSON_Delete(config_node);
@@ -141,6 +678,27 @@ cJSON* config_serialize(const struct robot_util_config* config) {
 
     cJSON_AddNumberToObject(config_node, "lcd_address", config->lcd_address);
     cJSON_AddItemToObject(config_node, "encoder_pins", child);
+    cJSON_AddStringToObject(config_node, "encoder_mode",
+                            config_serialize_encoder_mode(config->encoder_settings.mode));
+
+    cJSON_AddNumberToObject(config_node, "encoder_resolution",
+                            config->encoder_settings.resolution);
+
+    child = config_serialize_button(&config->encoder_settings.button);
+    if (!child) {
+        cJSON_Delete(config_node);
+        return NULL;
+    }
+
+    cJSON_AddItemToObject(config_node, "encoder_button", child);
+
+    child = config_serialize_input_thread(&config->input_thread);
+    if (!child) {
+        cJSON_Delete(config_node);
+        return NULL;
+    }
+
+    cJSON_AddItemToObject(config_node, "input_thread", child);
 
     if (config->update_url) {
         child = cJSON_CreateString(config->update_url);
@@ -150,6 +708,30 @@ cJSON* config_serialize(const struct robot_util_config* config) {
 
     cJSON_AddItemToObject(config_node, "update_url", child);
 
+    child = config_serialize_idle(&config->idle);
+    if (!child) {
+        cJSON_Delete(config_node);
+        return NULL;
+    }
+
+    cJSON_AddItemToObject(config_node, "idle", child);
+
+    child = config_serialize_input_log(&config->input_log);
+    if (!child) {
+        cJSON_Delete(config_node);
+        return NULL;
+    }
+
+    cJSON_AddItemToObject(config_node, "input_log", child);
+
+    child = config_serialize_bluetooth(&config->bluetooth);
+    if (!child) {
+        cJSON_Delete(config_node);
+        return NULL;
+    }
+
+    cJSON_AddItemToObject(config_node, "bluetooth", child);
+
     return config_node;
 }
 
@@ -240,6 +822,21 @@ int config_load_or_default(const char* path, struct robot_util_config* config) {
 }
 
 void config_destroy(struct robot_util_config* config) {
+    size_t i;
+
     free(config->backend_name);
+    free(config->gpio_chip);
     free(config->update_url);
+
+    free(config->input_log.record_path);
+    free(config->input_log.replay_path);
+
+    free(config->bluetooth.bus_address);
+    free(config->bluetooth.cache_path);
+    free(config->bluetooth.discovery.transport);
+    for (i = 0; i < config->bluetooth.discovery.uuid_count; i++) {
+        free(config->bluetooth.discovery.uuids[i]);
+    }
+
+    free(config->bluetooth.discovery.uuids);
 }
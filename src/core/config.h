@@ -2,15 +2,71 @@
 #define CONFIG_H
 
 #include "devices/rotary_encoder.h"
+#include "devices/encoder_thread.h"
+
+#include "ui/input_log.h"
+
+#include "core/bluetooth_settings.h"
 
 #include <stdint.h>
 
+struct idle_config {
+    // milliseconds without input before the app goes idle. 0 disables idle mode
+    uint32_t timeout_ms;
+
+    // milliseconds between ticks while idle
+    uint32_t tick_interval_ms;
+
+    // turn the LCD backlight off while idle
+    int dim_backlight;
+};
+
+struct input_log_config {
+    // file to record every input to. null disables recording
+    char* record_path;
+
+    // file to replay input from, on top of the backend. null disables replay
+    char* replay_path;
+    input_log_timing replay_timing;
+};
+
+struct bluetooth_config {
+    // d-bus address bluez is reached on. null means the system bus
+    char* bus_address;
+
+    // known devices are saved here, so that the bluetooth menu has something to show before bluez
+    // catches up. null disables the cache
+    char* cache_path;
+
+    // rows in the bluetooth menu. paired devices come first, then the strongest signals
+    uint32_t max_devices;
+
+    // milliseconds an unpaired device may go without advertising before it is hidden
+    uint32_t stale_timeout_ms;
+
+    // applied while the bluetooth menu is open, which is the only time devices are discovered
+    struct bluetooth_discovery_filter discovery;
+
+    // paired and trusted devices connected to at startup
+    struct bluetooth_reconnect_settings reconnect;
+};
+
 struct robot_util_config {
     char* backend_name;
 
+    // gpio chip device the encoder is on. null means /dev/gpiochip0. see protocol/gpio_sim.h for
+    // simulated chips
+    char* gpio_chip;
+
     struct rotary_encoder_pins encoder_pins;
+    struct rotary_encoder_settings encoder_settings;
+    struct encoder_thread_settings input_thread;
     uint16_t lcd_address;
 
+    struct idle_config idle;
+    struct input_log_config input_log;
+    struct bluetooth_config bluetooth;
+
     // url to send a GET request to for image updates. use this with an application like watchtower
     char* update_url;
 };
@@ -0,0 +1,90 @@
+#include "core/ring.h"
+
+#include <malloc.h>
+#include <string.h>
+
+#include <stdatomic.h>
+
+struct ring {
+    size_t element_size;
+
+    // always a power of two, so that indices wrap with a mask
+    size_t capacity;
+    size_t mask;
+
+    // free-running counters. head is written by the consumer, tail by the producer
+    atomic_size_t head;
+    atomic_size_t tail;
+
+    unsigned char* data;
+};
+
+ring_t* ring_alloc(size_t element_size, size_t capacity) {
+    ring_t* ring;
+    size_t rounded;
+
+    if (element_size == 0 || capacity == 0) {
+        return NULL;
+    }
+
+    rounded = 1;
+    while (rounded < capacity) {
+        rounded <<= 1;
+    }
+
+    ring = (ring_t*)malloc(sizeof(ring_t));
+    ring->element_size = element_size;
+    ring->capacity = rounded;
+    ring->mask = rounded - 1;
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+
+    ring->data = (unsigned char*)malloc(element_size * rounded);
+    return ring;
+}
+
+void ring_free(ring_t* ring) {
+    if (!ring) {
+        return;
+    }
+
+    free(ring->data);
+    free(ring);
+}
+
+int ring_push(ring_t* ring, const void* element) {
+    size_t head, tail;
+
+    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (tail - head >= ring->capacity) {
+        return 0;
+    }
+
+    memcpy(ring->data + (tail & ring->mask) * ring->element_size, element, ring->element_size);
+
+    // publish the element only after it has been written
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+int ring_pop(ring_t* ring, void* element) {
+    size_t head, tail;
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head == tail) {
+        return 0;
+    }
+
+    memcpy(element, ring->data + (head & ring->mask) * ring->element_size, ring->element_size);
+
+    // hand the slot back to the producer only after it has been read
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 1;
+}
+
+size_t ring_get_capacity(const ring_t* ring) { return ring->capacity; }
@@ -0,0 +1,26 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+
+// a fixed-capacity queue of fixed-size elements, safe to use without locks as long as there is
+// exactly one producer thread and one consumer thread
+typedef struct ring ring_t;
+
+// allocates a ring holding at least capacity elements of element_size bytes each
+ring_t* ring_alloc(size_t element_size, size_t capacity);
+
+// frees a ring. neither thread may be using it anymore
+void ring_free(ring_t* ring);
+
+// copies an element into the ring. producer only. returns 1 on success, 0 if the ring is full
+int ring_push(ring_t* ring, const void* element);
+
+// copies the oldest element out of the ring. consumer only. returns 1 on success, 0 if the ring is
+// empty
+int ring_pop(ring_t* ring, void* element);
+
+// the number of elements the ring can hold
+size_t ring_get_capacity(const ring_t* ring);
+
+#endif
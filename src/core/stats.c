@@ -0,0 +1,101 @@
+#include "core/stats.h"
+
+#include "core/list.h"
+
+#include <malloc.h>
+#include <string.h>
+
+#include <pthread.h>
+
+struct stats_entry {
+    int id;
+    char* name;
+
+    stats_dump_callback_t callback;
+    void* user_data;
+};
+
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static list_t* stats_entries = NULL;
+static int stats_next_id = 1;
+
+int stats_register(const char* name, stats_dump_callback_t callback, void* user_data) {
+    struct stats_entry* entry;
+    int id;
+
+    if (!callback) {
+        return 0;
+    }
+
+    entry = (struct stats_entry*)malloc(sizeof(struct stats_entry));
+    entry->name = strdup(name);
+    entry->callback = callback;
+    entry->user_data = user_data;
+
+    pthread_mutex_lock(&stats_mutex);
+
+    if (!stats_entries) {
+        stats_entries = list_alloc();
+    }
+
+    id = entry->id = stats_next_id++;
+    list_insert(stats_entries, list_end(stats_entries), entry);
+
+    pthread_mutex_unlock(&stats_mutex);
+    return id;
+}
+
+void stats_unregister(int id) {
+    list_node_t* current_node;
+    struct stats_entry* entry;
+
+    if (id <= 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&stats_mutex);
+
+    current_node = stats_entries ? list_begin(stats_entries) : NULL;
+    while (current_node) {
+        entry = (struct stats_entry*)list_node_get(current_node);
+
+        if (entry->id == id) {
+            list_remove(stats_entries, current_node);
+
+            free(entry->name);
+            free(entry);
+
+            break;
+        }
+
+        current_node = list_node_next(current_node);
+    }
+
+    // nothing left to dump
+    if (stats_entries && !list_begin(stats_entries)) {
+        list_free(stats_entries);
+        stats_entries = NULL;
+    }
+
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+void stats_dump(FILE* stream) {
+    list_node_t* current_node;
+    struct stats_entry* entry;
+
+    pthread_mutex_lock(&stats_mutex);
+
+    current_node = stats_entries ? list_begin(stats_entries) : NULL;
+    while (current_node) {
+        entry = (struct stats_entry*)list_node_get(current_node);
+
+        fprintf(stream, "[%s]\n", entry->name);
+        entry->callback(entry->user_data, stream);
+
+        current_node = list_node_next(current_node);
+    }
+
+    fflush(stream);
+    pthread_mutex_unlock(&stats_mutex);
+}
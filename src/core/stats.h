@@ -0,0 +1,18 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+typedef void (*stats_dump_callback_t)(void* user_data, FILE* stream);
+
+// registers a subsystem whose counters are printed by stats_dump. copies name. returns an id to
+// pass to stats_unregister, or 0 on failure
+int stats_register(const char* name, stats_dump_callback_t callback, void* user_data);
+
+// removes a subsystem from the stats dump
+void stats_unregister(int id);
+
+// prints the counters of every registered subsystem to stream. thread-safe
+void stats_dump(FILE* stream);
+
+#endif
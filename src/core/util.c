@@ -7,6 +7,7 @@
 #include <sys/stat.h>
 
 #include <stdio.h>
+#include <time.h>
 
 #include <malloc.h>
 #include <string.h>
@@ -24,6 +25,20 @@ void util_time_diff(const struct timespec* t0, const struct timespec* t1, struct
     }
 }
 
+uint64_t util_get_monotonic_us() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+uint64_t util_get_realtime_us() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
 void util_set_bit_flag(uint8_t* dst, uint8_t flag, int enabled) {
     if (enabled) {
         *dst |= flag;
@@ -13,6 +13,12 @@ void util_sleep_ms(uint32_t ms);
 
 void util_time_diff(const struct timespec* t0, const struct timespec* t1, struct timespec* delta);
 
+// microseconds on CLOCK_MONOTONIC
+uint64_t util_get_monotonic_us();
+
+// microseconds on CLOCK_REALTIME. for times which have to mean something after a restart
+uint64_t util_get_realtime_us();
+
 void util_set_bit_flag(uint8_t* dst, uint8_t flag, int enabled);
 
 void* util_read_file(const char* path, size_t* size);
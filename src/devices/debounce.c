@@ -0,0 +1,100 @@
+#include "devices/debounce.h"
+
+#include <string.h>
+
+void debounce_init(struct debounce* input, const struct debounce_settings* settings, int active,
+                   uint64_t now_us) {
+    memcpy(&input->settings, settings, sizeof(struct debounce_settings));
+
+    input->raw = input->stable = active ? 1 : 0;
+    input->last_edge_us = now_us;
+    input->has_edge = 0;
+
+    // dont report a long press for an input which was already held when we started
+    input->long_press_sent = 1;
+}
+
+size_t debounce_emit(debounce_event_type type, uint64_t timestamp_us,
+                     struct debounce_event* events, size_t max_events) {
+    if (max_events == 0) {
+        return 0;
+    }
+
+    events[0].type = type;
+    events[0].timestamp_us = timestamp_us;
+
+    return 1;
+}
+
+size_t debounce_accept(struct debounce* input, uint64_t timestamp_us,
+                       struct debounce_event* events, size_t max_events) {
+    input->stable = input->raw;
+    input->last_edge_us = timestamp_us;
+    input->has_edge = 1;
+
+    if (input->stable) {
+        input->long_press_sent = 0;
+        return debounce_emit(DEBOUNCE_EVENT_PRESS, timestamp_us, events, max_events);
+    } else {
+        return debounce_emit(DEBOUNCE_EVENT_RELEASE, timestamp_us, events, max_events);
+    }
+}
+
+int debounce_in_window(const struct debounce* input, uint64_t timestamp_us) {
+    return input->has_edge && timestamp_us >= input->last_edge_us &&
+           timestamp_us - input->last_edge_us < input->settings.window_us;
+}
+
+size_t debounce_update(struct debounce* input, int active, uint64_t timestamp_us,
+                       struct debounce_event* events, size_t max_events) {
+    size_t event_count;
+
+    // a long press may have come due before this edge
+    event_count = debounce_poll(input, timestamp_us, events, max_events);
+
+    input->raw = active ? 1 : 0;
+    if (input->raw == input->stable || debounce_in_window(input, timestamp_us)) {
+        // either nothing changed, or it is bounce. debounce_poll picks up the final level once the
+        // window has passed
+        return event_count;
+    }
+
+    event_count +=
+        debounce_accept(input, timestamp_us, events + event_count, max_events - event_count);
+
+    return event_count;
+}
+
+int debounce_is_settled(const struct debounce* input) {
+    if (input->raw != input->stable) {
+        return 0;
+    }
+
+    return !input->stable || input->long_press_sent || input->settings.long_press_us == 0;
+}
+
+size_t debounce_poll(struct debounce* input, uint64_t now_us, struct debounce_event* events,
+                     size_t max_events) {
+    size_t event_count;
+    uint64_t settled_us;
+
+    event_count = 0;
+
+    // the input settled on a different level than the edge we accepted
+    if (input->raw != input->stable && !debounce_in_window(input, now_us)) {
+        settled_us = input->last_edge_us + input->settings.window_us;
+        event_count += debounce_accept(input, settled_us, events, max_events);
+    }
+
+    if (input->stable && !input->long_press_sent && input->settings.long_press_us > 0 &&
+        now_us >= input->last_edge_us &&
+        now_us - input->last_edge_us >= input->settings.long_press_us) {
+        input->long_press_sent = 1;
+
+        event_count += debounce_emit(DEBOUNCE_EVENT_LONG_PRESS,
+                                     input->last_edge_us + input->settings.long_press_us,
+                                     events + event_count, max_events - event_count);
+    }
+
+    return event_count;
+}
@@ -0,0 +1,60 @@
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum debounce_event_type {
+    DEBOUNCE_EVENT_PRESS = 0,
+    DEBOUNCE_EVENT_RELEASE,
+    DEBOUNCE_EVENT_LONG_PRESS,
+} debounce_event_type;
+
+struct debounce_event {
+    debounce_event_type type;
+    uint64_t timestamp_us;
+};
+
+struct debounce_settings {
+    // changes within this many microseconds of an accepted edge are contact bounce
+    uint32_t window_us;
+
+    // how long the input must be held to emit a long press. 0 disables long presses
+    uint32_t long_press_us;
+};
+
+// a single debounced input. the first edge is accepted immediately, and anything within the window
+// after it is ignored, so debouncing adds no delay
+struct debounce {
+    struct debounce_settings settings;
+
+    // last level seen, and the debounced level. 1 is active
+    int raw;
+    int stable;
+
+    // time of the last accepted edge, if any
+    uint64_t last_edge_us;
+    int has_edge;
+
+    int long_press_sent;
+};
+
+// initializes a debounced input which is currently at level active
+void debounce_init(struct debounce* input, const struct debounce_settings* settings, int active,
+                   uint64_t now_us);
+
+// feeds a sample or an edge at timestamp_us. writes at most max_events events. returns the number
+// of events written
+size_t debounce_update(struct debounce* input, int active, uint64_t timestamp_us,
+                       struct debounce_event* events, size_t max_events);
+
+// returns 1 if debounce_poll has nothing left to report until the input changes again, so that
+// callers can stop polling
+int debounce_is_settled(const struct debounce* input);
+
+// advances time without a new sample, for long presses and for edges which settled inside the
+// window. call regularly. returns the number of events written
+size_t debounce_poll(struct debounce* input, uint64_t now_us, struct debounce_event* events,
+                     size_t max_events);
+
+#endif
@@ -0,0 +1,306 @@
+// for pthread_setaffinity_np
+#define _GNU_SOURCE
+
+#include "devices/encoder_thread.h"
+
+#include "core/ring.h"
+#include "core/stats.h"
+#include "core/util.h"
+
+#include <malloc.h>
+#include <string.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+// events which can be queued before the ui thread has to drain them
+#define ENCODER_THREAD_RING_CAPACITY 256
+
+// how often to sample in poll mode
+#define ENCODER_THREAD_POLL_INTERVAL_MS 1
+
+// in poll mode, sampling slows to this once the encoder has been still for ENCODER_THREAD_IDLE_MS.
+// still short enough to see every quarter step of a hand turned detent
+#define ENCODER_THREAD_IDLE_POLL_INTERVAL_MS 5
+#define ENCODER_THREAD_IDLE_MS 1000
+
+// how often to wake without edges in event mode while the button has something left to report,
+// so that long presses are reported on time. otherwise the thread sleeps until the next edge
+#define ENCODER_THREAD_IDLE_INTERVAL_MS 10
+
+struct encoder_thread {
+    rotary_encoder_t* encoder;
+    struct encoder_thread_settings settings;
+
+    pthread_t thread;
+    int thread_started;
+
+    ring_t* events;
+
+    // written by the encoder thread once events are queued
+    int notify_fd;
+
+    // written by the ui thread to stop the encoder thread
+    int stop_fd;
+
+    atomic_int failed;
+
+    atomic_ullong events_queued;
+    atomic_ullong events_dropped;
+
+    int stats_id;
+};
+
+void encoder_thread_signal(int fd) {
+    uint64_t value;
+
+    value = 1;
+    if (write(fd, &value, sizeof(uint64_t)) < 0 && errno != EAGAIN) {
+        perror("write");
+    }
+}
+
+void encoder_thread_apply_settings(encoder_thread_t* thread) {
+    struct sched_param param;
+    cpu_set_t cpus;
+    int error;
+
+    if (thread->settings.cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(thread->settings.cpu, &cpus);
+
+        error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+        if (error) {
+            fprintf(stderr, "Failed to pin encoder thread to CPU %d: %s\n", thread->settings.cpu,
+                    strerror(error));
+        }
+    }
+
+    if (thread->settings.priority > 0) {
+        memset(&param, 0, sizeof(struct sched_param));
+        param.sched_priority = thread->settings.priority;
+
+        // needs CAP_SYS_NICE. the thread still helps without it
+        error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (error) {
+            fprintf(stderr, "Failed to set encoder thread priority: %s\n", strerror(error));
+        }
+    }
+}
+
+void encoder_thread_queue(encoder_thread_t* thread, const struct encoder_event* event) {
+    if (ring_push(thread->events, event)) {
+        atomic_fetch_add_explicit(&thread->events_queued, 1, memory_order_relaxed);
+    } else {
+        atomic_fetch_add_explicit(&thread->events_dropped, 1, memory_order_relaxed);
+    }
+}
+
+// returns 1 if anything was queued
+int encoder_thread_queue_input(encoder_thread_t* thread, const struct rotary_encoder_input* input) {
+    struct encoder_event event;
+    size_t i;
+
+    if (input->motion != 0) {
+        event.type = ENCODER_EVENT_MOTION;
+        event.motion.steps = input->motion;
+        event.motion.velocity = input->velocity;
+        event.motion.timestamp_us = input->motion_timestamp_us;
+
+        encoder_thread_queue(thread, &event);
+    }
+
+    for (i = 0; i < input->button_event_count; i++) {
+        event.type = ENCODER_EVENT_BUTTON;
+        memcpy(&event.button, &input->button_events[i], sizeof(struct debounce_event));
+
+        encoder_thread_queue(thread, &event);
+    }
+
+    return input->motion != 0 || input->button_event_count > 0;
+}
+
+void* encoder_thread_run(void* arg) {
+    encoder_thread_t* thread;
+    struct rotary_encoder_input input;
+
+    struct pollfd fds[ROTARY_ENCODER_MAX_FDS + 1];
+    size_t fd_count, i;
+    int encoder_fds[ROTARY_ENCODER_MAX_FDS];
+    int timeout_ms;
+    uint64_t last_input_us, now_us;
+
+    thread = (encoder_thread_t*)arg;
+    encoder_thread_apply_settings(thread);
+
+    fd_count = rotary_encoder_get_fds(thread->encoder, encoder_fds, ROTARY_ENCODER_MAX_FDS);
+    if (fd_count > ROTARY_ENCODER_MAX_FDS) {
+        fd_count = ROTARY_ENCODER_MAX_FDS;
+    }
+
+    for (i = 0; i < fd_count; i++) {
+        fds[i].fd = encoder_fds[i];
+        fds[i].events = POLLIN;
+    }
+
+    fds[fd_count].fd = thread->stop_fd;
+    fds[fd_count].events = POLLIN;
+
+    last_input_us = util_get_monotonic_us();
+    timeout_ms = 0;
+
+    while (1) {
+        for (i = 0; i <= fd_count; i++) {
+            fds[i].revents = 0;
+        }
+
+        if (poll(fds, (nfds_t)(fd_count + 1), timeout_ms) < 0 && errno != EINTR) {
+            perror("poll");
+        }
+
+        if (fds[fd_count].revents & POLLIN) {
+            break;
+        }
+
+        if (!rotary_encoder_get(thread->encoder, &input)) {
+            atomic_store(&thread->failed, 1);
+            encoder_thread_signal(thread->notify_fd);
+
+            break;
+        }
+
+        now_us = util_get_monotonic_us();
+        if (encoder_thread_queue_input(thread, &input)) {
+            encoder_thread_signal(thread->notify_fd);
+            last_input_us = now_us;
+        }
+
+        if (fd_count > 0) {
+            // edges wake the thread, so only the button's timers need a timeout
+            timeout_ms =
+                rotary_encoder_is_settled(thread->encoder) ? -1 : ENCODER_THREAD_IDLE_INTERVAL_MS;
+        } else if (now_us - last_input_us >= (uint64_t)ENCODER_THREAD_IDLE_MS * 1000 &&
+                   rotary_encoder_is_settled(thread->encoder)) {
+            // in poll mode, there are no edges to wait on
+            timeout_ms = ENCODER_THREAD_IDLE_POLL_INTERVAL_MS;
+        } else {
+            timeout_ms = ENCODER_THREAD_POLL_INTERVAL_MS;
+        }
+    }
+
+    return NULL;
+}
+
+void encoder_thread_dump_stats(void* user_data, FILE* stream) {
+    encoder_thread_t* thread;
+
+    thread = (encoder_thread_t*)user_data;
+
+    fprintf(stream, "events queued: %llu\n", atomic_load(&thread->events_queued));
+    fprintf(stream, "events dropped: %llu\n", atomic_load(&thread->events_dropped));
+}
+
+void encoder_thread_free(encoder_thread_t* thread) {
+    if (thread->notify_fd >= 0) {
+        close(thread->notify_fd);
+    }
+
+    if (thread->stop_fd >= 0) {
+        close(thread->stop_fd);
+    }
+
+    ring_free(thread->events);
+    free(thread);
+}
+
+encoder_thread_t* encoder_thread_start(rotary_encoder_t* encoder,
+                                       const struct encoder_thread_settings* settings) {
+    encoder_thread_t* thread;
+    int error;
+
+    thread = (encoder_thread_t*)malloc(sizeof(encoder_thread_t));
+    memset(thread, 0, sizeof(encoder_thread_t));
+
+    thread->encoder = encoder;
+    memcpy(&thread->settings, settings, sizeof(struct encoder_thread_settings));
+
+    atomic_init(&thread->failed, 0);
+    atomic_init(&thread->events_queued, 0);
+    atomic_init(&thread->events_dropped, 0);
+
+    thread->events = ring_alloc(sizeof(struct encoder_event), ENCODER_THREAD_RING_CAPACITY);
+    thread->notify_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    thread->stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (thread->notify_fd < 0 || thread->stop_fd < 0) {
+        perror("eventfd");
+
+        encoder_thread_free(thread);
+        return NULL;
+    }
+
+    // affects the whole process, not just this thread
+    if (settings->lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        perror("mlockall");
+    }
+
+    error = pthread_create(&thread->thread, NULL, encoder_thread_run, thread);
+    if (error) {
+        fprintf(stderr, "Failed to start encoder thread: %s\n", strerror(error));
+
+        encoder_thread_free(thread);
+        return NULL;
+    }
+
+    thread->thread_started = 1;
+    thread->stats_id = stats_register("input", encoder_thread_dump_stats, thread);
+
+    return thread;
+}
+
+void encoder_thread_stop(encoder_thread_t* thread) {
+    if (!thread) {
+        return;
+    }
+
+    stats_unregister(thread->stats_id);
+
+    if (thread->thread_started) {
+        encoder_thread_signal(thread->stop_fd);
+        pthread_join(thread->thread, NULL);
+    }
+
+    rotary_encoder_close(thread->encoder);
+    encoder_thread_free(thread);
+}
+
+int encoder_thread_get_fd(encoder_thread_t* thread) { return thread->notify_fd; }
+
+size_t encoder_thread_read(encoder_thread_t* thread, struct encoder_event* events,
+                           size_t max_events) {
+    uint64_t value;
+    size_t event_count;
+
+    // reset the notification before draining. anything queued after this signals again
+    if (read(thread->notify_fd, &value, sizeof(uint64_t)) < 0 && errno != EAGAIN) {
+        perror("read");
+    }
+
+    event_count = 0;
+    while (event_count < max_events && ring_pop(thread->events, &events[event_count])) {
+        event_count++;
+    }
+
+    return event_count;
+}
+
+int encoder_thread_has_failed(encoder_thread_t* thread) { return atomic_load(&thread->failed); }
@@ -0,0 +1,63 @@
+#ifndef ENCODER_THREAD_H
+#define ENCODER_THREAD_H
+
+#include "devices/rotary_encoder.h"
+
+#include <stdint.h>
+
+struct encoder_thread_settings {
+    // read the encoder on a dedicated thread instead of the ui thread
+    int enabled;
+
+    // SCHED_FIFO priority of the thread, from 1 to 99. 0 keeps the default scheduler
+    int priority;
+
+    // lock all pages of the process into memory, so that the thread never waits on a page fault
+    int lock_memory;
+
+    // cpu to pin the thread to. -1 lets it run anywhere
+    int cpu;
+};
+
+typedef enum encoder_event_type {
+    ENCODER_EVENT_MOTION = 0,
+    ENCODER_EVENT_BUTTON,
+} encoder_event_type;
+
+struct encoder_event {
+    encoder_event_type type;
+
+    union {
+        // signed steps, and an estimate in signed steps per second. timestamp_us is the monotonic
+        // time of the edge which completed the last step, not of when it was queued
+        struct {
+            int32_t steps;
+            float velocity;
+            uint64_t timestamp_us;
+        } motion;
+
+        struct debounce_event button;
+    };
+};
+
+typedef struct encoder_thread encoder_thread_t;
+
+// starts a thread which reads encoder and queues its input. assumes ownership of encoder on success
+encoder_thread_t* encoder_thread_start(rotary_encoder_t* encoder,
+                                       const struct encoder_thread_settings* settings);
+
+// stops the thread and closes its encoder. queued events are discarded
+void encoder_thread_stop(encoder_thread_t* thread);
+
+// a file descriptor which is readable while events are queued, or once the thread has failed
+int encoder_thread_get_fd(encoder_thread_t* thread);
+
+// moves up to max_events queued events into events, oldest first. if max_events are returned, call
+// again, as more may be queued. returns the number of events read
+size_t encoder_thread_read(encoder_thread_t* thread, struct encoder_event* events,
+                           size_t max_events);
+
+// returns 1 if reading the encoder has failed. the thread stops after the first failure
+int encoder_thread_has_failed(encoder_thread_t* thread);
+
+#endif
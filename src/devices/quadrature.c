@@ -0,0 +1,110 @@
+#include "devices/quadrature.h"
+
+#include <string.h>
+
+// an encoder which hasnt stepped for this long is considered stopped
+#define QUADRATURE_VELOCITY_TIMEOUT_US 150000
+
+// weight of the newest step interval in the velocity estimate
+#define QUADRATURE_VELOCITY_SMOOTHING 0.5f
+
+// marks a transition where both lines changed. the direction cant be known, so it is noise
+#define X 2
+
+// indexed by (last state << 2) | current state, where a state is (a << 1) | b. clockwise is
+// 00 -> 10 -> 11 -> 01 -> 00
+static const int8_t quadrature_transitions[16] = {
+    0,  -1, 1,  X,  // from 00
+    1,  0,  X,  -1, // from 01
+    -1, X,  0,  1,  // from 10
+    X,  1,  -1, 0,  // from 11
+};
+
+void quadrature_init(struct quadrature_decoder* decoder, quadrature_resolution resolution, int a,
+                     int b) {
+    memset(decoder, 0, sizeof(struct quadrature_decoder));
+
+    decoder->resolution = resolution;
+    decoder->state = (uint8_t)((a ? 2 : 0) | (b ? 1 : 0));
+    decoder->rest_state = decoder->state;
+}
+
+int quadrature_is_detent(const struct quadrature_decoder* decoder) {
+    switch (decoder->resolution) {
+    case QUADRATURE_RESOLUTION_1X:
+        return decoder->state == decoder->rest_state;
+    case QUADRATURE_RESOLUTION_2X:
+        // halfway through a cycle, both lines are flipped
+        return decoder->state == decoder->rest_state || decoder->state == (decoder->rest_state ^ 3);
+    default:
+        return 1;
+    }
+}
+
+void quadrature_update_velocity(struct quadrature_decoder* decoder, int32_t steps,
+                                uint64_t timestamp_us) {
+    uint64_t interval_us;
+    float instantaneous;
+
+    interval_us = timestamp_us - decoder->last_step_us;
+    if (decoder->last_step_us == 0 || timestamp_us <= decoder->last_step_us ||
+        interval_us > QUADRATURE_VELOCITY_TIMEOUT_US) {
+        // starting from rest
+        decoder->velocity = 0;
+    } else {
+        instantaneous = (float)steps * 1e6f / (float)interval_us;
+
+        // reversing starts over
+        if (decoder->velocity == 0 || (instantaneous > 0) != (decoder->velocity > 0)) {
+            decoder->velocity = instantaneous;
+        } else {
+            decoder->velocity +=
+                (instantaneous - decoder->velocity) * QUADRATURE_VELOCITY_SMOOTHING;
+        }
+    }
+
+    decoder->last_step_us = timestamp_us;
+}
+
+int32_t quadrature_update(struct quadrature_decoder* decoder, int a, int b, uint64_t timestamp_us) {
+    uint8_t state;
+    int8_t transition;
+    int32_t quarters_per_step, steps;
+
+    state = (uint8_t)((a ? 2 : 0) | (b ? 1 : 0));
+    transition = quadrature_transitions[(decoder->state << 2) | state];
+    decoder->state = state;
+
+    if (transition == X) {
+        decoder->invalid_transitions++;
+        return 0;
+    }
+
+    // bounces cancel themselves out here
+    decoder->quarter_steps += transition;
+
+    quarters_per_step = 4 / (int32_t)decoder->resolution;
+    steps = decoder->quarter_steps / quarters_per_step;
+    decoder->quarter_steps -= steps * quarters_per_step;
+
+    // drop whatever is left of a partial step once back on a detent, so that the count stays
+    // aligned with the detents after noise
+    if (quadrature_is_detent(decoder)) {
+        decoder->quarter_steps = 0;
+    }
+
+    if (steps != 0) {
+        quadrature_update_velocity(decoder, steps, timestamp_us);
+    }
+
+    return steps;
+}
+
+float quadrature_get_velocity(const struct quadrature_decoder* decoder, uint64_t now_us) {
+    if (now_us > decoder->last_step_us &&
+        now_us - decoder->last_step_us > QUADRATURE_VELOCITY_TIMEOUT_US) {
+        return 0;
+    }
+
+    return decoder->velocity;
+}
@@ -0,0 +1,45 @@
+#ifndef QUADRATURE_H
+#define QUADRATURE_H
+
+#include <stdint.h>
+
+// quarter transitions per reported step are 4 / resolution
+typedef enum quadrature_resolution {
+    QUADRATURE_RESOLUTION_1X = 1,
+    QUADRATURE_RESOLUTION_2X = 2,
+    QUADRATURE_RESOLUTION_4X = 4,
+} quadrature_resolution;
+
+struct quadrature_decoder {
+    quadrature_resolution resolution;
+
+    // last A/B state, as (a << 1) | b
+    uint8_t state;
+
+    // state the encoder rests in at a detent
+    uint8_t rest_state;
+
+    // quarter transitions which have not been reported as a step yet
+    int32_t quarter_steps;
+
+    // signed steps per second
+    float velocity;
+    uint64_t last_step_us;
+
+    // transitions where both A and B changed at once
+    uint32_t invalid_transitions;
+};
+
+// initializes a decoder. the current state is assumed to be a detent
+void quadrature_init(struct quadrature_decoder* decoder, quadrature_resolution resolution, int a,
+                     int b);
+
+// feeds a new A/B state, sampled or reconstructed from an edge at timestamp_us. returns the signed
+// number of steps this completed
+int32_t quadrature_update(struct quadrature_decoder* decoder, int a, int b, uint64_t timestamp_us);
+
+// returns the velocity estimate in signed steps per second as of now_us. decays to 0 once the
+// encoder stops
+float quadrature_get_velocity(const struct quadrature_decoder* decoder, uint64_t now_us);
+
+#endif
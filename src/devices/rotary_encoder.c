@@ -2,64 +2,93 @@
 
 #include "protocol/gpio.h"
 
+#include "core/util.h"
+
 #include <malloc.h>
 #include <string.h>
 
+#include <time.h>
+
+// order of lines in the encoder's line group
+enum {
+    ROTARY_ENCODER_LINE_A = 0,
+    ROTARY_ENCODER_LINE_B,
+    ROTARY_ENCODER_LINE_SW,
+    ROTARY_ENCODER_LINE_COUNT,
+};
+
+// edge events processed per read in event mode
+#define ROTARY_ENCODER_EVENT_BATCH_SIZE 64
+
 struct rotary_encoder_state {
     int a, b;
+    int sw;
 };
 
 struct rotary_encoder {
-    gpio_chip_t* chip;
+    gpio_line_group_t* lines;
     struct rotary_encoder_pins pins;
+    rotary_encoder_mode mode;
 
     struct rotary_encoder_state last_state;
+    struct quadrature_decoder decoder;
+    struct debounce button;
 };
 
-int rotary_encoder_sample(rotary_encoder_t* encoder, struct rotary_encoder_state* state) {
-    unsigned int pins[2];
-    int values[2];
-
-    int success;
+uint64_t rotary_encoder_get_timestamp_us(const struct timespec* timestamp) {
+    return (uint64_t)timestamp->tv_sec * 1000000 + (uint64_t)timestamp->tv_nsec / 1000;
+}
 
-    pins[0] = encoder->pins.a;
-    pins[1] = encoder->pins.b;
+int rotary_encoder_sample(rotary_encoder_t* encoder, struct rotary_encoder_state* state) {
+    int values[ROTARY_ENCODER_LINE_COUNT];
 
-    if (!gpio_get_digital(encoder->chip, 2, pins, values)) {
+    // one read for all three lines. this also works for lines requested for events
+    if (!gpio_line_group_get(encoder->lines, values)) {
         return 0;
     }
 
-    state->a = values[0];
-    state->b = values[1];
+    state->a = values[ROTARY_ENCODER_LINE_A];
+    state->b = values[ROTARY_ENCODER_LINE_B];
+    state->sw = values[ROTARY_ENCODER_LINE_SW];
 
     return 1;
 }
 
-rotary_encoder_t* rotary_encoder_open(gpio_chip_t* chip, const struct rotary_encoder_pins* pins) {
+rotary_encoder_t* rotary_encoder_open(gpio_chip_t* chip, const struct rotary_encoder_pins* pins,
+                                      const struct rotary_encoder_settings* settings) {
     rotary_encoder_t* encoder;
-    struct gpio_request_config config;
-
-    unsigned int rotary_pins[2];
+    struct gpio_line_config lines[ROTARY_ENCODER_LINE_COUNT];
+    gpio_request_type request_type;
+    struct timespec now;
+    size_t i;
 
     encoder = (rotary_encoder_t*)malloc(sizeof(rotary_encoder_t));
-    encoder->chip = chip;
-
     memcpy(&encoder->pins, pins, sizeof(struct rotary_encoder_pins));
+    encoder->mode = settings->mode;
 
-    config.type = GPIO_REQUEST_DIRECTION_INPUT;
-    config.flags = GPIO_REQUEST_FLAG_BIAS_PULL_DOWN;
+    if (encoder->mode == ROTARY_ENCODER_MODE_EVENTS) {
+        request_type = GPIO_REQUEST_EVENT_BOTH_EDGES;
+    } else {
+        request_type = GPIO_REQUEST_DIRECTION_INPUT;
+    }
 
-    rotary_pins[0] = pins->a;
-    rotary_pins[1] = pins->b;
+    lines[ROTARY_ENCODER_LINE_A].pin = pins->a;
+    lines[ROTARY_ENCODER_LINE_B].pin = pins->b;
+    lines[ROTARY_ENCODER_LINE_SW].pin = pins->sw;
 
-    if (!gpio_set_pin_request(chip, 2, rotary_pins, &config)) {
-        rotary_encoder_close(encoder);
-        return NULL;
+    for (i = 0; i < ROTARY_ENCODER_LINE_COUNT; i++) {
+        lines[i].request.type = request_type;
+        lines[i].request.flags = GPIO_REQUEST_FLAG_BIAS_PULL_DOWN;
+
+        // the button is debounced in software without delaying the first edge, and the quadrature
+        // decoder already rejects bounce on a and b
+        lines[i].request.debounce_period_us = 0;
     }
 
-    config.flags = GPIO_REQUEST_FLAG_BIAS_PULL_UP;
+    lines[ROTARY_ENCODER_LINE_SW].request.flags = GPIO_REQUEST_FLAG_BIAS_PULL_UP;
 
-    if (!gpio_set_pin_request(chip, 1, &pins->sw, &config)) {
+    encoder->lines = gpio_line_group_request(chip, ROTARY_ENCODER_LINE_COUNT, lines);
+    if (!encoder->lines) {
         rotary_encoder_close(encoder);
         return NULL;
     }
@@ -69,6 +98,14 @@ rotary_encoder_t* rotary_encoder_open(gpio_chip_t* chip, const struct rotary_enc
         return NULL;
     }
 
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    quadrature_init(&encoder->decoder, settings->resolution, encoder->last_state.a,
+                    encoder->last_state.b);
+
+    debounce_init(&encoder->button, &settings->button, !encoder->last_state.sw,
+                  rotary_encoder_get_timestamp_us(&now));
+
     return encoder;
 }
 
@@ -77,61 +114,121 @@ void rotary_encoder_close(rotary_encoder_t* encoder) {
         return;
     }
 
+    gpio_line_group_release(encoder->lines);
     free(encoder);
 }
 
-int rotary_encoder_get_direction(const struct rotary_encoder_state* current,
-                                 const struct rotary_encoder_state* last) {
-    // we dont want duplicate signals
-    if (current->a == last->a && current->b == last->b) {
-        return 0;
-    }
+void rotary_encoder_update_button(rotary_encoder_t* encoder, int sw, uint64_t timestamp_us,
+                                  struct rotary_encoder_input* input) {
+    size_t max_events;
 
-    if (current->a && !last->a && !current->b) {
-        return 1;
-    }
-
-    if (current->b && !last->b && !current->a) {
-        return -1;
-    }
+    max_events = ARRAYSIZE(input->button_events) - input->button_event_count;
 
-    return 0;
+    // the switch pulls the line low when pressed
+    input->button_event_count +=
+        debounce_update(&encoder->button, !sw, timestamp_us,
+                        input->button_events + input->button_event_count, max_events);
 }
 
-int rotary_encoder_get_motion(rotary_encoder_t* encoder, int* motion) {
-    struct rotary_encoder_state state;
-    if (!rotary_encoder_sample(encoder, &state)) {
-        return 0;
-    }
-
-    *motion = rotary_encoder_get_direction(&state, &encoder->last_state);
-    memcpy(&encoder->last_state, &state, sizeof(struct rotary_encoder_state));
+// replays queued edges in order, so that no transition is missed between calls
+int rotary_encoder_read_events(rotary_encoder_t* encoder, struct rotary_encoder_state* state,
+                               struct rotary_encoder_input* input) {
+    struct gpio_line_event events[ROTARY_ENCODER_EVENT_BATCH_SIZE];
+    uint64_t timestamp_us;
+    ssize_t event_count, i;
+    int32_t steps;
+
+    memcpy(state, &encoder->last_state, sizeof(struct rotary_encoder_state));
+
+    do {
+        event_count = gpio_line_group_read_events(encoder->lines, events, ARRAYSIZE(events));
+        if (event_count < 0) {
+            return 0;
+        }
+
+        for (i = 0; i < event_count; i++) {
+            timestamp_us = rotary_encoder_get_timestamp_us(&events[i].timestamp);
+
+            switch (events[i].line) {
+            case ROTARY_ENCODER_LINE_A:
+                state->a = events[i].rising;
+                break;
+            case ROTARY_ENCODER_LINE_B:
+                state->b = events[i].rising;
+                break;
+            case ROTARY_ENCODER_LINE_SW:
+                state->sw = events[i].rising;
+                rotary_encoder_update_button(encoder, state->sw, timestamp_us, input);
+
+                continue;
+            }
+
+            steps = quadrature_update(&encoder->decoder, state->a, state->b, timestamp_us);
+            if (steps != 0) {
+                input->motion += steps;
+                input->motion_timestamp_us = timestamp_us;
+            }
+        }
+    } while (event_count == ARRAYSIZE(events));
 
     return 1;
 }
 
-int rotary_encoder_get_pressed(rotary_encoder_t* encoder, int* pressed) {
-    int high;
-    if (!gpio_get_digital(encoder->chip, 1, &encoder->pins.sw, &high)) {
-        return 0;
+int rotary_encoder_get(rotary_encoder_t* encoder, struct rotary_encoder_input* input) {
+    struct rotary_encoder_state state;
+    struct timespec now;
+    uint64_t now_us;
+    size_t max_events;
+
+    memset(input, 0, sizeof(struct rotary_encoder_input));
+
+    if (encoder->mode == ROTARY_ENCODER_MODE_EVENTS) {
+        if (!rotary_encoder_read_events(encoder, &state, input)) {
+            return 0;
+        }
+
+        // kernel edge timestamps are on CLOCK_MONOTONIC too
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        now_us = rotary_encoder_get_timestamp_us(&now);
+    } else {
+        if (!rotary_encoder_sample(encoder, &state)) {
+            return 0;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        now_us = rotary_encoder_get_timestamp_us(&now);
+
+        input->motion = quadrature_update(&encoder->decoder, state.a, state.b, now_us);
+        if (input->motion != 0) {
+            input->motion_timestamp_us = now_us;
+        }
+
+        rotary_encoder_update_button(encoder, state.sw, now_us, input);
     }
 
-    *pressed = !high;
-    return 1;
-}
+    // as of the edge, so that a late call doesn't see the estimate decay
+    if (input->motion != 0) {
+        input->velocity = quadrature_get_velocity(&encoder->decoder, input->motion_timestamp_us);
+    }
 
-int rotary_encoder_get(rotary_encoder_t* encoder, int* pressed, int* motion) {
-    int success;
+    // long presses and bounce that settled without another edge
+    max_events = ARRAYSIZE(input->button_events) - input->button_event_count;
+    input->button_event_count +=
+        debounce_poll(&encoder->button, now_us, input->button_events + input->button_event_count,
+                      max_events);
 
-    success = 1;
+    memcpy(&encoder->last_state, &state, sizeof(struct rotary_encoder_state));
+    return 1;
+}
 
-    if (motion) {
-        success &= rotary_encoder_get_motion(encoder, motion);
-    }
+int rotary_encoder_is_settled(rotary_encoder_t* encoder) {
+    return debounce_is_settled(&encoder->button);
+}
 
-    if (pressed) {
-        success &= rotary_encoder_get_pressed(encoder, pressed);
+size_t rotary_encoder_get_fds(rotary_encoder_t* encoder, int* fds, size_t max_fds) {
+    if (encoder->mode != ROTARY_ENCODER_MODE_EVENTS) {
+        return 0;
     }
 
-    return success;
+    return gpio_line_group_get_fds(encoder->lines, fds, max_fds);
 }
@@ -1,22 +1,75 @@
 #ifndef ROTARY_ENCODER_H
 #define ROTARY_ENCODER_H
 
+#include "devices/quadrature.h"
+#include "devices/debounce.h"
+
+#include <stddef.h>
+
 struct rotary_encoder_pins {
     unsigned int a, b;
     unsigned int sw;
 };
 
+typedef enum rotary_encoder_mode {
+    // sample the lines on each call to rotary_encoder_get. transitions between calls are missed
+    ROTARY_ENCODER_MODE_POLL = 0,
+
+    // have the kernel queue every edge, and replay them on each call to rotary_encoder_get
+    ROTARY_ENCODER_MODE_EVENTS,
+} rotary_encoder_mode;
+
+struct rotary_encoder_settings {
+    rotary_encoder_mode mode;
+
+    // steps reported per detent cycle
+    quadrature_resolution resolution;
+
+    // debounce window and long press duration of the push switch
+    struct debounce_settings button;
+};
+
+// upper bound on button events reported by one call to rotary_encoder_get
+#define ROTARY_ENCODER_MAX_BUTTON_EVENTS 8
+
+struct rotary_encoder_input {
+    // signed steps since the last call. positive for clockwise, negative for counter-clockwise
+    int32_t motion;
+
+    // estimate in signed steps per second, as of the last step
+    float velocity;
+
+    // monotonic time of the edge or sample which completed the last step. 0 without motion
+    uint64_t motion_timestamp_us;
+
+    // debounced press, release, and long press events since the last call, oldest first
+    struct debounce_event button_events[ROTARY_ENCODER_MAX_BUTTON_EVENTS];
+    size_t button_event_count;
+};
+
+// upper bound on the descriptors returned by rotary_encoder_get_fds
+#define ROTARY_ENCODER_MAX_FDS 3
+
 typedef struct gpio_chip gpio_chip_t;
 typedef struct rotary_encoder rotary_encoder_t;
 
 // open a rotary encoder
-rotary_encoder_t* rotary_encoder_open(gpio_chip_t* chip, const struct rotary_encoder_pins* pins);
+rotary_encoder_t* rotary_encoder_open(gpio_chip_t* chip, const struct rotary_encoder_pins* pins,
+                                      const struct rotary_encoder_settings* settings);
 
 // close a rotary encoder
 void rotary_encoder_close(rotary_encoder_t* encoder);
 
-// sample the state of a rotary encoder. "clicked" is 1 if the button is pressed down. moved is
-// non-zero if the encoder was moved. positive for clockwise, negative for counter-clockwise
-int rotary_encoder_get(rotary_encoder_t* encoder, int* pressed, int* motion);
+// collect input from a rotary encoder since the last call. call regularly, even without edges
+// pending, so that long presses are reported. returns 1 on success, 0 on failure
+int rotary_encoder_get(rotary_encoder_t* encoder, struct rotary_encoder_input* input);
+
+// returns 1 if rotary_encoder_get has nothing to report until the lines change. in event mode, a
+// caller can then wait on the descriptors alone
+int rotary_encoder_is_settled(rotary_encoder_t* encoder);
+
+// retrieves file descriptors which become readable when the encoder has input to process, for use
+// with poll. writes at most max_fds. returns the number of descriptors, which is 0 in poll mode
+size_t rotary_encoder_get_fds(rotary_encoder_t* encoder, int* fds, size_t max_fds);
 
 #endif
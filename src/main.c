@@ -2,6 +2,8 @@
 #include "protocol/i2c.h"
 
 #include "core/config.h"
+#include "core/stats.h"
+#include "core/util.h"
 
 #include "ui/menu.h"
 #include "ui/app.h"
@@ -14,6 +16,9 @@
 #include <malloc.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
 
 struct robot_util_config* config;
 
@@ -23,6 +28,14 @@ i2c_device_t* device;
 
 app_t* app;
 
+volatile sig_atomic_t stats_requested;
+
+// set by --bench. the bluetooth menu is opened without a screen, and the app exits after this long
+uint32_t bench_seconds;
+uint64_t bench_end_us;
+
+void handle_stats_signal(int signum) { stats_requested = 1; }
+
 int init() {
     rotary_encoder_t* encoder;
 
@@ -37,11 +50,19 @@ int init() {
 
     app = NULL;
 
+    stats_requested = 0;
+    signal(SIGUSR1, handle_stats_signal);
+
     config = (struct robot_util_config*)malloc(sizeof(struct robot_util_config));
     if (!config_load_or_default("config/util.json", config)) {
         return 1;
     }
 
+    if (bench_seconds > 0) {
+        free(config->backend_name);
+        config->backend_name = strdup("null");
+    }
+
     app = app_create(config);
     config = NULL;
 
@@ -49,12 +70,24 @@ int init() {
         return 1;
     }
 
+    if (bench_seconds > 0) {
+        menu = app_get_top(app);
+        if (!menu) {
+            return 1;
+        }
+
+        menus_main_open_bluetooth(menu);
+        bench_end_us = util_get_monotonic_us() + (uint64_t)bench_seconds * 1000000;
+    }
+
     return 0;
 }
 
 void shutdown() {
     struct hd44780_screen_config screen_config;
 
+    stats_dump(stderr);
+
     app_destroy(app);
 
     i2c_device_close(device);
@@ -70,10 +103,32 @@ void shutdown() {
 int main(int argc, const char** argv) {
     int result;
 
+    bench_seconds = 0;
+    bench_end_us = 0;
+
+    if (argc == 3 && !strcmp(argv[1], "--bench")) {
+        bench_seconds = (uint32_t)strtoul(argv[2], NULL, 10);
+    }
+
+    if (argc != 1 && bench_seconds == 0) {
+        fprintf(stderr, "Usage: %s [--bench <seconds>]\n", argv[0]);
+        return 1;
+    }
+
     result = init();
     if (!result) {
         while (!app_should_exit(app)) {
             app_update(app);
+
+            // kill -USR1 dumps subsystem counters
+            if (stats_requested) {
+                stats_requested = 0;
+                stats_dump(stderr);
+            }
+
+            if (bench_end_us && util_get_monotonic_us() >= bench_end_us) {
+                app_request_exit(app, 0);
+            }
         }
 
         result = app_get_status(app);
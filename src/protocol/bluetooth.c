@@ -3,6 +3,7 @@
 #include "core/map.h"
 #include "core/list.h"
 
+#include "core/stats.h"
 #include "core/util.h"
 
 #include "protocol/dbus.h"
@@ -20,11 +21,42 @@
 #define BLUEZ_BUS_NAME "org.bluez"
 #define DEVICE_INTERFACE_NAME "org.bluez.Device1"
 #define ADAPTER_INTERFACE_NAME "org.bluez.Adapter1"
-#define PROPERTIES_INTERFACE_NAME "org.freedesktop.DBus.Properties"
+#define AGENT_INTERFACE_NAME "org.bluez.Agent1"
+#define AGENT_MANAGER_INTERFACE_NAME "org.bluez.AgentManager1"
+
+#define BLUEZ_ROOT_PATH "/org/bluez"
+#define BLUETOOTH_AGENT_PATH "/org/robot_util/agent"
+
+// we can neither show nor enter a code, so bluez falls back to just works pairing
+#define BLUETOOTH_AGENT_CAPABILITY "NoInputNoOutput"
+
+// how long interfaces coming and going are collected before they are applied at once
+#define BLUETOOTH_BATCH_WINDOW_MS 100
+
+// both borrow the object manager's proxies, which already hold the properties from
+// GetManagedObjects and track PropertiesChanged
 
 struct bluetooth_device {
-    GDBusProxy* device_proxy;
-    GDBusProxy* properties_proxy;
+    GDBusProxy* proxy;
+    gulong properties_changed_handler;
+
+    // cached properties. guarded by the connection's mutex
+    char* name;
+    char* address;
+    char* adapter_path;
+    int paired;
+    int trusted;
+    int connected;
+
+    // signal strength of the last advertisement. has_rssi is 0 while out of range
+    int16_t rssi;
+    int has_rssi;
+
+    // monotonic time of the last advertisement or property change. 0 if never heard from
+    uint64_t last_seen_us;
+
+    // a BLUETOOTH_DEVICE_CHANGED event is queued. guarded by the connection's mutex
+    int change_queued;
 
     char* path;
 
@@ -32,11 +64,12 @@ struct bluetooth_device {
 };
 
 struct bluetooth_adapter {
-    GDBusProxy* adapter_proxy;
-    GDBusProxy* properties_proxy;
+    GDBusProxy* proxy;
 
     char* path;
-    int initially_discovering;
+
+    // we hold a discovery session on this adapter. guarded by the connection's mutex
+    int discovering;
 
     bluetooth_t* connection;
 };
@@ -45,6 +78,9 @@ struct bluetooth {
     GDBusConnection* connection;
     GDBusObjectManager* manager;
 
+    // null for the system bus
+    char* bus_address;
+
     // maps string (path) to agent ptr
     map_t* agents;
 
@@ -54,50 +90,127 @@ struct bluetooth {
     // maps string (path) to adapter ptr
     map_t* adapters;
 
+    // map string (path) to struct bluetooth_pending_interface ptr. only the latest change per path
+    // is kept. only touched on the dbus thread
+    map_t* pending_devices;
+    map_t* pending_adapters;
+
+    // applies the pending interfaces once the window is over. null if nothing is pending
+    GSource* batch_source;
+
+    // interface signals collected into the pending batch. only touched on the dbus thread
+    uint64_t pending_signals;
+
+    // counters for the stats dump. guarded by mutex
+    uint64_t connect_start_us;
+    uint64_t connect_time_us;
+    uint64_t signals_received;
+    uint64_t batches_applied;
+    uint64_t max_batch_time_us;
+    int stats_id;
+
+    // bumped by every device property update, including rssi, which raises no event. guarded by
+    // mutex
+    uint64_t property_updates;
+
+    // guarded by mutex
+    bluetooth_state state;
+    GCancellable* cancellable;
+
+    // operations which have not been dispatched yet
+    list_t* operations;
+
+    // signaled when an operation finishes or the connection attempt ends
+    pthread_cond_t cond;
+
+    // device events which have not been dispatched yet. guarded by mutex
+    list_t* events;
+
+    // only touched by the thread which dispatches
+    list_t* subscriptions;
+    int next_subscription_id;
+
+    // bluetooth_start_discovery calls without a matching stop, and the filter given to the first.
+    // guarded by mutex
+    uint32_t discovery_references;
+    GVariant* discovery_filter;
+
     pthread_mutex_t mutex;
 };
 
-struct bluetooth_agent {
-    bluetooth_t* connection;
+struct bluetooth_event {
+    bluetooth_device_event type;
+    bluetooth_device_t* device;
 };
 
-// returns with a reference
-GVariant* bluetooth_get_property(GDBusProxy* proxy, const char* interface_name, const char* name) {
-    GVariant* argument_ptrs[2];
-    GVariant* arguments;
-    GVariant* retval;
+// an interface which appeared or went away since the last batch
+struct bluetooth_pending_interface {
+    char* path;
 
-    GVariant* value;
+    // null if the interface went away
+    GDBusProxy* proxy;
+};
 
-    argument_ptrs[0] = g_variant_new_string(interface_name);
-    argument_ptrs[1] = g_variant_new_string(name);
-    arguments = g_variant_new_tuple(argument_ptrs, ARRAYSIZE(argument_ptrs));
+struct bluetooth_subscription {
+    int id;
+    int removed;
 
-    retval =
-        g_dbus_proxy_call_sync(proxy, "Get", arguments, G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
+    bluetooth_device_callback_t callback;
+    void* user_data;
+};
 
-    if (!retval) {
-        return NULL;
-    }
+struct bluetooth_operation {
+    bluetooth_t* connection;
 
-    // return value is first element
-    value = g_variant_get_child_value(retval, 0);
+    GDBusProxy* proxy;
+    const char* method;
 
-    // transfer ownership & free tuple
-    g_variant_ref(value);
-    g_variant_unref(retval);
+    // called on the proxy when the operation is cancelled. can be null
+    const char* cancel_method;
 
-    if (g_variant_is_of_type(value, G_VARIANT_TYPE("v"))) {
-        retval = value;
-        value = g_variant_get_variant(retval);
-        g_variant_unref(retval);
+    GCancellable* cancellable;
+
+    bluetooth_operation_callback_t callback;
+    void* user_data;
+
+    // guarded by the connection's mutex
+    int finished;
+    int success;
+    int cancelled;
+};
+
+struct bluetooth_agent {
+    char* path;
+
+    struct dbus_service_spec spec;
+    dbus_service_t* service;
+
+    // registered with bluez's agent manager. set once bluez accepts the agent. atomic, as bluez may
+    // release the agent on the dbus thread at any time
+    gint registered;
+
+    // cancelled when the agent is freed, so that a RegisterAgent reply still on its way is dropped
+    GCancellable* cancellable;
+
+    bluetooth_t* connection;
+};
+
+void bluetooth_device_destroy(bluetooth_device_t* device) {
+    if (device->properties_changed_handler) {
+        g_signal_handler_disconnect(device->proxy, device->properties_changed_handler);
     }
 
-    return value;
+    g_object_unref(device->proxy);
+
+    free(device->name);
+    free(device->address);
+    free(device->adapter_path);
+
+    free(device->path);
+    free(device);
 }
 
 void bluetooth_device_free(bluetooth_t* bt, const char* path) {
-    bluetooth_device_t* device;
     void* key;
     void* value;
 
@@ -110,63 +223,334 @@ void bluetooth_device_free(bluetooth_t* bt, const char* path) {
         return;
     }
 
-    device = (bluetooth_device_t*)value;
     map_remove(bt->devices, key);
+    bluetooth_device_destroy((bluetooth_device_t*)value);
+}
 
-    g_object_unref(device->device_proxy);
-    g_object_unref(device->properties_proxy);
+// the connection's mutex must be held
+void bluetooth_queue_event(bluetooth_t* bt, bluetooth_device_t* device,
+                           bluetooth_device_event type) {
+    struct bluetooth_event* event;
 
-    free(device->path);
-    free(device);
+    event = (struct bluetooth_event*)malloc(sizeof(struct bluetooth_event));
+    event->type = type;
+    event->device = device;
+
+    list_insert(bt->events, list_end(bt->events), event);
 }
 
-void bluetooth_device_alloc(bluetooth_t* bt, const char* path, GDBusInterfaceInfo* interface_info) {
+// subscribers may still hold the device, so it is freed once its removal is dispatched. the
+// connection's mutex must be held
+void bluetooth_device_detach(bluetooth_t* bt, const char* path) {
     bluetooth_device_t* device;
+    void* key;
+    void* value;
 
-    GError* error;
+    key = (void*)path;
+    if (!map_get(bt->devices, key, &value)) {
+        return;
+    }
+
+    device = (bluetooth_device_t*)value;
+    map_remove(bt->devices, key);
+
+    g_signal_handler_disconnect(device->proxy, device->properties_changed_handler);
+    device->properties_changed_handler = 0;
+
+    bluetooth_queue_event(bt, device, BLUETOOTH_DEVICE_REMOVED);
+}
+
+// returns 1 if the string changed
+int bluetooth_replace_string(char** field, GVariant* value) {
+    const char* string;
+
+    string = value ? g_variant_get_string(value, NULL) : NULL;
+    if (string == *field || (string && *field && strcmp(string, *field) == 0)) {
+        return 0;
+    }
+
+    free(*field);
+    *field = string ? strdup(string) : NULL;
+
+    return 1;
+}
+
+// returns 1 if the flag changed
+int bluetooth_replace_boolean(int* field, GVariant* value) {
+    int flag;
+
+    flag = value ? (int)g_variant_get_boolean(value) : 0;
+    if (flag == *field) {
+        return 0;
+    }
+
+    *field = flag;
+    return 1;
+}
+
+// value is NULL if the property was invalidated. the connection's mutex must be held. returns 1 if
+// a property subscribers are told about changed
+int bluetooth_device_update_property(bluetooth_device_t* device, const char* name,
+                                     GVariant* value) {
+    // changes with every advertisement. only used for ranking, so it raises no event
+    if (strcmp(name, "RSSI") == 0) {
+        device->has_rssi = value != NULL;
+        device->rssi = value ? g_variant_get_int16(value) : 0;
+
+        return 0;
+    }
+
+    if (strcmp(name, "Name") == 0) {
+        return bluetooth_replace_string(&device->name, value);
+    } else if (strcmp(name, "Address") == 0) {
+        return bluetooth_replace_string(&device->address, value);
+    } else if (strcmp(name, "Adapter") == 0) {
+        return bluetooth_replace_string(&device->adapter_path, value);
+    } else if (strcmp(name, "Paired") == 0) {
+        return bluetooth_replace_boolean(&device->paired, value);
+    } else if (strcmp(name, "Trusted") == 0) {
+        return bluetooth_replace_boolean(&device->trusted, value);
+    } else if (strcmp(name, "Connected") == 0) {
+        return bluetooth_replace_boolean(&device->connected, value);
+    }
+
+    return 0;
+}
+
+void bluetooth_device_load_properties(bluetooth_device_t* device) {
+    static const char* const names[] = { "Name",    "Address",   "Adapter", "Paired",
+                                         "Trusted", "Connected", "RSSI" };
+
+    GVariant* value;
+    size_t i;
+
+    for (i = 0; i < ARRAYSIZE(names); i++) {
+        value = g_dbus_proxy_get_cached_property(device->proxy, names[i]);
+        bluetooth_device_update_property(device, names[i], value);
+
+        if (value) {
+            g_variant_unref(value);
+        }
+    }
+}
+
+void bluetooth_device_properties_changed(GDBusProxy* proxy, GVariant* changed_properties,
+                                         const gchar* const* invalidated_properties,
+                                         bluetooth_device_t* device) {
+    GVariantIter iter;
+    const gchar* name;
+    GVariant* value;
+    size_t i;
+    int changed;
+
+    pthread_mutex_lock(&device->connection->mutex);
+
+    device->last_seen_us = util_get_monotonic_us();
+    device->connection->property_updates++;
+
+    changed = 0;
+    g_variant_iter_init(&iter, changed_properties);
+    while (g_variant_iter_next(&iter, "{&sv}", &name, &value)) {
+        changed |= bluetooth_device_update_property(device, name, value);
+        g_variant_unref(value);
+    }
+
+    for (i = 0; invalidated_properties[i] != NULL; i++) {
+        changed |= bluetooth_device_update_property(device, invalidated_properties[i], NULL);
+    }
+
+    // one event per device covers any number of changes between dispatches
+    if (changed && !device->change_queued) {
+        device->change_queued = 1;
+        bluetooth_queue_event(device->connection, device, BLUETOOTH_DEVICE_CHANGED);
+    }
+
+    pthread_mutex_unlock(&device->connection->mutex);
+}
+
+// the connection's mutex must be held
+void bluetooth_device_alloc(bluetooth_t* bt, const char* path, GDBusProxy* proxy) {
+    bluetooth_device_t* device;
 
     device = (bluetooth_device_t*)malloc(sizeof(bluetooth_device_t));
+    memset(device, 0, sizeof(bluetooth_device_t));
+
     device->connection = bt;
+    device->path = strdup(path);
+
+    device->proxy = (GDBusProxy*)g_object_ref(proxy);
+    bluetooth_device_load_properties(device);
+
+    // bluez also lists devices it remembers from earlier, which are only around if they advertise
+    if (device->has_rssi) {
+        device->last_seen_us = util_get_monotonic_us();
+    }
+
+    device->properties_changed_handler =
+        g_signal_connect(device->proxy, "g-properties-changed",
+                         G_CALLBACK(bluetooth_device_properties_changed), device);
+
+    bluetooth_device_detach(bt, device->path);
+    map_insert(bt->devices, device->path, device);
+}
+
+// called on the dbus thread with the reply to a bluetooth_call. retval is null if the call failed,
+// and error null if it succeeded. both are freed once this returns
+typedef void (*bluetooth_call_callback_t)(GDBusProxy* proxy, GVariant* retval, GError* error,
+                                          void* user_data);
+
+// called on the dbus thread for calls nobody waits on
+void bluetooth_log_call_result(GDBusProxy* proxy, GVariant* retval, GError* error,
+                               void* user_data) {
+    if (!retval) {
+        fprintf(stderr, "%s failed on %s: %s\n", (const char*)user_data,
+                g_dbus_proxy_get_object_path(proxy), error->message);
+    }
+}
+
+// a proxy call waiting to be started on the dbus thread, and then waiting on its reply
+struct bluetooth_call {
+    GDBusProxy* proxy;
+    const char* method;
+    GVariant* arguments;
+    gint timeout_ms;
+
+    GCancellable* cancellable;
+    bluetooth_call_callback_t callback;
+    void* user_data;
+
+    struct dbus_call_timer timer;
+};
+
+// called on the dbus thread
+void bluetooth_finish_call(GObject* source, GAsyncResult* result, gpointer user_data) {
+    struct bluetooth_call* call;
+    GVariant* retval;
+    GError* error;
+
+    call = (struct bluetooth_call*)user_data;
 
     error = NULL;
-    device->device_proxy =
-        g_dbus_proxy_new_sync(bt->connection, G_DBUS_PROXY_FLAGS_NONE, interface_info,
-                              BLUEZ_BUS_NAME, path, DEVICE_INTERFACE_NAME, NULL, &error);
+    retval = g_dbus_proxy_call_finish(call->proxy, result, &error);
+
+    if (retval) {
+        dbus_call_end(&call->timer, DBUS_CALL_SUCCEEDED);
+    } else if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        dbus_call_end(&call->timer, DBUS_CALL_CANCELLED);
+    } else {
+        dbus_call_end(&call->timer, DBUS_CALL_FAILED);
+    }
+
+    if (call->callback) {
+        call->callback(call->proxy, retval, error, call->user_data);
+    }
+
+    if (retval) {
+        g_variant_unref(retval);
+    } else {
+        g_error_free(error);
+    }
+
+    g_object_unref(call->proxy);
+    free(call);
+}
+
+// called on the dbus thread
+void bluetooth_start_call(void* user_data) {
+    struct bluetooth_call* call;
+
+    call = (struct bluetooth_call*)user_data;
+    g_dbus_proxy_call(call->proxy, call->method, call->arguments, G_DBUS_CALL_FLAGS_NONE,
+                      call->timeout_ms, call->cancellable, bluetooth_finish_call, call);
+
+    if (call->arguments) {
+        g_variant_unref(call->arguments);
+    }
 
-    if (!device->device_proxy) {
-        fprintf(stderr, "Failed to create proxy for device: %s\n", error->message);
+    if (call->cancellable) {
+        g_object_unref(call->cancellable);
+    }
+}
+
+// calls a method from the dbus thread, so that the reply is handled there too. safe to call from
+// any thread. method must be a literal, and arguments may be floating. callback and cancellable can
+// be null. timed from here, so the latency includes the wait for the dbus thread
+void bluetooth_call(GDBusProxy* proxy, const char* method, GVariant* arguments, gint timeout_ms,
+                    GCancellable* cancellable, bluetooth_call_callback_t callback,
+                    void* user_data) {
+    struct bluetooth_call* call;
+
+    call = (struct bluetooth_call*)malloc(sizeof(struct bluetooth_call));
+    call->proxy = (GDBusProxy*)g_object_ref(proxy);
+    call->method = method;
+    call->arguments = arguments ? g_variant_ref_sink(arguments) : NULL;
+    call->timeout_ms = timeout_ms;
+
+    call->cancellable = cancellable ? (GCancellable*)g_object_ref(cancellable) : NULL;
+    call->callback = callback;
+    call->user_data = user_data;
+
+    dbus_call_begin(&call->timer, g_dbus_proxy_get_interface_name(proxy), method, 0);
+    dbus_loop_invoke(bluetooth_start_call, call);
+}
+
+// blocks until the reply is in. only for where waiting is the point, since calls made off the dbus
+// thread are flagged in the stats. arguments may be floating
+GVariant* bluetooth_call_sync(GDBusProxy* proxy, const char* method, GVariant* arguments,
+                              gint timeout_ms, GError** error) {
+    struct dbus_call_timer timer;
+    GVariant* retval;
+
+    dbus_call_begin(&timer, g_dbus_proxy_get_interface_name(proxy), method, 1);
+
+    retval = g_dbus_proxy_call_sync(proxy, method, arguments, G_DBUS_CALL_FLAGS_NONE, timeout_ms,
+                                    NULL, error);
 
-        free(device);
+    dbus_call_end(&timer, retval ? DBUS_CALL_SUCCEEDED : DBUS_CALL_FAILED);
+    return retval;
+}
+
+// the connection's mutex must be held
+void bluetooth_adapter_start_discovery(bluetooth_adapter_t* adapter) {
+    bluetooth_t* bt;
+
+    bt = adapter->connection;
+    if (adapter->discovering) {
         return;
     }
 
-    error = NULL;
-    device->properties_proxy =
-        g_dbus_proxy_new_sync(bt->connection, G_DBUS_PROXY_FLAGS_NONE, NULL, BLUEZ_BUS_NAME, path,
-                              PROPERTIES_INTERFACE_NAME, NULL, &error);
+    // bluez handles a client's calls in order, so the filter applies before discovery starts
+    if (bt->discovery_filter) {
+        bluetooth_call(adapter->proxy, "SetDiscoveryFilter",
+                       g_variant_new_tuple(&bt->discovery_filter, 1), -1, NULL,
+                       bluetooth_log_call_result, "SetDiscoveryFilter");
+    }
 
-    if (!device->properties_proxy) {
-        fprintf(stderr, "Failed to create proxy for device properties: %s\n", error->message);
+    bluetooth_call(adapter->proxy, "StartDiscovery", NULL, -1, NULL, bluetooth_log_call_result,
+                   "StartDiscovery");
 
-        g_object_unref(device->device_proxy);
-        free(device);
+    adapter->discovering = 1;
+}
 
+// the connection's mutex must be held
+void bluetooth_adapter_stop_discovery(bluetooth_adapter_t* adapter) {
+    if (!adapter->discovering) {
         return;
     }
 
-    device->path = strdup(path);
+    // bluez drops our filter along with the session
+    bluetooth_call(adapter->proxy, "StopDiscovery", NULL, -1, NULL, bluetooth_log_call_result,
+                   "StopDiscovery");
 
-    bluetooth_device_free(bt, device->path);
-    map_insert(bt->devices, device->path, device);
+    adapter->discovering = 0;
 }
 
+// the connection's mutex must be held
 void bluetooth_adapter_free(bluetooth_t* bt, const char* path) {
     bluetooth_adapter_t* adapter;
     void* key;
     void* value;
 
-    GVariant* retval;
-
     if (!bt || !path) {
         return;
     }
@@ -179,138 +563,185 @@ void bluetooth_adapter_free(bluetooth_t* bt, const char* path) {
     adapter = (bluetooth_adapter_t*)value;
     map_remove(bt->adapters, key);
 
-    if (!adapter->initially_discovering) {
-        retval = g_dbus_proxy_call_sync(adapter->adapter_proxy, "StopDiscovery", NULL,
-                                        G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
-
-        if (retval) {
-            g_variant_unref(retval);
-        }
-
-        // we dont care if it failed. not our problem anymore
-    }
-
-    g_object_unref(adapter->adapter_proxy);
-    g_object_unref(adapter->properties_proxy);
+    bluetooth_adapter_stop_discovery(adapter);
+    g_object_unref(adapter->proxy);
 
     free(adapter->path);
     free(adapter);
 }
 
-void bluetooth_adapter_alloc(bluetooth_t* bt, const char* path, GDBusInterfaceInfo* info) {
+// the connection's mutex must be held
+void bluetooth_adapter_alloc(bluetooth_t* bt, const char* path, GDBusProxy* proxy) {
     bluetooth_adapter_t* adapter;
 
-    GVariant* value;
-    GError* error;
-
     adapter = (bluetooth_adapter_t*)malloc(sizeof(bluetooth_adapter_t));
     adapter->connection = bt;
+    adapter->proxy = (GDBusProxy*)g_object_ref(proxy);
+    adapter->discovering = 0;
 
-    error = NULL;
-    adapter->adapter_proxy =
-        g_dbus_proxy_new_sync(bt->connection, G_DBUS_PROXY_FLAGS_NONE, info, BLUEZ_BUS_NAME, path,
-                              ADAPTER_INTERFACE_NAME, NULL, &error);
+    adapter->path = strdup(path);
 
-    if (!adapter->adapter_proxy) {
-        fprintf(stderr, "Failed to create proxy for adapter: %s\n", error->message);
+    bluetooth_adapter_free(bt, path);
+    map_insert(bt->adapters, adapter->path, adapter);
 
-        free(adapter);
-        return;
+    // an adapter plugged in while the menu is open joins in
+    if (bt->discovery_references > 0) {
+        bluetooth_adapter_start_discovery(adapter);
     }
+}
 
-    error = NULL;
-    adapter->properties_proxy =
-        g_dbus_proxy_new_sync(bt->connection, G_DBUS_PROXY_FLAGS_NONE, info, BLUEZ_BUS_NAME, path,
-                              PROPERTIES_INTERFACE_NAME, NULL, &error);
+void bluetooth_map_iterate_collect_keys(void* key, void* value, void* user_data) {
+    list_t* list;
+
+    list = (list_t*)user_data;
+    list_insert(list, NULL, key);
+}
 
-    if (!adapter->properties_proxy) {
-        fprintf(stderr, "Failed to create proxy for adapter properties: %s\n", error->message);
+void bluetooth_free_pending(map_t* pending) {
+    struct bluetooth_pending_interface* interface;
+    list_t* paths;
+    list_node_t* current_node;
+    void* value;
 
-        g_object_unref(adapter->adapter_proxy);
-        free(adapter);
+    paths = list_alloc();
+    map_iterate(pending, bluetooth_map_iterate_collect_keys, paths);
 
-        return;
-    }
+    for (current_node = list_begin(paths); current_node != NULL;
+         current_node = list_node_next(current_node)) {
+        map_get(pending, list_node_get(current_node), &value);
+        map_remove(pending, list_node_get(current_node));
 
-    value =
-        bluetooth_get_property(adapter->properties_proxy, ADAPTER_INTERFACE_NAME, "Discovering");
+        interface = (struct bluetooth_pending_interface*)value;
+        if (interface->proxy) {
+            g_object_unref(interface->proxy);
+        }
 
-    if (value) {
-        adapter->initially_discovering = (int)g_variant_get_boolean(value);
-        g_variant_unref(value);
-    } else {
-        adapter->initially_discovering = 1; // dont bother
+        free(interface->path);
+        free(interface);
     }
 
-    if (!adapter->initially_discovering) {
-        error = NULL;
-        value = g_dbus_proxy_call_sync(adapter->adapter_proxy, "StartDiscovery", NULL,
-                                       G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+    list_free(paths);
+}
 
-        if (!value) {
-            fprintf(stderr, "Failed to begin discovery for adapter %s: %s\n", path, error->message);
-            adapter->initially_discovering = 0;
-        } else {
-            g_variant_unref(value);
-        }
+void bluetooth_map_iterate_apply_device(void* key, void* value, void* user_data) {
+    struct bluetooth_pending_interface* interface;
+
+    interface = (struct bluetooth_pending_interface*)value;
+    if (interface->proxy) {
+        bluetooth_device_alloc((bluetooth_t*)user_data, interface->path, interface->proxy);
+    } else {
+        bluetooth_device_detach((bluetooth_t*)user_data, interface->path);
     }
+}
 
-    adapter->path = strdup(path);
+void bluetooth_map_iterate_apply_adapter(void* key, void* value, void* user_data) {
+    struct bluetooth_pending_interface* interface;
 
-    bluetooth_adapter_free(bt, path);
-    map_insert(bt->adapters, adapter->path, adapter);
+    interface = (struct bluetooth_pending_interface*)value;
+    if (interface->proxy) {
+        bluetooth_adapter_alloc((bluetooth_t*)user_data, interface->path, interface->proxy);
+    } else {
+        bluetooth_adapter_free((bluetooth_t*)user_data, interface->path);
+    }
 }
 
-void bluetooth_interface_added(GDBusObjectManager* manager, GDBusObject* object,
-                               GDBusInterface* interface, bluetooth_t* bt) {
-    const gchar* object_path;
-    const gchar* interface_name;
-    GDBusInterfaceInfo* info;
-
-    object_path = g_dbus_object_get_object_path(object);
-    interface_name = g_dbus_proxy_get_interface_name(G_DBUS_PROXY(interface));
-    info = g_dbus_interface_get_info(interface);
+// called on the dbus thread
+void bluetooth_apply_pending(bluetooth_t* bt) {
+    uint64_t start_us, batch_time_us;
 
-    if (!interface_name) {
-        return;
+    if (bt->batch_source) {
+        g_source_destroy(bt->batch_source);
+        g_source_unref(bt->batch_source);
+        bt->batch_source = NULL;
     }
 
     pthread_mutex_lock(&bt->mutex);
+    start_us = util_get_monotonic_us();
 
-    if (strcmp(interface_name, DEVICE_INTERFACE_NAME) == 0) {
-        bluetooth_device_alloc(bt, object_path, info);
+    map_iterate(bt->pending_adapters, bluetooth_map_iterate_apply_adapter, bt);
+    map_iterate(bt->pending_devices, bluetooth_map_iterate_apply_device, bt);
+
+    if (map_get_size(bt->pending_devices) > 0) {
+        bluetooth_queue_event(bt, NULL, BLUETOOTH_DEVICES_CHANGED);
     }
 
-    if (strcmp(interface_name, ADAPTER_INTERFACE_NAME) == 0) {
-        bluetooth_adapter_alloc(bt, object_path, info);
+    batch_time_us = util_get_monotonic_us() - start_us;
+    if (batch_time_us > bt->max_batch_time_us) {
+        bt->max_batch_time_us = batch_time_us;
     }
 
+    bt->signals_received += bt->pending_signals;
+    bt->batches_applied++;
+
     pthread_mutex_unlock(&bt->mutex);
+
+    bt->pending_signals = 0;
+
+    bluetooth_free_pending(bt->pending_adapters);
+    bluetooth_free_pending(bt->pending_devices);
 }
 
-void bluetooth_interface_removed(GDBusObjectManager* manager, GDBusObject* object,
-                                 GDBusInterface* interface, bluetooth_t* bt) {
-    const gchar* object_path;
+// called on the dbus thread
+gboolean bluetooth_batch_window_ended(gpointer user_data) {
+    bluetooth_apply_pending((bluetooth_t*)user_data);
+    return G_SOURCE_REMOVE;
+}
+
+// called on the dbus thread. proxy is null if the interface went away
+void bluetooth_queue_interface(bluetooth_t* bt, const char* path, GDBusInterface* interface,
+                               GDBusProxy* proxy) {
+    struct bluetooth_pending_interface* pending;
     const gchar* interface_name;
+    map_t* pending_interfaces;
+    void* value;
 
-    object_path = g_dbus_object_get_object_path(object);
     interface_name = g_dbus_proxy_get_interface_name(G_DBUS_PROXY(interface));
-
     if (!interface_name) {
         return;
     }
 
-    pthread_mutex_lock(&bt->mutex);
-
     if (strcmp(interface_name, DEVICE_INTERFACE_NAME) == 0) {
-        bluetooth_device_free(bt, object_path);
+        pending_interfaces = bt->pending_devices;
+    } else if (strcmp(interface_name, ADAPTER_INTERFACE_NAME) == 0) {
+        pending_interfaces = bt->pending_adapters;
+    } else {
+        return;
     }
 
-    if (strcmp(interface_name, ADAPTER_INTERFACE_NAME) == 0) {
-        bluetooth_adapter_free(bt, object_path);
+    // a later change to the same path supersedes the earlier one
+    if (map_get(pending_interfaces, (void*)path, &value)) {
+        pending = (struct bluetooth_pending_interface*)value;
+
+        if (pending->proxy) {
+            g_object_unref(pending->proxy);
+        }
+    } else {
+        pending =
+            (struct bluetooth_pending_interface*)malloc(sizeof(struct bluetooth_pending_interface));
+
+        pending->path = strdup(path);
+        map_insert(pending_interfaces, pending->path, pending);
     }
 
-    pthread_mutex_unlock(&bt->mutex);
+    pending->proxy = proxy ? (GDBusProxy*)g_object_ref(proxy) : NULL;
+    bt->pending_signals++;
+
+    if (!bt->batch_source) {
+        bt->batch_source = g_timeout_source_new(BLUETOOTH_BATCH_WINDOW_MS);
+        g_source_set_callback(bt->batch_source, bluetooth_batch_window_ended, bt, NULL);
+        g_source_attach(bt->batch_source, dbus_loop_get_context());
+    }
+}
+
+void bluetooth_interface_added(GDBusObjectManager* manager, GDBusObject* object,
+                               GDBusInterface* interface, bluetooth_t* bt) {
+    bluetooth_queue_interface(bt, g_dbus_object_get_object_path(object), interface,
+                              G_DBUS_PROXY(interface));
+}
+
+void bluetooth_interface_removed(GDBusObjectManager* manager, GDBusObject* object,
+                                 GDBusInterface* interface, bluetooth_t* bt) {
+    bluetooth_queue_interface(bt, g_dbus_object_get_object_path(object), interface, NULL);
 }
 
 void bluetooth_object_added(GDBusObjectManager* manager, GDBusObject* object, bluetooth_t* bt) {
@@ -349,21 +780,46 @@ void bluetooth_scan_bus(bluetooth_t* bt) {
     }
 
     g_list_free_full(objects, g_object_unref);
+
+    // what is already on the bus doesn't need to wait for the window
+    bluetooth_apply_pending(bt);
+}
+
+void bluetooth_set_state(bluetooth_t* bt, bluetooth_state state) {
+    pthread_mutex_lock(&bt->mutex);
+
+    bt->state = state;
+
+    pthread_cond_broadcast(&bt->cond);
+    pthread_mutex_unlock(&bt->mutex);
 }
 
-int bluetooth_create_object_manager(bluetooth_t* bt) {
+// called on the dbus thread
+void bluetooth_report_connect_error(GError* error, const char* message) {
+    if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        fprintf(stderr, "%s: %s\n", message, error->message);
+    }
+
+    g_error_free(error);
+}
+
+// called on the dbus thread
+void bluetooth_manager_ready(GObject* source, GAsyncResult* result, gpointer user_data) {
+    bluetooth_t* bt;
+    bluetooth_agent_t* agent;
     GError* error;
 
+    bt = (bluetooth_t*)user_data;
+
     error = NULL;
-    bt->manager = g_dbus_object_manager_client_new_sync(
-        bt->connection, G_DBUS_OBJECT_MANAGER_CLIENT_FLAGS_NONE, BLUEZ_BUS_NAME, "/", NULL, NULL,
-        NULL, NULL, &error);
+    bt->manager = g_dbus_object_manager_client_new_finish(result, &error);
 
     if (!bt->manager) {
-        fprintf(stderr, "Error creating object manager client for bus org.bluez: %s\n",
-                error->message);
+        bluetooth_report_connect_error(error,
+                                       "Error creating object manager client for bus org.bluez");
 
-        return 0;
+        bluetooth_set_state(bt, BLUETOOTH_STATE_FAILED);
+        return;
     }
 
     g_signal_connect_data(bt->manager, "interface-added", (GCallback)bluetooth_interface_added, bt,
@@ -377,13 +833,87 @@ int bluetooth_create_object_manager(bluetooth_t* bt) {
                           0);
 
     bluetooth_scan_bus(bt);
-    return 1;
+
+    // pairing stalls until bluez times out if nobody answers its agent requests
+    agent = bluetooth_agent_create(bt, BLUETOOTH_AGENT_PATH);
+    if (agent) {
+        map_insert(bt->agents, agent->path, agent);
+        bluetooth_register_agent(agent);
+    }
+
+    pthread_mutex_lock(&bt->mutex);
+    bt->connect_time_us = util_get_monotonic_us() - bt->connect_start_us;
+    pthread_mutex_unlock(&bt->mutex);
+
+    bluetooth_set_state(bt, BLUETOOTH_STATE_READY);
 }
 
-bluetooth_t* bluetooth_connect() {
+// called on the dbus thread
+void bluetooth_bus_ready(GObject* source, GAsyncResult* result, gpointer user_data) {
     bluetooth_t* bt;
     GError* error;
 
+    bt = (bluetooth_t*)user_data;
+
+    error = NULL;
+    if (bt->bus_address) {
+        bt->connection = g_dbus_connection_new_for_address_finish(result, &error);
+    } else {
+        bt->connection = g_bus_get_finish(result, &error);
+    }
+
+    if (!bt->connection) {
+        bluetooth_report_connect_error(error, "Error connecting to bus");
+
+        bluetooth_set_state(bt, BLUETOOTH_STATE_FAILED);
+        return;
+    }
+
+    g_dbus_object_manager_client_new(bt->connection, G_DBUS_OBJECT_MANAGER_CLIENT_FLAGS_NONE,
+                                     BLUEZ_BUS_NAME, "/", NULL, NULL, NULL, bt->cancellable,
+                                     bluetooth_manager_ready, bt);
+}
+
+// called on the dbus thread, so that the object manager and its proxies bind to the dbus loop
+void bluetooth_begin_connect(void* user_data) {
+    bluetooth_t* bt;
+
+    bt = (bluetooth_t*)user_data;
+
+    if (!bt->bus_address) {
+        g_bus_get(G_BUS_TYPE_SYSTEM, bt->cancellable, bluetooth_bus_ready, bt);
+        return;
+    }
+
+    g_dbus_connection_new_for_address(bt->bus_address,
+                                      G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                          G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                      NULL, bt->cancellable, bluetooth_bus_ready, bt);
+}
+
+void bluetooth_dump_stats(void* user_data, FILE* stream) {
+    bluetooth_t* bt;
+
+    bt = (bluetooth_t*)user_data;
+
+    pthread_mutex_lock(&bt->mutex);
+
+    if (bt->state == BLUETOOTH_STATE_READY) {
+        fprintf(stream, "connect time: %llu us\n", (unsigned long long)bt->connect_time_us);
+    }
+
+    fprintf(stream, "devices: %zu\n", map_get_size(bt->devices));
+    fprintf(stream, "adapters: %zu\n", map_get_size(bt->adapters));
+    fprintf(stream, "interface signals: %llu\n", (unsigned long long)bt->signals_received);
+    fprintf(stream, "batches applied: %llu\n", (unsigned long long)bt->batches_applied);
+    fprintf(stream, "max batch time: %llu us\n", (unsigned long long)bt->max_batch_time_us);
+
+    pthread_mutex_unlock(&bt->mutex);
+}
+
+bluetooth_t* bluetooth_connect(const char* bus_address) {
+    bluetooth_t* bt;
+
     if (!dbus_loop_ref()) {
         return NULL;
     }
@@ -393,63 +923,161 @@ bluetooth_t* bluetooth_connect() {
     bt->devices = map_alloc_string_key(100);
     bt->adapters = map_alloc_string_key(100);
 
+    bt->state = BLUETOOTH_STATE_CONNECTING;
+    bt->cancellable = g_cancellable_new();
+
+    bt->operations = list_alloc();
+    bt->events = list_alloc();
+
+    bt->subscriptions = list_alloc();
+    bt->next_subscription_id = 1;
+
+    bt->discovery_references = 0;
+    bt->discovery_filter = NULL;
+
+    bt->pending_devices = map_alloc_string_key(100);
+    bt->pending_adapters = map_alloc_string_key(16);
+    bt->batch_source = NULL;
+
+    bt->pending_signals = 0;
+    bt->connect_start_us = util_get_monotonic_us();
+    bt->connect_time_us = 0;
+    bt->signals_received = 0;
+    bt->batches_applied = 0;
+    bt->max_batch_time_us = 0;
+    bt->property_updates = 0;
+
     bt->connection = NULL;
     bt->manager = NULL;
+    bt->bus_address = bus_address ? strdup(bus_address) : NULL;
 
     pthread_mutex_init(&bt->mutex, NULL);
+    pthread_cond_init(&bt->cond, NULL);
 
-    error = NULL;
-    bt->connection = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
+    bt->stats_id = stats_register("bluetooth", bluetooth_dump_stats, bt);
 
-    if (!bt->connection) {
-        fprintf(stderr, "Error retrieving system bus: %s\n", error->message);
+    // the rest happens on the dbus thread, so that a slow or missing bluez doesn't hold up the ui
+    dbus_loop_invoke(bluetooth_begin_connect, bt);
 
-        bluetooth_disconnect(bt);
-        return NULL;
+    return bt;
+}
+
+bluetooth_state bluetooth_get_state(bluetooth_t* bt) {
+    bluetooth_state state;
+
+    pthread_mutex_lock(&bt->mutex);
+    state = bt->state;
+    pthread_mutex_unlock(&bt->mutex);
+
+    return state;
+}
+
+uint64_t bluetooth_get_property_updates(bluetooth_t* bt) {
+    uint64_t updates;
+
+    pthread_mutex_lock(&bt->mutex);
+    updates = bt->property_updates;
+    pthread_mutex_unlock(&bt->mutex);
+
+    return updates;
+}
+
+void bluetooth_operation_free(bluetooth_operation_t* operation) {
+    g_object_unref(operation->proxy);
+    g_object_unref(operation->cancellable);
+
+    free(operation);
+}
+
+// cancels every operation and waits for glib to let go of them, so that no callback outlives the
+// connection
+void bluetooth_wait_for_operations(bluetooth_t* bt) {
+    list_node_t* current_node;
+    bluetooth_operation_t* operation;
+
+    for (current_node = list_begin(bt->operations); current_node != NULL;
+         current_node = list_node_next(current_node)) {
+        bluetooth_operation_cancel((bluetooth_operation_t*)list_node_get(current_node));
     }
 
-    if (!bluetooth_create_object_manager(bt)) {
-        bluetooth_disconnect(bt);
-        return NULL;
+    pthread_mutex_lock(&bt->mutex);
+
+    while ((current_node = list_begin(bt->operations)) != NULL) {
+        operation = (bluetooth_operation_t*)list_node_get(current_node);
+        while (!operation->finished) {
+            pthread_cond_wait(&bt->cond, &bt->mutex);
+        }
+
+        list_remove(bt->operations, current_node);
+        bluetooth_operation_free(operation);
     }
 
-    return bt;
+    pthread_mutex_unlock(&bt->mutex);
+    list_free(bt->operations);
 }
 
-void bluetooth_iterate_free_agent(void* key, void* value, void* user_data) {
-    bluetooth_agent_free((bluetooth_agent_t*)value);
-}
+// frees detached devices whose removal was never dispatched
+void bluetooth_free_events(bluetooth_t* bt) {
+    list_node_t* current_node;
+    struct bluetooth_event* event;
 
-void bluetooth_map_iterate_collect_keys(void* key, void* value, void* user_data) {
-    list_t* list;
+    while ((current_node = list_begin(bt->events)) != NULL) {
+        event = (struct bluetooth_event*)list_node_get(current_node);
+        if (event->type == BLUETOOTH_DEVICE_REMOVED) {
+            bluetooth_device_destroy(event->device);
+        }
 
-    list = (list_t*)user_data;
-    list_insert(list, NULL, key);
+        free(event);
+        list_remove(bt->events, current_node);
+    }
+
+    list_free(bt->events);
+
+    for (current_node = list_begin(bt->subscriptions); current_node != NULL;
+         current_node = list_node_next(current_node)) {
+        free(list_node_get(current_node));
+    }
+
+    list_free(bt->subscriptions);
 }
 
-void bluetooth_disconnect(bluetooth_t* bt) {
+void bluetooth_iterate_free_agent(void* key, void* value, void* user_data) {
+    bluetooth_agent_free((bluetooth_agent_t*)value);
+}
+
+// called on the dbus thread
+void bluetooth_release_bus(void* user_data) {
+    bluetooth_t* bt;
     list_t* freed_paths;
     list_node_t* current_node;
 
-    if (!bt) {
-        return;
-    }
+    bt = (bluetooth_t*)user_data;
 
-    pthread_mutex_destroy(&bt->mutex);
+    // unregistering goes through the agent manager's proxy
+    map_iterate(bt->agents, bluetooth_iterate_free_agent, bt);
+    map_free(bt->agents);
 
     if (bt->manager) {
         g_object_unref(bt->manager);
     }
 
+    // a batch still being collected is dropped
+    if (bt->batch_source) {
+        g_source_destroy(bt->batch_source);
+        g_source_unref(bt->batch_source);
+    }
+
+    bluetooth_free_pending(bt->pending_devices);
+    bluetooth_free_pending(bt->pending_adapters);
+    map_free(bt->pending_devices);
+    map_free(bt->pending_adapters);
+
     if (bt->connection) {
         g_object_unref(bt->connection);
     }
 
-    map_iterate(bt->agents, bluetooth_iterate_free_agent, bt);
-    map_free(bt->agents);
-
     freed_paths = list_alloc();
-    map_iterate(bt->devices, bluetooth_map_iterate_collect_keys, bt);
+    map_iterate(bt->devices, bluetooth_map_iterate_collect_keys, freed_paths);
 
     for (current_node = list_begin(freed_paths); current_node != NULL;
          current_node = list_node_next(current_node)) {
@@ -459,7 +1087,7 @@ void bluetooth_disconnect(bluetooth_t* bt) {
     map_free(bt->devices);
     list_clear(freed_paths);
 
-    map_iterate(bt->adapters, bluetooth_map_iterate_collect_keys, bt);
+    map_iterate(bt->adapters, bluetooth_map_iterate_collect_keys, freed_paths);
     for (current_node = list_begin(freed_paths); current_node != NULL;
          current_node = list_node_next(current_node)) {
         bluetooth_adapter_free(bt, (const char*)list_node_get(current_node));
@@ -467,6 +1095,41 @@ void bluetooth_disconnect(bluetooth_t* bt) {
 
     map_free(bt->adapters);
     list_free(freed_paths);
+}
+
+void bluetooth_disconnect(bluetooth_t* bt) {
+    if (!bt) {
+        return;
+    }
+
+    stats_unregister(bt->stats_id);
+
+    // the connection attempt holds on to bt until it ends
+    g_cancellable_cancel(bt->cancellable);
+
+    pthread_mutex_lock(&bt->mutex);
+    while (bt->state == BLUETOOTH_STATE_CONNECTING) {
+        pthread_cond_wait(&bt->cond, &bt->mutex);
+    }
+
+    pthread_mutex_unlock(&bt->mutex);
+    g_object_unref(bt->cancellable);
+
+    bluetooth_wait_for_operations(bt);
+
+    // nothing on the dbus thread can be using bt while it is released there
+    dbus_loop_invoke_sync(bluetooth_release_bus, bt);
+
+    bluetooth_free_events(bt);
+
+    if (bt->discovery_filter) {
+        g_variant_unref(bt->discovery_filter);
+    }
+
+    free(bt->bus_address);
+
+    pthread_cond_destroy(&bt->cond);
+    pthread_mutex_destroy(&bt->mutex);
 
     free(bt);
 
@@ -510,132 +1173,667 @@ bluetooth_device_t** bluetooth_iterate_devices(bluetooth_t* bt, uint32_t* count)
         device_array[index++] = (bluetooth_device_t*)list_node_get(current_node);
     }
 
+    list_free(iteration.devices);
     return device_array;
 }
 
+// returns a floating reference, or NULL if the filter is empty
+GVariant* bluetooth_build_discovery_filter(const struct bluetooth_discovery_filter* filter) {
+    GVariantBuilder builder;
+    int empty;
+
+    empty = 1;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+
+    if (filter->transport) {
+        g_variant_builder_add(&builder, "{sv}", "Transport",
+                              g_variant_new_string(filter->transport));
+
+        empty = 0;
+    }
+
+    if (filter->rssi != 0) {
+        g_variant_builder_add(&builder, "{sv}", "RSSI", g_variant_new_int16(filter->rssi));
+        empty = 0;
+    }
+
+    if (filter->uuid_count > 0) {
+        g_variant_builder_add(
+            &builder, "{sv}", "UUIDs",
+            g_variant_new_strv((const gchar* const*)filter->uuids, (long)filter->uuid_count));
+
+        empty = 0;
+    }
+
+    if (empty) {
+        // an empty dict is still valid, but there is no point sending it
+        g_variant_builder_clear(&builder);
+        return NULL;
+    }
+
+    return g_variant_builder_end(&builder);
+}
+
+void bluetooth_map_iterate_start_discovery(void* key, void* value, void* user_data) {
+    bluetooth_adapter_start_discovery((bluetooth_adapter_t*)value);
+}
+
+void bluetooth_map_iterate_stop_discovery(void* key, void* value, void* user_data) {
+    bluetooth_adapter_stop_discovery((bluetooth_adapter_t*)value);
+}
+
+void bluetooth_start_discovery(bluetooth_t* bt, const struct bluetooth_discovery_filter* filter) {
+    pthread_mutex_lock(&bt->mutex);
+
+    if (bt->discovery_references++ == 0) {
+        bt->discovery_filter = filter ? bluetooth_build_discovery_filter(filter) : NULL;
+        if (bt->discovery_filter) {
+            g_variant_ref_sink(bt->discovery_filter);
+        }
+
+        map_iterate(bt->adapters, bluetooth_map_iterate_start_discovery, NULL);
+    }
+
+    pthread_mutex_unlock(&bt->mutex);
+}
+
+void bluetooth_stop_discovery(bluetooth_t* bt) {
+    pthread_mutex_lock(&bt->mutex);
+
+    if (bt->discovery_references > 0 && --bt->discovery_references == 0) {
+        map_iterate(bt->adapters, bluetooth_map_iterate_stop_discovery, NULL);
+
+        if (bt->discovery_filter) {
+            g_variant_unref(bt->discovery_filter);
+            bt->discovery_filter = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&bt->mutex);
+}
+
+struct bluetooth_device_ranking {
+    bluetooth_device_t** devices;
+    size_t max_devices;
+    size_t count;
+
+    uint64_t now_us;
+    uint64_t stale_us;
+};
+
+// rssi is compared in coarse steps, so that noise doesn't reorder devices every few seconds
+#define BLUETOOTH_RSSI_STEP 6
+
+// returns 1 if lhs ranks above rhs
+int bluetooth_device_ranks_above(const bluetooth_device_t* lhs, const bluetooth_device_t* rhs) {
+    int lhs_step, rhs_step;
+
+    if (lhs->paired != rhs->paired) {
+        return lhs->paired;
+    }
+
+    if (lhs->has_rssi != rhs->has_rssi) {
+        return lhs->has_rssi;
+    }
+
+    lhs_step = lhs->has_rssi ? (lhs->rssi + 128) / BLUETOOTH_RSSI_STEP : 0;
+    rhs_step = rhs->has_rssi ? (rhs->rssi + 128) / BLUETOOTH_RSSI_STEP : 0;
+
+    if (lhs_step != rhs_step) {
+        return lhs_step > rhs_step;
+    }
+
+    // named devices always have a path. any stable order will do
+    return strcmp(lhs->path, rhs->path) < 0;
+}
+
+void bluetooth_map_iterate_rank(void* key, void* value, void* user_data) {
+    struct bluetooth_device_ranking* ranking;
+    bluetooth_device_t* device;
+    size_t index;
+
+    ranking = (struct bluetooth_device_ranking*)user_data;
+    device = (bluetooth_device_t*)value;
+
+    if (!device->name) {
+        return;
+    }
+
+    if (!device->paired && ranking->now_us - device->last_seen_us > ranking->stale_us) {
+        return;
+    }
+
+    // insertion into a bounded sorted array. max_devices is small, so this beats a heap
+    index = ranking->count;
+    while (index > 0 && bluetooth_device_ranks_above(device, ranking->devices[index - 1])) {
+        index--;
+    }
+
+    if (index >= ranking->max_devices) {
+        return;
+    }
+
+    if (ranking->count < ranking->max_devices) {
+        ranking->count++;
+    }
+
+    memmove(ranking->devices + index + 1, ranking->devices + index,
+            (ranking->count - index - 1) * sizeof(bluetooth_device_t*));
+
+    ranking->devices[index] = device;
+}
+
+size_t bluetooth_rank_devices(bluetooth_t* bt, bluetooth_device_t** devices, size_t max_devices,
+                              uint64_t stale_us) {
+    struct bluetooth_device_ranking ranking;
+
+    if (max_devices == 0) {
+        return 0;
+    }
+
+    ranking.devices = devices;
+    ranking.max_devices = max_devices;
+    ranking.count = 0;
+    ranking.stale_us = stale_us;
+
+    pthread_mutex_lock(&bt->mutex);
+
+    // taken under the lock, so that no device was seen after it
+    ranking.now_us = util_get_monotonic_us();
+    map_iterate(bt->devices, bluetooth_map_iterate_rank, &ranking);
+    pthread_mutex_unlock(&bt->mutex);
+
+    return ranking.count;
+}
+
 char* bluetooth_device_get_name(bluetooth_device_t* device) {
-    GVariant* value;
     char* name;
 
-    value = bluetooth_get_property(device->properties_proxy, DEVICE_INTERFACE_NAME, "Name");
-    if (value) {
-        name = strdup(g_variant_get_string(value, NULL));
-        g_variant_unref(value);
-    } else {
-        name = NULL;
-    }
+    pthread_mutex_lock(&device->connection->mutex);
+    name = device->name ? strdup(device->name) : NULL;
+    pthread_mutex_unlock(&device->connection->mutex);
 
     return name;
 }
 
 char* bluetooth_device_get_address(bluetooth_device_t* device) {
-    GVariant* value;
     char* address;
 
-    value = bluetooth_get_property(device->properties_proxy, DEVICE_INTERFACE_NAME, "Address");
-    if (value) {
-        address = strdup(g_variant_get_string(value, NULL));
-        g_variant_unref(value);
-    } else {
-        address = NULL;
-    }
+    pthread_mutex_lock(&device->connection->mutex);
+    address = device->address ? strdup(device->address) : NULL;
+    pthread_mutex_unlock(&device->connection->mutex);
 
     return address;
 }
 
 bluetooth_adapter_t* bluetooth_device_get_adapter(bluetooth_device_t* device) {
-    GVariant* value;
-    char* path;
+    bluetooth_t* bt;
     void* adapter;
 
-    value = bluetooth_get_property(device->properties_proxy, DEVICE_INTERFACE_NAME, "Adapter");
-    if (value) {
-        path = strdup(g_variant_get_string(value, NULL));
-        g_variant_unref(value);
-    } else {
-        return NULL;
-    }
+    bt = device->connection;
+    pthread_mutex_lock(&bt->mutex);
 
-    if (!map_get(device->connection->adapters, path, &adapter)) {
+    if (!device->adapter_path || !map_get(bt->adapters, device->adapter_path, &adapter)) {
         adapter = NULL;
     }
 
-    free(path);
+    pthread_mutex_unlock(&bt->mutex);
     return (bluetooth_adapter_t*)adapter;
 }
 
+// returns a new reference to the proxy of the device's adapter, or null if there is none. the
+// adapter itself may be freed on the dbus thread as soon as the mutex is released
+GDBusProxy* bluetooth_device_ref_adapter_proxy(bluetooth_device_t* device) {
+    bluetooth_t* bt;
+    void* adapter;
+    GDBusProxy* proxy;
+
+    bt = device->connection;
+    pthread_mutex_lock(&bt->mutex);
+
+    proxy = NULL;
+    if (device->adapter_path && map_get(bt->adapters, device->adapter_path, &adapter)) {
+        proxy = (GDBusProxy*)g_object_ref(((bluetooth_adapter_t*)adapter)->proxy);
+    }
+
+    pthread_mutex_unlock(&bt->mutex);
+    return proxy;
+}
+
 int bluetooth_device_is_paired(bluetooth_device_t* device) {
-    GVariant* value;
     int paired;
 
-    value = bluetooth_get_property(device->properties_proxy, DEVICE_INTERFACE_NAME, "Paired");
-    if (value) {
-        paired = (int)g_variant_get_boolean(value);
-        g_variant_unref(value);
-    } else {
-        paired = 0;
-    }
+    pthread_mutex_lock(&device->connection->mutex);
+    paired = device->paired;
+    pthread_mutex_unlock(&device->connection->mutex);
 
     return paired;
 }
 
-int bluetooth_device_pair(bluetooth_device_t* device) {
-    GVariant* retval;
-    GError* error;
+int bluetooth_device_is_trusted(bluetooth_device_t* device) {
+    int trusted;
 
-    error = NULL;
-    retval = g_dbus_proxy_call_sync(device->device_proxy, "Pair", NULL, G_DBUS_CALL_FLAGS_NONE,
-                                    INT_MAX, NULL, &error);
+    pthread_mutex_lock(&device->connection->mutex);
+    trusted = device->trusted;
+    pthread_mutex_unlock(&device->connection->mutex);
 
-    if (!retval) {
-        fprintf(stderr, "Failed to pair device at path %s: %s\n", device->path, error->message);
-        return 0;
-    } else {
-        g_variant_unref(retval);
-        return 1;
+    return trusted;
+}
+
+int bluetooth_device_is_connected(bluetooth_device_t* device) {
+    int connected;
+
+    pthread_mutex_lock(&device->connection->mutex);
+    connected = device->connected;
+    pthread_mutex_unlock(&device->connection->mutex);
+
+    return connected;
+}
+
+int bluetooth_device_get_rssi(bluetooth_device_t* device, int16_t* rssi) {
+    int has_rssi;
+
+    pthread_mutex_lock(&device->connection->mutex);
+
+    has_rssi = device->has_rssi;
+    if (has_rssi) {
+        *rssi = device->rssi;
     }
+
+    pthread_mutex_unlock(&device->connection->mutex);
+
+    return has_rssi;
 }
 
-int bluetooth_device_remove(bluetooth_device_t* device) {
-    bluetooth_adapter_t* adapter;
+uint64_t bluetooth_device_get_last_seen_us(bluetooth_device_t* device) {
+    uint64_t last_seen_us;
 
-    GVariant* arguments;
-    GVariant* path;
+    pthread_mutex_lock(&device->connection->mutex);
+    last_seen_us = device->last_seen_us;
+    pthread_mutex_unlock(&device->connection->mutex);
 
-    GVariant* retval;
-    GError* error;
+    return last_seen_us;
+}
+
+// called on the dbus thread
+void bluetooth_operation_finish(GDBusProxy* proxy, GVariant* retval, GError* error,
+                                void* user_data) {
+    bluetooth_operation_t* operation;
+
+    operation = (bluetooth_operation_t*)user_data;
+
+    if (!retval && !g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        fprintf(stderr, "%s failed on %s: %s\n", operation->method,
+                g_dbus_proxy_get_object_path(proxy), error->message);
+    }
+
+    pthread_mutex_lock(&operation->connection->mutex);
+
+    operation->finished = 1;
+    operation->success = retval != NULL;
+
+    pthread_cond_broadcast(&operation->connection->cond);
+    pthread_mutex_unlock(&operation->connection->mutex);
+}
+
+bluetooth_operation_t* bluetooth_operation_start(bluetooth_t* bt, GDBusProxy* proxy,
+                                                 const char* method, GVariant* arguments,
+                                                 const char* cancel_method,
+                                                 bluetooth_operation_callback_t callback,
+                                                 void* user_data) {
+    bluetooth_operation_t* operation;
+
+    operation = (bluetooth_operation_t*)malloc(sizeof(bluetooth_operation_t));
+    memset(operation, 0, sizeof(bluetooth_operation_t));
+
+    operation->connection = bt;
+    operation->proxy = (GDBusProxy*)g_object_ref(proxy);
+    operation->method = method;
+    operation->cancel_method = cancel_method;
+    operation->cancellable = g_cancellable_new();
+
+    operation->callback = callback;
+    operation->user_data = user_data;
+
+    // only the thread which dispatches touches the list itself
+    list_insert(bt->operations, list_end(bt->operations), operation);
 
-    adapter = bluetooth_device_get_adapter(device);
-    if (!adapter) {
+    bluetooth_call(proxy, method, arguments, INT_MAX, operation->cancellable,
+                   bluetooth_operation_finish, operation);
+
+    return operation;
+}
+
+bluetooth_operation_t* bluetooth_device_pair_async(bluetooth_device_t* device,
+                                                   bluetooth_operation_callback_t callback,
+                                                   void* user_data) {
+    return bluetooth_operation_start(device->connection, device->proxy, "Pair", NULL,
+                                     "CancelPairing", callback, user_data);
+}
+
+// disconnecting aborts a connection attempt in progress
+bluetooth_operation_t* bluetooth_device_connect_async(bluetooth_device_t* device,
+                                                      bluetooth_operation_callback_t callback,
+                                                      void* user_data) {
+    return bluetooth_operation_start(device->connection, device->proxy, "Connect", NULL,
+                                     "Disconnect", callback, user_data);
+}
+
+bluetooth_operation_t* bluetooth_device_remove_async(bluetooth_device_t* device,
+                                                     bluetooth_operation_callback_t callback,
+                                                     void* user_data) {
+    bluetooth_operation_t* operation;
+    GDBusProxy* adapter_proxy;
+    GVariant* path;
+
+    adapter_proxy = bluetooth_device_ref_adapter_proxy(device);
+    if (!adapter_proxy) {
         fprintf(stderr, "Failed to retrieve adapter for device %s\n", device->path);
-        return 0;
+        return NULL;
     }
 
     path = g_variant_new_object_path(device->path);
-    arguments = g_variant_new_tuple(&path, 1);
+    operation = bluetooth_operation_start(device->connection, adapter_proxy, "RemoveDevice",
+                                          g_variant_new_tuple(&path, 1), NULL, callback,
+                                          user_data);
 
-    error = NULL;
-    retval = g_dbus_proxy_call_sync(adapter->adapter_proxy, "RemoveDevice", arguments,
-                                    G_DBUS_CALL_FLAGS_NONE, INT_MAX, NULL, &error);
+    g_object_unref(adapter_proxy);
+    return operation;
+}
 
-    if (!retval) {
-        fprintf(stderr, "Failed to remove device %s from adapter %s: %s\n", device->path,
-                adapter->path, error->message);
+void bluetooth_operation_cancel(bluetooth_operation_t* operation) {
+    int finished;
 
-        return 0;
-    } else {
-        g_variant_unref(retval);
-        return 1;
+    if (!operation) {
+        return;
+    }
+
+    pthread_mutex_lock(&operation->connection->mutex);
+
+    operation->cancelled = 1;
+    finished = operation->finished;
+
+    pthread_mutex_unlock(&operation->connection->mutex);
+
+    if (finished) {
+        return;
+    }
+
+    g_cancellable_cancel(operation->cancellable);
+
+    // cancelling the call only stops us from waiting on it
+    if (operation->cancel_method) {
+        bluetooth_call(operation->proxy, operation->cancel_method, NULL, -1, NULL, NULL, NULL);
     }
 }
 
+void bluetooth_dispatch_operations(bluetooth_t* bt) {
+    list_node_t* current_node;
+    list_node_t* next_node;
+    bluetooth_operation_t* operation;
+    int finished;
+
+    for (current_node = list_begin(bt->operations); current_node != NULL;
+         current_node = next_node) {
+        next_node = list_node_next(current_node);
+        operation = (bluetooth_operation_t*)list_node_get(current_node);
+
+        pthread_mutex_lock(&bt->mutex);
+        finished = operation->finished;
+        pthread_mutex_unlock(&bt->mutex);
+
+        if (!finished) {
+            continue;
+        }
+
+        // callbacks may start or cancel operations, but they never remove nodes
+        list_remove(bt->operations, current_node);
+
+        if (!operation->cancelled) {
+            operation->callback(operation, operation->success, operation->user_data);
+        }
+
+        bluetooth_operation_free(operation);
+    }
+}
+
+void bluetooth_notify(bluetooth_t* bt, bluetooth_device_t* device, bluetooth_device_event type) {
+    list_node_t* current_node;
+    struct bluetooth_subscription* subscription;
+
+    for (current_node = list_begin(bt->subscriptions); current_node != NULL;
+         current_node = list_node_next(current_node)) {
+        subscription = (struct bluetooth_subscription*)list_node_get(current_node);
+
+        if (!subscription->removed) {
+            subscription->callback(device, type, subscription->user_data);
+        }
+    }
+}
+
+void bluetooth_dispatch_events(bluetooth_t* bt) {
+    list_node_t* current_node;
+    list_node_t* next_node;
+    struct bluetooth_event* event;
+
+    pthread_mutex_lock(&bt->mutex);
+
+    while ((current_node = list_begin(bt->events)) != NULL) {
+        event = (struct bluetooth_event*)list_node_get(current_node);
+        list_remove(bt->events, current_node);
+
+        if (event->type == BLUETOOTH_DEVICE_CHANGED) {
+            event->device->change_queued = 0;
+        }
+
+        // subscribers read the device through the getters, which take the mutex
+        pthread_mutex_unlock(&bt->mutex);
+
+        bluetooth_notify(bt, event->device, event->type);
+        if (event->type == BLUETOOTH_DEVICE_REMOVED) {
+            bluetooth_device_destroy(event->device);
+        }
+
+        free(event);
+        pthread_mutex_lock(&bt->mutex);
+    }
+
+    pthread_mutex_unlock(&bt->mutex);
+
+    // subscriptions may be removed from within callbacks, so free them afterward
+    for (current_node = list_begin(bt->subscriptions); current_node != NULL;
+         current_node = next_node) {
+        next_node = list_node_next(current_node);
+
+        if (((struct bluetooth_subscription*)list_node_get(current_node))->removed) {
+            free(list_node_get(current_node));
+            list_remove(bt->subscriptions, current_node);
+        }
+    }
+}
+
+void bluetooth_dispatch(bluetooth_t* bt) {
+    bluetooth_dispatch_operations(bt);
+    bluetooth_dispatch_events(bt);
+}
+
+int bluetooth_subscribe(bluetooth_t* bt, bluetooth_device_callback_t callback, void* user_data) {
+    struct bluetooth_subscription* subscription;
+
+    subscription = (struct bluetooth_subscription*)malloc(sizeof(struct bluetooth_subscription));
+    subscription->id = bt->next_subscription_id++;
+    subscription->removed = 0;
+
+    subscription->callback = callback;
+    subscription->user_data = user_data;
+
+    list_insert(bt->subscriptions, list_end(bt->subscriptions), subscription);
+    return subscription->id;
+}
+
+void bluetooth_unsubscribe(bluetooth_t* bt, int id) {
+    list_node_t* current_node;
+    struct bluetooth_subscription* subscription;
+
+    for (current_node = list_begin(bt->subscriptions); current_node != NULL;
+         current_node = list_node_next(current_node)) {
+        subscription = (struct bluetooth_subscription*)list_node_get(current_node);
+
+        if (subscription->id == id) {
+            subscription->removed = 1;
+            return;
+        }
+    }
+}
+
+// called on the dbus thread. returns 1 if the call came from bluez. anyone on the bus can reach the
+// agent, so everyone else is turned away before they can answer for a pairing
+int bluetooth_agent_check_sender(bluetooth_agent_t* agent, GDBusMethodInvocation* invocation) {
+    gchar* owner;
+    int allowed;
+
+    owner = g_dbus_object_manager_client_get_name_owner(
+        G_DBUS_OBJECT_MANAGER_CLIENT(agent->connection->manager));
+
+    allowed = owner && !g_strcmp0(owner, g_dbus_method_invocation_get_sender(invocation));
+    g_free(owner);
+
+    if (!allowed) {
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.Rejected",
+                                                   "Agent calls are only accepted from bluez");
+    }
+
+    return allowed;
+}
+
+// called on the dbus thread. every request is accepted as is
+void bluetooth_agent_accept(GVariant* parameters, GDBusMethodInvocation* invocation,
+                            void* user_data) {
+    if (!bluetooth_agent_check_sender((bluetooth_agent_t*)user_data, invocation)) {
+        return;
+    }
+
+    g_dbus_method_invocation_return_value(invocation, NULL);
+}
+
+// bluez dropped the agent, e.g. because another one was registered. it stays unregistered until
+// bluetooth_register_agent is called again
+void bluetooth_agent_release(GVariant* parameters, GDBusMethodInvocation* invocation,
+                             void* user_data) {
+    bluetooth_agent_t* agent;
+
+    agent = (bluetooth_agent_t*)user_data;
+    if (!bluetooth_agent_check_sender(agent, invocation)) {
+        return;
+    }
+
+    g_atomic_int_set(&agent->registered, 0);
+    g_dbus_method_invocation_return_value(invocation, NULL);
+}
+
+// only legacy devices ask for these despite our capability. they usually expect the default code
+void bluetooth_agent_request_pin_code(GVariant* parameters, GDBusMethodInvocation* invocation,
+                                      void* user_data) {
+    if (!bluetooth_agent_check_sender((bluetooth_agent_t*)user_data, invocation)) {
+        return;
+    }
+
+    g_dbus_method_invocation_return_value(invocation, g_variant_new("(s)", "0000"));
+}
+
+void bluetooth_agent_request_passkey(GVariant* parameters, GDBusMethodInvocation* invocation,
+                                     void* user_data) {
+    if (!bluetooth_agent_check_sender((bluetooth_agent_t*)user_data, invocation)) {
+        return;
+    }
+
+    g_dbus_method_invocation_return_value(invocation, g_variant_new("(u)", (guint32)0));
+}
+
+const struct dbus_service_argument_spec bluetooth_agent_request_pin_code_arguments[] = {
+    { "device", DBUS_SERVICE_ARGUMENT_OBJECT_PATH, DBUS_SERVICE_ARGUMENT_IN },
+    { "pincode", DBUS_SERVICE_ARGUMENT_STRING, DBUS_SERVICE_ARGUMENT_OUT },
+};
+
+const struct dbus_service_argument_spec bluetooth_agent_display_pin_code_arguments[] = {
+    { "device", DBUS_SERVICE_ARGUMENT_OBJECT_PATH, DBUS_SERVICE_ARGUMENT_IN },
+    { "pincode", DBUS_SERVICE_ARGUMENT_STRING, DBUS_SERVICE_ARGUMENT_IN },
+};
+
+const struct dbus_service_argument_spec bluetooth_agent_request_passkey_arguments[] = {
+    { "device", DBUS_SERVICE_ARGUMENT_OBJECT_PATH, DBUS_SERVICE_ARGUMENT_IN },
+    { "passkey", DBUS_SERVICE_ARGUMENT_UINT32, DBUS_SERVICE_ARGUMENT_OUT },
+};
+
+const struct dbus_service_argument_spec bluetooth_agent_display_passkey_arguments[] = {
+    { "device", DBUS_SERVICE_ARGUMENT_OBJECT_PATH, DBUS_SERVICE_ARGUMENT_IN },
+    { "passkey", DBUS_SERVICE_ARGUMENT_UINT32, DBUS_SERVICE_ARGUMENT_IN },
+    { "entered", DBUS_SERVICE_ARGUMENT_UINT16, DBUS_SERVICE_ARGUMENT_IN },
+};
+
+const struct dbus_service_argument_spec bluetooth_agent_request_confirmation_arguments[] = {
+    { "device", DBUS_SERVICE_ARGUMENT_OBJECT_PATH, DBUS_SERVICE_ARGUMENT_IN },
+    { "passkey", DBUS_SERVICE_ARGUMENT_UINT32, DBUS_SERVICE_ARGUMENT_IN },
+};
+
+const struct dbus_service_argument_spec bluetooth_agent_request_authorization_arguments[] = {
+    { "device", DBUS_SERVICE_ARGUMENT_OBJECT_PATH, DBUS_SERVICE_ARGUMENT_IN },
+};
+
+const struct dbus_service_argument_spec bluetooth_agent_authorize_service_arguments[] = {
+    { "device", DBUS_SERVICE_ARGUMENT_OBJECT_PATH, DBUS_SERVICE_ARGUMENT_IN },
+    { "uuid", DBUS_SERVICE_ARGUMENT_STRING, DBUS_SERVICE_ARGUMENT_IN },
+};
+
+#define BLUETOOTH_AGENT_METHOD(name, arguments, callback)                                          \
+    { { name, arguments, ARRAYSIZE(arguments) }, callback }
+
+#define BLUETOOTH_AGENT_METHOD_NO_ARGUMENTS(name, callback) { { name, NULL, 0 }, callback }
+
+// org.bluez.Agent1, see doc/org.bluez.Agent.rst in bluez
+const struct dbus_service_method_spec bluetooth_agent_methods[] = {
+    BLUETOOTH_AGENT_METHOD_NO_ARGUMENTS("Release", bluetooth_agent_release),
+    BLUETOOTH_AGENT_METHOD("RequestPinCode", bluetooth_agent_request_pin_code_arguments,
+                           bluetooth_agent_request_pin_code),
+    BLUETOOTH_AGENT_METHOD("DisplayPinCode", bluetooth_agent_display_pin_code_arguments,
+                           bluetooth_agent_accept),
+    BLUETOOTH_AGENT_METHOD("RequestPasskey", bluetooth_agent_request_passkey_arguments,
+                           bluetooth_agent_request_passkey),
+    BLUETOOTH_AGENT_METHOD("DisplayPasskey", bluetooth_agent_display_passkey_arguments,
+                           bluetooth_agent_accept),
+    BLUETOOTH_AGENT_METHOD("RequestConfirmation", bluetooth_agent_request_confirmation_arguments,
+                           bluetooth_agent_accept),
+    BLUETOOTH_AGENT_METHOD("RequestAuthorization",
+                           bluetooth_agent_request_authorization_arguments, bluetooth_agent_accept),
+    BLUETOOTH_AGENT_METHOD("AuthorizeService", bluetooth_agent_authorize_service_arguments,
+                           bluetooth_agent_accept),
+    BLUETOOTH_AGENT_METHOD_NO_ARGUMENTS("Cancel", bluetooth_agent_accept),
+};
+
+const struct dbus_service_interface_spec bluetooth_agent_interface = {
+    AGENT_INTERFACE_NAME,
+    bluetooth_agent_methods,
+    ARRAYSIZE(bluetooth_agent_methods),
+};
+
 bluetooth_agent_t* bluetooth_agent_create(bluetooth_t* connection, const char* path) {
     bluetooth_agent_t* agent;
 
     agent = (bluetooth_agent_t*)malloc(sizeof(bluetooth_agent_t));
     agent->connection = connection;
+    agent->path = strdup(path);
+    agent->registered = 0;
+    agent->cancellable = g_cancellable_new();
 
-    // todo: register dbus service
+    agent->spec.interfaces = &bluetooth_agent_interface;
+    agent->spec.interface_count = 1;
+    agent->spec.user_data = agent;
+
+    agent->service = dbus_service_register(connection->connection, path, &agent->spec);
+    if (!agent->service) {
+        bluetooth_agent_free(agent);
+        return NULL;
+    }
 
     return agent;
 }
@@ -645,17 +1843,100 @@ void bluetooth_agent_free(bluetooth_agent_t* agent) {
         return;
     }
 
-    bluetooth_unregister_agent(agent);
+    g_cancellable_cancel(agent->cancellable);
+    g_object_unref(agent->cancellable);
 
-    // todo: unregister dbus service
+    bluetooth_unregister_agent(agent);
+    dbus_service_unregister(agent->service);
 
+    free(agent->path);
     free(agent);
 }
 
+// called on the dbus thread with the reply to RegisterAgent. a failed registration leaves the
+// agent unregistered, so that nothing tries to undo it. once cancelled, the agent may be gone
+void bluetooth_agent_registered(GDBusProxy* proxy, GVariant* retval, GError* error,
+                                void* user_data) {
+    bluetooth_agent_t* agent;
+
+    if (!retval) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            fprintf(stderr, "RegisterAgent failed on %s: %s\n",
+                    g_dbus_proxy_get_object_path(proxy), error->message);
+        }
+
+        return;
+    }
+
+    agent = (bluetooth_agent_t*)user_data;
+    g_atomic_int_set(&agent->registered, 1);
+}
+
+// returns a new reference, or null if bluez isn't running
+GDBusProxy* bluetooth_get_agent_manager(bluetooth_t* bt) {
+    GDBusInterface* interface;
+
+    interface = g_dbus_object_manager_get_interface(bt->manager, BLUEZ_ROOT_PATH,
+                                                    AGENT_MANAGER_INTERFACE_NAME);
+
+    if (!interface) {
+        fprintf(stderr, "%s is not available\n", AGENT_MANAGER_INTERFACE_NAME);
+        return NULL;
+    }
+
+    return G_DBUS_PROXY(interface);
+}
+
 void bluetooth_register_agent(bluetooth_agent_t* agent) {
-    // todo: register agent via dbus
+    GDBusProxy* agent_manager;
+
+    if (g_atomic_int_get(&agent->registered)) {
+        return;
+    }
+
+    agent_manager = bluetooth_get_agent_manager(agent->connection);
+    if (!agent_manager) {
+        return;
+    }
+
+    // bluez handles both in order, so there is no need to wait in between
+    bluetooth_call(agent_manager, "RegisterAgent",
+                   g_variant_new("(os)", agent->path, BLUETOOTH_AGENT_CAPABILITY), -1,
+                   agent->cancellable, bluetooth_agent_registered, agent);
+
+    bluetooth_call(agent_manager, "RequestDefaultAgent", g_variant_new("(o)", agent->path), -1,
+                   NULL, bluetooth_log_call_result, "RequestDefaultAgent");
+
+    g_object_unref(agent_manager);
 }
 
 void bluetooth_unregister_agent(bluetooth_agent_t* agent) {
-    // todo: unregister agent via dbus
+    GDBusProxy* agent_manager;
+    GVariant* retval;
+    GError* error;
+
+    if (!g_atomic_int_compare_and_exchange(&agent->registered, 1, 0)) {
+        return;
+    }
+
+    agent_manager = bluetooth_get_agent_manager(agent->connection);
+    if (!agent_manager) {
+        return;
+    }
+
+    // synchronous, so that the request is out before the connection goes away
+    error = NULL;
+    retval = bluetooth_call_sync(agent_manager, "UnregisterAgent",
+                                 g_variant_new("(o)", agent->path), -1, &error);
+
+    if (retval) {
+        g_variant_unref(retval);
+    } else {
+        fprintf(stderr, "Failed to unregister agent at path %s: %s\n", agent->path,
+                error->message);
+
+        g_error_free(error);
+    }
+
+    g_object_unref(agent_manager);
 }
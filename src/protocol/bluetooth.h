@@ -1,27 +1,115 @@
 #ifndef BLUETOOTH_H
 #define BLUETOOTH_H
 
+#include "core/bluetooth_settings.h"
+
+#include <stddef.h>
 #include <stdint.h>
 
 typedef struct bluetooth bluetooth_t;
 typedef struct bluetooth_agent bluetooth_agent_t;
 typedef struct bluetooth_device bluetooth_device_t;
 typedef struct bluetooth_adapter bluetooth_adapter_t;
+typedef struct bluetooth_operation bluetooth_operation_t;
+
+typedef enum bluetooth_state {
+    BLUETOOTH_STATE_CONNECTING = 0,
+    BLUETOOTH_STATE_READY,
+
+    // bluez or the system bus is unavailable
+    BLUETOOTH_STATE_FAILED,
+} bluetooth_state;
+
+// success is 0 if the call failed
+typedef void (*bluetooth_operation_callback_t)(bluetooth_operation_t* operation, int success,
+                                               void* user_data);
+
+typedef enum bluetooth_device_event {
+    // devices were added, removed or replaced. sent once per batch of bus changes, after the
+    // batch's removals. device is null
+    BLUETOOTH_DEVICES_CHANGED = 0,
 
-bluetooth_t* bluetooth_connect();
+    // the device is freed once every callback has returned
+    BLUETOOTH_DEVICE_REMOVED,
+
+    // one or more of the device's properties changed
+    BLUETOOTH_DEVICE_CHANGED,
+} bluetooth_device_event;
+
+typedef void (*bluetooth_device_callback_t)(bluetooth_device_t* device,
+                                            bluetooth_device_event event, void* user_data);
+
+// returns right away. the connection is made in the background, and devices appear once it is
+// ready. bus_address is a d-bus address to find bluez on, or null for the system bus. returns NULL
+// on failure
+bluetooth_t* bluetooth_connect(const char* bus_address);
 void bluetooth_disconnect(bluetooth_t* bt);
 
+bluetooth_state bluetooth_get_state(bluetooth_t* bt);
+
+// counts device property updates, including the rssi and last seen changes which raise no event.
+// it moved if anything about the devices did
+uint64_t bluetooth_get_property_updates(bluetooth_t* bt);
+
+// calls the callbacks of finished operations and device events. call this regularly from the
+// thread which started them
+void bluetooth_dispatch(bluetooth_t* bt);
+
+// callback is called from bluetooth_dispatch for every device event. existing devices are not
+// announced, although an event queued before subscribing may still arrive for a device that
+// bluetooth_iterate_devices already returned. returns a subscription id
+int bluetooth_subscribe(bluetooth_t* bt, bluetooth_device_callback_t callback, void* user_data);
+
+// safe to call from within a device callback
+void bluetooth_unsubscribe(bluetooth_t* bt, int id);
+
 bluetooth_device_t** bluetooth_iterate_devices(bluetooth_t* bt, uint32_t* count);
 
+// discovers devices on every adapter until a matching bluetooth_stop_discovery. calls nest, and
+// only the first call's filter is applied. filter can be null
+void bluetooth_start_discovery(bluetooth_t* bt, const struct bluetooth_discovery_filter* filter);
+void bluetooth_stop_discovery(bluetooth_t* bt);
+
+// fills devices with at most max_devices named devices, best first: paired devices, then the rest
+// by signal strength. unpaired devices which haven't advertised for stale_us microseconds are left
+// out. returns the number of devices written
+size_t bluetooth_rank_devices(bluetooth_t* bt, bluetooth_device_t** devices, size_t max_devices,
+                              uint64_t stale_us);
+
 char* bluetooth_device_get_name(bluetooth_device_t* device);
 char* bluetooth_device_get_address(bluetooth_device_t* device);
 
 bluetooth_adapter_t* bluetooth_device_get_adapter(bluetooth_device_t* device);
 
 int bluetooth_device_is_paired(bluetooth_device_t* device);
+int bluetooth_device_is_trusted(bluetooth_device_t* device);
+int bluetooth_device_is_connected(bluetooth_device_t* device);
+
+// returns 0 while the device is out of range, leaving rssi alone
+int bluetooth_device_get_rssi(bluetooth_device_t* device, int16_t* rssi);
+
+// monotonic time of the last advertisement or property change. 0 if never heard from
+uint64_t bluetooth_device_get_last_seen_us(bluetooth_device_t* device);
+
+// pairing and removal never block, as bluez may take as long as it likes to answer. the callback
+// is called once from bluetooth_dispatch, unless the operation is cancelled first. the operation is
+// freed after its callback returns. returns NULL on failure
+bluetooth_operation_t* bluetooth_device_pair_async(bluetooth_device_t* device,
+                                                   bluetooth_operation_callback_t callback,
+                                                   void* user_data);
+
+bluetooth_operation_t* bluetooth_device_remove_async(bluetooth_device_t* device,
+                                                     bluetooth_operation_callback_t callback,
+                                                     void* user_data);
+
+// connects every profile the device offers
+bluetooth_operation_t* bluetooth_device_connect_async(bluetooth_device_t* device,
+                                                      bluetooth_operation_callback_t callback,
+                                                      void* user_data);
 
-int bluetooth_device_pair(bluetooth_device_t* device);
-int bluetooth_device_remove(bluetooth_device_t* device);
+// stops waiting for an operation. its callback will not be called. a pairing or connection in
+// progress is aborted as well
+void bluetooth_operation_cancel(bluetooth_operation_t* operation);
 
 bluetooth_agent_t* bluetooth_agent_create(bluetooth_t* connection, const char* path);
 void bluetooth_agent_free(bluetooth_agent_t* agent);
@@ -0,0 +1,508 @@
+#include "protocol/bluetooth_cache.h"
+
+#include "core/util.h"
+
+#include <stdio.h>
+
+#include <malloc.h>
+#include <string.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// "RBTC" read as a little endian integer
+#define BLUETOOTH_CACHE_MAGIC 0x43544252
+#define BLUETOOTH_CACHE_VERSION 1
+
+// rssi churns constantly while discovering, so changes are saved at most this often
+#define BLUETOOTH_CACHE_SAVE_INTERVAL_MS 30000
+
+// followed by record_count records
+struct bluetooth_cache_header {
+    uint32_t magic;
+    uint16_t version;
+
+    // catches layout changes nobody bumped the version for
+    uint16_t record_size;
+
+    uint32_t record_count;
+    uint32_t reserved;
+};
+
+struct bluetooth_cache {
+    bluetooth_t* bt;
+    char* path;
+
+    uint32_t max_devices;
+    uint64_t stale_us;
+
+    // the file as it was at startup. null if there was none
+    void* mapping;
+    size_t mapping_size;
+
+    const struct bluetooth_cache_record* records;
+    uint32_t record_count;
+
+    int subscription;
+
+    // a device changed since the last snapshot, if only its rssi or when it was last seen
+    int dirty;
+
+    // bluetooth_get_property_updates as of the last check
+    uint64_t property_updates;
+    uint64_t last_save_us;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    // the next snapshot to write. a newer one replaces it if the thread hasn't got to it yet.
+    // guarded by mutex
+    struct bluetooth_cache_record* pending;
+    uint32_t pending_count;
+    int stopping;
+};
+
+void bluetooth_cache_format_address(const struct bluetooth_cache_record* record, char* buffer) {
+    snprintf(buffer, 18, "%02X:%02X:%02X:%02X:%02X:%02X", record->address[0], record->address[1],
+             record->address[2], record->address[3], record->address[4], record->address[5]);
+}
+
+int bluetooth_cache_parse_address(const char* address, uint8_t* bytes) {
+    unsigned int values[6];
+    int length;
+    size_t i;
+
+    length = 0;
+    if (sscanf(address, "%2x:%2x:%2x:%2x:%2x:%2x%n", &values[0], &values[1], &values[2],
+               &values[3], &values[4], &values[5], &length) != 6 ||
+        address[length] != '\0') {
+        return 0;
+    }
+
+    for (i = 0; i < ARRAYSIZE(values); i++) {
+        bytes[i] = (uint8_t)values[i];
+    }
+
+    return 1;
+}
+
+// returns 0 and leaves the cache empty if the file is missing or damaged
+int bluetooth_cache_map(bluetooth_cache_t* cache) {
+    const struct bluetooth_cache_header* header;
+    struct stat file_stat;
+    void* mapping;
+    uint32_t i;
+    int fd;
+
+    fd = open(cache->path, O_RDONLY);
+    if (fd < 0) {
+        // nothing saved yet
+        if (errno != ENOENT) {
+            perror("open");
+        }
+
+        return 0;
+    }
+
+    if (fstat(fd, &file_stat) < 0) {
+        perror("fstat");
+
+        close(fd);
+        return 0;
+    }
+
+    if ((size_t)file_stat.st_size < sizeof(struct bluetooth_cache_header)) {
+        fprintf(stderr, "Ignoring truncated bluetooth cache at %s\n", cache->path);
+
+        close(fd);
+        return 0;
+    }
+
+    // the mapping outlives the descriptor. saves replace the file rather than write into it, so
+    // this keeps seeing the startup contents
+    mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        perror("mmap");
+        return 0;
+    }
+
+    header = (const struct bluetooth_cache_header*)mapping;
+    if (header->magic != BLUETOOTH_CACHE_MAGIC || header->version != BLUETOOTH_CACHE_VERSION ||
+        header->record_size != sizeof(struct bluetooth_cache_record) ||
+        (size_t)file_stat.st_size != sizeof(struct bluetooth_cache_header) +
+                                         (size_t)header->record_count * header->record_size) {
+        fprintf(stderr, "Ignoring damaged bluetooth cache at %s\n", cache->path);
+
+        munmap(mapping, file_stat.st_size);
+        return 0;
+    }
+
+    cache->mapping = mapping;
+    cache->mapping_size = file_stat.st_size;
+    cache->records = (const struct bluetooth_cache_record*)(header + 1);
+    cache->record_count = header->record_count;
+
+    // names are used as strings, and the mapping is read only
+    for (i = 0; i < cache->record_count; i++) {
+        if (!memchr(cache->records[i].name, '\0', BLUETOOTH_CACHE_NAME_SIZE)) {
+            cache->record_count = i;
+            break;
+        }
+    }
+
+    return 1;
+}
+
+int bluetooth_cache_write_all(int fd, const void* data, size_t size) {
+    size_t offset;
+    ssize_t bytes_written;
+
+    offset = 0;
+    while (offset < size) {
+        bytes_written = write(fd, (const uint8_t*)data + offset, size - offset);
+        if (bytes_written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            perror("write");
+            return 0;
+        }
+
+        offset += bytes_written;
+    }
+
+    return 1;
+}
+
+// called on the cache thread. written next to the old file and renamed over it, so that a crash
+// halfway through leaves the old file intact
+void bluetooth_cache_save(bluetooth_cache_t* cache, const struct bluetooth_cache_record* records,
+                          uint32_t count) {
+    static const mode_t file_mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+
+    struct bluetooth_cache_header header;
+    char* temp_path;
+    int fd, success;
+
+    temp_path = (char*)malloc(strlen(cache->path) + 5);
+    sprintf(temp_path, "%s.tmp", cache->path);
+
+    fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, file_mode);
+    if (fd < 0) {
+        perror("open");
+
+        free(temp_path);
+        return;
+    }
+
+    memset(&header, 0, sizeof(struct bluetooth_cache_header));
+    header.magic = BLUETOOTH_CACHE_MAGIC;
+    header.version = BLUETOOTH_CACHE_VERSION;
+    header.record_size = sizeof(struct bluetooth_cache_record);
+    header.record_count = count;
+
+    success = bluetooth_cache_write_all(fd, &header, sizeof(struct bluetooth_cache_header)) &&
+              bluetooth_cache_write_all(fd, records, count * sizeof(struct bluetooth_cache_record));
+
+    if (success && fsync(fd) < 0) {
+        perror("fsync");
+        success = 0;
+    }
+
+    close(fd);
+
+    if (success && rename(temp_path, cache->path) < 0) {
+        perror("rename");
+        success = 0;
+    }
+
+    if (!success) {
+        fprintf(stderr, "Failed to save bluetooth cache to %s\n", cache->path);
+        unlink(temp_path);
+    }
+
+    free(temp_path);
+}
+
+void* bluetooth_cache_run(void* arg) {
+    bluetooth_cache_t* cache;
+    struct bluetooth_cache_record* records;
+    uint32_t count;
+
+    cache = (bluetooth_cache_t*)arg;
+
+    pthread_mutex_lock(&cache->mutex);
+
+    // a snapshot queued before stopping is still written
+    for (;;) {
+        while (!cache->pending && !cache->stopping) {
+            pthread_cond_wait(&cache->cond, &cache->mutex);
+        }
+
+        if (!cache->pending) {
+            break;
+        }
+
+        records = cache->pending;
+        count = cache->pending_count;
+        cache->pending = NULL;
+
+        pthread_mutex_unlock(&cache->mutex);
+
+        bluetooth_cache_save(cache, records, count);
+        free(records);
+
+        pthread_mutex_lock(&cache->mutex);
+    }
+
+    pthread_mutex_unlock(&cache->mutex);
+    return NULL;
+}
+
+int bluetooth_cache_fill_record(struct bluetooth_cache_record* record, bluetooth_device_t* device,
+                                uint64_t now_us, uint64_t now_monotonic_us) {
+    char* address;
+    char* name;
+    int16_t rssi;
+    uint64_t last_seen_us;
+    int valid;
+
+    memset(record, 0, sizeof(struct bluetooth_cache_record));
+
+    address = bluetooth_device_get_address(device);
+    valid = address && bluetooth_cache_parse_address(address, record->address);
+    free(address);
+
+    if (!valid) {
+        return 0;
+    }
+
+    // ranked devices always have a name, unless it went away since
+    name = bluetooth_device_get_name(device);
+    if (name) {
+        strncpy(record->name, name, BLUETOOTH_CACHE_NAME_SIZE - 1);
+        free(name);
+    }
+
+    util_set_bit_flag(&record->flags, BLUETOOTH_CACHE_RECORD_PAIRED,
+                      bluetooth_device_is_paired(device));
+
+    if (bluetooth_device_get_rssi(device, &rssi)) {
+        record->flags |= BLUETOOTH_CACHE_RECORD_HAS_RSSI;
+        record->rssi = rssi < INT8_MIN ? INT8_MIN : rssi > INT8_MAX ? INT8_MAX : (int8_t)rssi;
+    }
+
+    // monotonic time means nothing after a reboot
+    last_seen_us = bluetooth_device_get_last_seen_us(device);
+    if (last_seen_us) {
+        record->last_seen_us = now_us - (now_monotonic_us - last_seen_us);
+    }
+
+    return 1;
+}
+
+int bluetooth_cache_find_address(const struct bluetooth_cache_record* records, uint32_t count,
+                                 const uint8_t* address) {
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        if (memcmp(records[i].address, address, sizeof(records[i].address)) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// the devices the bluetooth menu would show, followed by startup records bluez hasn't caught up
+// with. the connection must be ready
+void bluetooth_cache_queue_snapshot(bluetooth_cache_t* cache) {
+    struct bluetooth_cache_record* records;
+    bluetooth_device_t** devices;
+    uint64_t now_us, now_monotonic_us;
+    uint32_t count, i;
+    size_t device_count;
+
+    devices = (bluetooth_device_t**)malloc((cache->max_devices + 1) * sizeof(bluetooth_device_t*));
+    records = (struct bluetooth_cache_record*)malloc((cache->max_devices + 1) *
+                                                     sizeof(struct bluetooth_cache_record));
+
+    device_count = bluetooth_rank_devices(cache->bt, devices, cache->max_devices, cache->stale_us);
+
+    now_us = util_get_realtime_us();
+    now_monotonic_us = util_get_monotonic_us();
+
+    count = 0;
+    for (i = 0; i < device_count; i++) {
+        count += bluetooth_cache_fill_record(&records[count], devices[i], now_us, now_monotonic_us);
+    }
+
+    free(devices);
+
+    for (i = 0; i < cache->record_count && count < cache->max_devices; i++) {
+        if (bluetooth_cache_find_address(records, count, cache->records[i].address) ||
+            !bluetooth_cache_record_is_current(cache, &cache->records[i], BLUETOOTH_STATE_READY)) {
+            continue;
+        }
+
+        memcpy(&records[count++], &cache->records[i], sizeof(struct bluetooth_cache_record));
+    }
+
+    pthread_mutex_lock(&cache->mutex);
+
+    free(cache->pending);
+    cache->pending = records;
+    cache->pending_count = count;
+
+    pthread_cond_signal(&cache->cond);
+    pthread_mutex_unlock(&cache->mutex);
+
+    cache->dirty = 0;
+    cache->last_save_us = now_monotonic_us;
+}
+
+void bluetooth_cache_device_event(bluetooth_device_t* device, bluetooth_device_event event,
+                                  void* user_data) {
+    bluetooth_cache_t* cache;
+
+    cache = (bluetooth_cache_t*)user_data;
+    cache->dirty = 1;
+}
+
+// rssi and last seen updates raise no device event, so they are picked up here instead
+void bluetooth_cache_check_updates(bluetooth_cache_t* cache) {
+    uint64_t updates;
+
+    updates = bluetooth_get_property_updates(cache->bt);
+    if (updates != cache->property_updates) {
+        cache->property_updates = updates;
+        cache->dirty = 1;
+    }
+}
+
+bluetooth_cache_t* bluetooth_cache_create(bluetooth_t* bt, const char* path, uint32_t max_devices,
+                                          uint64_t stale_us) {
+    bluetooth_cache_t* cache;
+
+    cache = (bluetooth_cache_t*)malloc(sizeof(bluetooth_cache_t));
+    memset(cache, 0, sizeof(bluetooth_cache_t));
+
+    cache->bt = bt;
+    cache->path = strdup(path);
+    cache->max_devices = max_devices;
+    cache->stale_us = stale_us;
+
+    bluetooth_cache_map(cache);
+
+    pthread_mutex_init(&cache->mutex, NULL);
+    pthread_cond_init(&cache->cond, NULL);
+
+    if (pthread_create(&cache->thread, NULL, bluetooth_cache_run, cache)) {
+        fprintf(stderr, "Failed to start bluetooth cache thread\n");
+
+        pthread_cond_destroy(&cache->cond);
+        pthread_mutex_destroy(&cache->mutex);
+
+        if (cache->mapping) {
+            munmap(cache->mapping, cache->mapping_size);
+        }
+
+        free(cache->path);
+        free(cache);
+        return NULL;
+    }
+
+    // the first snapshot reconciles the startup records with bluez, whether or not anything changes
+    cache->dirty = 1;
+    cache->subscription = bluetooth_subscribe(bt, bluetooth_cache_device_event, cache);
+
+    return cache;
+}
+
+void bluetooth_cache_destroy(bluetooth_cache_t* cache) {
+    if (!cache) {
+        return;
+    }
+
+    bluetooth_unsubscribe(cache->bt, cache->subscription);
+    bluetooth_cache_check_updates(cache);
+
+    if (cache->dirty && bluetooth_get_state(cache->bt) == BLUETOOTH_STATE_READY) {
+        bluetooth_cache_queue_snapshot(cache);
+    }
+
+    pthread_mutex_lock(&cache->mutex);
+    cache->stopping = 1;
+
+    pthread_cond_signal(&cache->cond);
+    pthread_mutex_unlock(&cache->mutex);
+
+    pthread_join(cache->thread, NULL);
+
+    pthread_cond_destroy(&cache->cond);
+    pthread_mutex_destroy(&cache->mutex);
+
+    if (cache->mapping) {
+        munmap(cache->mapping, cache->mapping_size);
+    }
+
+    free(cache->path);
+    free(cache);
+}
+
+void bluetooth_cache_update(bluetooth_cache_t* cache) {
+    bluetooth_cache_check_updates(cache);
+
+    // nothing to reconcile with until bluez is there, and the startup records are kept as they are
+    if (!cache->dirty || bluetooth_get_state(cache->bt) != BLUETOOTH_STATE_READY) {
+        return;
+    }
+
+    if (cache->last_save_us &&
+        util_get_monotonic_us() - cache->last_save_us <
+            (uint64_t)BLUETOOTH_CACHE_SAVE_INTERVAL_MS * 1000) {
+        return;
+    }
+
+    bluetooth_cache_queue_snapshot(cache);
+}
+
+const struct bluetooth_cache_record* bluetooth_cache_get_records(bluetooth_cache_t* cache,
+                                                                 uint32_t* count) {
+    *count = cache->record_count;
+    return cache->records;
+}
+
+int bluetooth_cache_record_is_current(bluetooth_cache_t* cache,
+                                      const struct bluetooth_cache_record* record,
+                                      bluetooth_state state) {
+    uint64_t now_us;
+
+    switch (state) {
+    case BLUETOOTH_STATE_CONNECTING:
+        return 1;
+    case BLUETOOTH_STATE_READY:
+        break;
+    default:
+        // there is no way to use any of them
+        return 0;
+    }
+
+    if ((record->flags & BLUETOOTH_CACHE_RECORD_PAIRED) || !record->last_seen_us) {
+        return 0;
+    }
+
+    // a clock set back since the record was saved counts as just now
+    now_us = util_get_realtime_us();
+    return now_us < record->last_seen_us || now_us - record->last_seen_us < cache->stale_us;
+}
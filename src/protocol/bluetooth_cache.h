@@ -0,0 +1,59 @@
+#ifndef BLUETOOTH_CACHE_H
+#define BLUETOOTH_CACHE_H
+
+#include "protocol/bluetooth.h"
+
+#include <stdint.h>
+
+// longer names are cut. the screen is narrower than this anyway
+#define BLUETOOTH_CACHE_NAME_SIZE 32
+
+#define BLUETOOTH_CACHE_RECORD_PAIRED 0x01
+#define BLUETOOTH_CACHE_RECORD_HAS_RSSI 0x02
+
+typedef struct bluetooth_cache bluetooth_cache_t;
+
+// one device as it was last seen. stored as is, in host byte order
+struct bluetooth_cache_record {
+    uint8_t address[6];
+    uint8_t flags;
+    int8_t rssi;
+
+    // wall clock time of the last advertisement or property change, in microseconds. 0 if never
+    // heard from
+    uint64_t last_seen_us;
+
+    // nul terminated
+    char name[BLUETOOTH_CACHE_NAME_SIZE];
+};
+
+// maps the devices saved at path, if there are any, and keeps them up to date from bt from then on.
+// a missing or damaged file leaves the cache empty
+bluetooth_cache_t* bluetooth_cache_create(bluetooth_t* bt, const char* path, uint32_t max_devices,
+                                          uint64_t stale_us);
+
+// saves the devices one last time and waits for the file to be written
+void bluetooth_cache_destroy(bluetooth_cache_t* cache);
+
+// saves the devices in the background if they changed and the last save was long enough ago.
+// call this regularly after bluetooth_dispatch, from the same thread
+void bluetooth_cache_update(bluetooth_cache_t* cache);
+
+// the devices as of startup, best first. valid until the cache is destroyed
+const struct bluetooth_cache_record* bluetooth_cache_get_records(bluetooth_cache_t* cache,
+                                                                 uint32_t* count);
+
+// returns 1 if a record not matched by a live device should still be shown, given the state of the
+// connection. once bluez is ready, it lists every paired device itself, and unpaired ones go stale
+// as they would live
+int bluetooth_cache_record_is_current(bluetooth_cache_t* cache,
+                                      const struct bluetooth_cache_record* record,
+                                      bluetooth_state state);
+
+// buffer must hold at least 18 chars
+void bluetooth_cache_format_address(const struct bluetooth_cache_record* record, char* buffer);
+
+// returns 0 if address is not of the form XX:XX:XX:XX:XX:XX
+int bluetooth_cache_parse_address(const char* address, uint8_t* bytes);
+
+#endif
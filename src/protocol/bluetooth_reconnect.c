@@ -0,0 +1,286 @@
+#include "protocol/bluetooth_reconnect.h"
+
+#include "core/util.h"
+
+#include <stdio.h>
+
+#include <malloc.h>
+#include <string.h>
+
+// keeps the retry delay from overflowing
+#define BLUETOOTH_RECONNECT_MAX_BACKOFF_SHIFT 10
+
+typedef enum bluetooth_reconnect_target_state {
+    BLUETOOTH_RECONNECT_TARGET_WAITING = 0,
+    BLUETOOTH_RECONNECT_TARGET_CONNECTING,
+    BLUETOOTH_RECONNECT_TARGET_CONNECTED,
+    BLUETOOTH_RECONNECT_TARGET_FAILED,
+} bluetooth_reconnect_target_state;
+
+struct bluetooth_reconnect_target {
+    bluetooth_reconnect_t* reconnect;
+
+    // null once the device went away
+    bluetooth_device_t* device;
+
+    bluetooth_reconnect_target_state state;
+    uint32_t attempts;
+
+    // monotonic time at which a waiting target may be tried again
+    uint64_t next_attempt_us;
+
+    // null unless connecting
+    bluetooth_operation_t* operation;
+};
+
+struct bluetooth_reconnect {
+    bluetooth_t* bt;
+    struct bluetooth_reconnect_settings settings;
+
+    // null until the connection is ready
+    struct bluetooth_reconnect_target* targets;
+    uint32_t target_count;
+    int listed;
+
+    uint32_t in_flight;
+    int subscription;
+};
+
+struct bluetooth_reconnect_target*
+bluetooth_reconnect_find_target(bluetooth_reconnect_t* reconnect, bluetooth_device_t* device) {
+    uint32_t i;
+
+    for (i = 0; i < reconnect->target_count; i++) {
+        if (reconnect->targets[i].device == device) {
+            return &reconnect->targets[i];
+        }
+    }
+
+    return NULL;
+}
+
+void bluetooth_reconnect_settle(struct bluetooth_reconnect_target* target,
+                                bluetooth_reconnect_target_state state) {
+    if (target->operation) {
+        bluetooth_operation_cancel(target->operation);
+        target->operation = NULL;
+    }
+
+    if (target->state == BLUETOOTH_RECONNECT_TARGET_CONNECTING) {
+        target->reconnect->in_flight--;
+    }
+
+    target->state = state;
+}
+
+void bluetooth_reconnect_attempt_failed(struct bluetooth_reconnect_target* target) {
+    bluetooth_reconnect_t* reconnect;
+    uint32_t shift;
+    char* name;
+
+    reconnect = target->reconnect;
+    bluetooth_reconnect_settle(target, BLUETOOTH_RECONNECT_TARGET_WAITING);
+
+    target->attempts++;
+    if (target->attempts >= reconnect->settings.max_attempts) {
+        name = bluetooth_device_get_name(target->device);
+        fprintf(stderr, "Giving up on reconnecting to %s after %u attempts\n",
+                name ? name : "unnamed device", target->attempts);
+
+        free(name);
+
+        target->state = BLUETOOTH_RECONNECT_TARGET_FAILED;
+        return;
+    }
+
+    shift = target->attempts - 1;
+    if (shift > BLUETOOTH_RECONNECT_MAX_BACKOFF_SHIFT) {
+        shift = BLUETOOTH_RECONNECT_MAX_BACKOFF_SHIFT;
+    }
+
+    target->next_attempt_us =
+        util_get_monotonic_us() + ((uint64_t)reconnect->settings.retry_delay_ms * 1000 << shift);
+}
+
+void bluetooth_reconnect_connected(bluetooth_operation_t* operation, int success,
+                                   void* user_data) {
+    struct bluetooth_reconnect_target* target;
+
+    target = (struct bluetooth_reconnect_target*)user_data;
+    target->operation = NULL;
+
+    if (success) {
+        bluetooth_reconnect_settle(target, BLUETOOTH_RECONNECT_TARGET_CONNECTED);
+    } else {
+        bluetooth_reconnect_attempt_failed(target);
+    }
+}
+
+void bluetooth_reconnect_device_event(bluetooth_device_t* device, bluetooth_device_event event,
+                                      void* user_data) {
+    bluetooth_reconnect_t* reconnect;
+    struct bluetooth_reconnect_target* target;
+
+    reconnect = (bluetooth_reconnect_t*)user_data;
+
+    target = bluetooth_reconnect_find_target(reconnect, device);
+    if (!target) {
+        return;
+    }
+
+    switch (event) {
+    case BLUETOOTH_DEVICE_REMOVED:
+        if (target->state != BLUETOOTH_RECONNECT_TARGET_CONNECTED) {
+            bluetooth_reconnect_settle(target, BLUETOOTH_RECONNECT_TARGET_FAILED);
+        }
+
+        target->device = NULL;
+        break;
+    case BLUETOOTH_DEVICE_CHANGED:
+        // controllers often come back on their own, so there is no need to keep trying
+        if (target->state == BLUETOOTH_RECONNECT_TARGET_WAITING &&
+            bluetooth_device_is_connected(device)) {
+            target->state = BLUETOOTH_RECONNECT_TARGET_CONNECTED;
+        }
+
+        break;
+    default:
+        break;
+    }
+}
+
+void bluetooth_reconnect_list(bluetooth_reconnect_t* reconnect) {
+    struct bluetooth_reconnect_target* target;
+    bluetooth_device_t** devices;
+    uint32_t count, i;
+
+    devices = bluetooth_iterate_devices(reconnect->bt, &count);
+    reconnect->targets = (struct bluetooth_reconnect_target*)malloc(
+        (count + 1) * sizeof(struct bluetooth_reconnect_target));
+
+    for (i = 0; i < count; i++) {
+        if (!bluetooth_device_is_paired(devices[i]) || !bluetooth_device_is_trusted(devices[i])) {
+            continue;
+        }
+
+        target = &reconnect->targets[reconnect->target_count++];
+        memset(target, 0, sizeof(struct bluetooth_reconnect_target));
+
+        target->reconnect = reconnect;
+        target->device = devices[i];
+
+        if (bluetooth_device_is_connected(devices[i])) {
+            target->state = BLUETOOTH_RECONNECT_TARGET_CONNECTED;
+        }
+    }
+
+    free(devices);
+    reconnect->listed = 1;
+}
+
+bluetooth_reconnect_t*
+bluetooth_reconnect_create(bluetooth_t* bt, const struct bluetooth_reconnect_settings* settings) {
+    bluetooth_reconnect_t* reconnect;
+
+    reconnect = (bluetooth_reconnect_t*)malloc(sizeof(bluetooth_reconnect_t));
+    memset(reconnect, 0, sizeof(bluetooth_reconnect_t));
+
+    reconnect->bt = bt;
+    memcpy(&reconnect->settings, settings, sizeof(struct bluetooth_reconnect_settings));
+
+    // at least one attempt at a time, or nothing would ever happen
+    if (reconnect->settings.max_concurrent == 0) {
+        reconnect->settings.max_concurrent = 1;
+    }
+
+    reconnect->subscription = bluetooth_subscribe(bt, bluetooth_reconnect_device_event, reconnect);
+
+    return reconnect;
+}
+
+void bluetooth_reconnect_destroy(bluetooth_reconnect_t* reconnect) {
+    uint32_t i;
+
+    if (!reconnect) {
+        return;
+    }
+
+    bluetooth_unsubscribe(reconnect->bt, reconnect->subscription);
+
+    for (i = 0; i < reconnect->target_count; i++) {
+        bluetooth_operation_cancel(reconnect->targets[i].operation);
+    }
+
+    free(reconnect->targets);
+    free(reconnect);
+}
+
+int bluetooth_reconnect_update(bluetooth_reconnect_t* reconnect) {
+    struct bluetooth_reconnect_target* target;
+    struct bluetooth_reconnect_progress progress;
+    uint64_t now_us;
+    uint32_t i;
+
+    if (!reconnect->listed) {
+        switch (bluetooth_get_state(reconnect->bt)) {
+        case BLUETOOTH_STATE_CONNECTING:
+            return 1;
+        case BLUETOOTH_STATE_READY:
+            bluetooth_reconnect_list(reconnect);
+            break;
+        default:
+            // nothing to reconnect to
+            reconnect->listed = 1;
+            return 0;
+        }
+    }
+
+    // every device gets its first attempt right away, as far as max_concurrent allows
+    now_us = util_get_monotonic_us();
+    for (i = 0; i < reconnect->target_count; i++) {
+        if (reconnect->in_flight >= reconnect->settings.max_concurrent) {
+            break;
+        }
+
+        target = &reconnect->targets[i];
+        if (target->state != BLUETOOTH_RECONNECT_TARGET_WAITING ||
+            target->next_attempt_us > now_us) {
+            continue;
+        }
+
+        target->operation =
+            bluetooth_device_connect_async(target->device, bluetooth_reconnect_connected, target);
+
+        if (!target->operation) {
+            bluetooth_reconnect_attempt_failed(target);
+            continue;
+        }
+
+        target->state = BLUETOOTH_RECONNECT_TARGET_CONNECTING;
+        reconnect->in_flight++;
+    }
+
+    bluetooth_reconnect_get_progress(reconnect, &progress);
+    return progress.connected + progress.failed < progress.total;
+}
+
+void bluetooth_reconnect_get_progress(bluetooth_reconnect_t* reconnect,
+                                      struct bluetooth_reconnect_progress* progress) {
+    uint32_t i;
+
+    memset(progress, 0, sizeof(struct bluetooth_reconnect_progress));
+    progress->total = reconnect->target_count;
+
+    for (i = 0; i < reconnect->target_count; i++) {
+        switch (reconnect->targets[i].state) {
+        case BLUETOOTH_RECONNECT_TARGET_CONNECTED:
+            progress->connected++;
+            break;
+        case BLUETOOTH_RECONNECT_TARGET_FAILED:
+            progress->failed++;
+            break;
+        default:
+            break;
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef BLUETOOTH_RECONNECT_H
+#define BLUETOOTH_RECONNECT_H
+
+#include "core/bluetooth_settings.h"
+
+#include "protocol/bluetooth.h"
+
+#include <stdint.h>
+
+typedef struct bluetooth_reconnect bluetooth_reconnect_t;
+
+struct bluetooth_reconnect_progress {
+    // paired and trusted devices found once the connection was ready
+    uint32_t total;
+
+    uint32_t connected;
+
+    // out of attempts, or the device went away
+    uint32_t failed;
+};
+
+// connects to every paired and trusted device in the background, once bt is ready. devices which
+// show up later are left alone
+bluetooth_reconnect_t*
+bluetooth_reconnect_create(bluetooth_t* bt, const struct bluetooth_reconnect_settings* settings);
+
+// cancels attempts still in flight
+void bluetooth_reconnect_destroy(bluetooth_reconnect_t* reconnect);
+
+// starts attempts which are due. call this regularly after bluetooth_dispatch, from the same
+// thread. returns 0 once every device is connected or given up on
+int bluetooth_reconnect_update(bluetooth_reconnect_t* reconnect);
+
+void bluetooth_reconnect_get_progress(bluetooth_reconnect_t* reconnect,
+                                      struct bluetooth_reconnect_progress* progress);
+
+#endif
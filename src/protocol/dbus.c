@@ -1,51 +1,242 @@
 #include "protocol/dbus.h"
 
+#include "core/map.h"
+#include "core/stats.h"
+#include "core/util.h"
+
+#include <stdio.h>
+
 #include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <gio/gio.h>
 
 #include <pthread.h>
 
+// bucket i counts calls which took less than 2^i ms. the last one takes everything slower
+#define DBUS_CALL_LATENCY_BUCKETS 14
+
 struct dbus_main_loop {
+    // ours alone, so that nothing else built on glib runs on or contends with the loop thread
+    GMainContext* context;
     GMainLoop* glib_loop;
 
     pthread_t loop_thread;
     int thread_started;
 
+    // guarded by dbus_loop_mutex
     int32_t references;
+
+    // maps "interface.method" to dbus_call_stats ptr. guarded by calls_mutex
+    map_t* calls;
+    pthread_mutex_t calls_mutex;
+    int stats_id;
+};
+
+struct dbus_call_stats {
+    // "interface.method". also the key in the loop's map
+    char* name;
+
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t cancelled;
+    uint32_t in_flight;
+
+    uint64_t sync_calls;
+
+    // synchronous calls made off the dbus thread, which is the ui thread in practice
+    uint64_t blocking_calls;
+
+    uint64_t total_latency_us;
+    uint64_t max_latency_us;
+    uint64_t latency_buckets[DBUS_CALL_LATENCY_BUCKETS];
+};
+
+struct dbus_loop_invocation {
+    dbus_loop_callback_t callback;
+    void* user_data;
+
+    // only used by dbus_loop_invoke_sync
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int finished;
+};
+
+struct dbus_service_interface {
+    dbus_service_t* service;
+    const struct dbus_service_interface_spec* spec;
+
+    // maps GDBusMethodInfo ptr to method spec ptr. gdbus hands us the method info of each call, so
+    // dispatching never compares names
+    map_t* methods;
+
+    // 0 if not registered
+    guint registration_id;
 };
 
 struct dbus_service {
     GDBusConnection* connection;
+    const struct dbus_service_spec* spec;
 
     char* introspection;
+    GDBusNodeInfo* node_info;
+
+    struct dbus_service_interface* interfaces;
+    uint32_t interface_count;
+};
+
+// indexed by dbus_service_argument_type
+const char* dbus_service_type_signatures[] = {
+    "y", "b", "n", "q", "i", "u", "x", "t", "d", "s", "o", "g", "h",
 };
 
 struct dbus_main_loop* dbus_loop = NULL;
 
+// guards dbus_loop itself and its references. they are taken and dropped from both the ui and the
+// dbus thread
+static pthread_mutex_t dbus_loop_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 void* dbus_loop_run(void* arg) {
     struct dbus_main_loop* loop;
 
     loop = (struct dbus_main_loop*)arg;
+
+    // async calls, signal subscriptions and exported objects bind to the thread-default context of
+    // whoever sets them up, which is this one for anything started on the loop thread
+    g_main_context_push_thread_default(loop->context);
     g_main_loop_run(loop->glib_loop);
+    g_main_context_pop_thread_default(loop->context);
 
     return NULL;
 }
 
+int dbus_call_compare_stats(const void* lhs, const void* rhs) {
+    return strcmp((*(struct dbus_call_stats**)lhs)->name, (*(struct dbus_call_stats**)rhs)->name);
+}
+
+void dbus_call_iterate_collect_stats(void* key, void* value, void* user_data) {
+    struct dbus_call_stats*** cursor;
+
+    cursor = (struct dbus_call_stats***)user_data;
+    *(*cursor)++ = (struct dbus_call_stats*)value;
+}
+
+void dbus_call_iterate_free_stats(void* key, void* value, void* user_data) {
+    struct dbus_call_stats* stats;
+
+    stats = (struct dbus_call_stats*)value;
+
+    free(stats->name);
+    free(stats);
+}
+
+void dbus_loop_dump_stats(void* user_data, FILE* stream) {
+    struct dbus_main_loop* loop;
+    struct dbus_call_stats** sorted;
+    struct dbus_call_stats** cursor;
+    struct dbus_call_stats* stats;
+    size_t count, i;
+    uint32_t bucket;
+
+    loop = (struct dbus_main_loop*)user_data;
+
+    pthread_mutex_lock(&loop->calls_mutex);
+
+    count = map_get_size(loop->calls);
+    sorted = (struct dbus_call_stats**)malloc((count + 1) * sizeof(struct dbus_call_stats*));
+
+    cursor = sorted;
+    map_iterate(loop->calls, dbus_call_iterate_collect_stats, &cursor);
+    qsort(sorted, count, sizeof(struct dbus_call_stats*), dbus_call_compare_stats);
+
+    for (i = 0; i < count; i++) {
+        stats = sorted[i];
+
+        fprintf(stream, "%s: %llu calls, %llu errors, %llu cancelled, %u in flight\n", stats->name,
+                (unsigned long long)stats->calls, (unsigned long long)stats->errors,
+                (unsigned long long)stats->cancelled, stats->in_flight);
+
+        if (stats->sync_calls > 0) {
+            fprintf(stream, "%s sync: %llu calls, %llu off the dbus thread\n", stats->name,
+                    (unsigned long long)stats->sync_calls,
+                    (unsigned long long)stats->blocking_calls);
+        }
+
+        if (stats->calls == stats->in_flight) {
+            continue;
+        }
+
+        fprintf(stream, "%s latency: mean %llu us, max %llu us,", stats->name,
+                (unsigned long long)(stats->total_latency_us / (stats->calls - stats->in_flight)),
+                (unsigned long long)stats->max_latency_us);
+
+        // empty buckets are left out to keep the line short
+        for (bucket = 0; bucket < DBUS_CALL_LATENCY_BUCKETS; bucket++) {
+            if (stats->latency_buckets[bucket] == 0) {
+                continue;
+            }
+
+            if (bucket == DBUS_CALL_LATENCY_BUCKETS - 1) {
+                fprintf(stream, " >=%u ms: %llu", 1u << (bucket - 1),
+                        (unsigned long long)stats->latency_buckets[bucket]);
+            } else {
+                fprintf(stream, " <%u ms: %llu", 1u << bucket,
+                        (unsigned long long)stats->latency_buckets[bucket]);
+            }
+        }
+
+        fprintf(stream, "\n");
+    }
+
+    pthread_mutex_unlock(&loop->calls_mutex);
+
+    free(sorted);
+}
+
+// frees dbus_loop. the caller holds dbus_loop_mutex
+void dbus_loop_destroy() {
+    if (dbus_loop->glib_loop) {
+        g_main_loop_quit(dbus_loop->glib_loop);
+
+        if (dbus_loop->thread_started) {
+            pthread_join(dbus_loop->loop_thread, NULL);
+        }
+
+        g_main_loop_unref(dbus_loop->glib_loop);
+    }
+
+    g_main_context_unref(dbus_loop->context);
+
+    stats_unregister(dbus_loop->stats_id);
+
+    map_iterate(dbus_loop->calls, dbus_call_iterate_free_stats, NULL);
+    map_free(dbus_loop->calls);
+    pthread_mutex_destroy(&dbus_loop->calls_mutex);
+
+    free(dbus_loop);
+    dbus_loop = NULL;
+}
+
 int dbus_loop_ref() {
+    pthread_mutex_lock(&dbus_loop_mutex);
+
     if (!dbus_loop) {
         dbus_loop = (struct dbus_main_loop*)malloc(sizeof(struct dbus_main_loop));
         dbus_loop->references = 0;
         dbus_loop->thread_started = 0;
 
-        dbus_loop->glib_loop = g_main_loop_new(NULL, TRUE);
-        if (!dbus_loop->glib_loop) {
-            dbus_loop_unref();
-            return 0;
-        }
+        dbus_loop->calls = map_alloc_string_key(32);
+        pthread_mutex_init(&dbus_loop->calls_mutex, NULL);
+        dbus_loop->stats_id = stats_register("dbus", dbus_loop_dump_stats, dbus_loop);
+
+        dbus_loop->context = g_main_context_new();
+        dbus_loop->glib_loop = g_main_loop_new(dbus_loop->context, TRUE);
+        if (!dbus_loop->glib_loop ||
+            pthread_create(&dbus_loop->loop_thread, NULL, dbus_loop_run, dbus_loop)) {
+            dbus_loop_destroy();
 
-        if (pthread_create(&dbus_loop->loop_thread, NULL, dbus_loop_run, dbus_loop)) {
-            dbus_loop_unref();
+            pthread_mutex_unlock(&dbus_loop_mutex);
             return 0;
         }
 
@@ -53,65 +244,362 @@ int dbus_loop_ref() {
     }
 
     dbus_loop->references++;
+
+    pthread_mutex_unlock(&dbus_loop_mutex);
     return 1;
 }
 
 void dbus_loop_unref() {
-    if (!dbus_loop) {
+    pthread_mutex_lock(&dbus_loop_mutex);
+
+    if (dbus_loop) {
+        dbus_loop->references--;
+        if (dbus_loop->references <= 0) {
+            dbus_loop_destroy();
+        }
+    }
+
+    pthread_mutex_unlock(&dbus_loop_mutex);
+}
+
+GMainContext* dbus_loop_get_context() { return dbus_loop->context; }
+
+int dbus_loop_is_current_thread() { return g_main_context_is_owner(dbus_loop->context); }
+
+// called on the dbus thread
+gboolean dbus_loop_dispatch_invocation(gpointer user_data) {
+    struct dbus_loop_invocation* invocation;
+
+    invocation = (struct dbus_loop_invocation*)user_data;
+    invocation->callback(invocation->user_data);
+
+    return G_SOURCE_REMOVE;
+}
+
+void dbus_loop_attach_invocation(struct dbus_loop_invocation* invocation,
+                                 GDestroyNotify destroy_callback) {
+    GSource* source;
+
+    // ahead of idle work, same as replies
+    source = g_idle_source_new();
+    g_source_set_priority(source, G_PRIORITY_DEFAULT);
+    g_source_set_callback(source, dbus_loop_dispatch_invocation, invocation, destroy_callback);
+
+    g_source_attach(source, dbus_loop->context);
+    g_source_unref(source);
+}
+
+void dbus_loop_invoke(dbus_loop_callback_t callback, void* user_data) {
+    struct dbus_loop_invocation* invocation;
+
+    if (dbus_loop_is_current_thread()) {
+        callback(user_data);
         return;
     }
 
-    dbus_loop->references--;
-    if (dbus_loop->references > 0) {
+    invocation = (struct dbus_loop_invocation*)malloc(sizeof(struct dbus_loop_invocation));
+    invocation->callback = callback;
+    invocation->user_data = user_data;
+
+    dbus_loop_attach_invocation(invocation, free);
+}
+
+// called on the dbus thread once the invocation's source is done with it
+void dbus_loop_finish_invocation(gpointer user_data) {
+    struct dbus_loop_invocation* invocation;
+
+    invocation = (struct dbus_loop_invocation*)user_data;
+
+    pthread_mutex_lock(&invocation->mutex);
+    invocation->finished = 1;
+
+    pthread_cond_signal(&invocation->cond);
+    pthread_mutex_unlock(&invocation->mutex);
+}
+
+void dbus_loop_invoke_sync(dbus_loop_callback_t callback, void* user_data) {
+    struct dbus_loop_invocation invocation;
+
+    if (dbus_loop_is_current_thread()) {
+        callback(user_data);
         return;
     }
 
-    if (dbus_loop->glib_loop) {
-        g_main_loop_quit(dbus_loop->glib_loop);
+    invocation.callback = callback;
+    invocation.user_data = user_data;
+    invocation.finished = 0;
 
-        if (dbus_loop->thread_started) {
-            pthread_join(dbus_loop->loop_thread, NULL);
+    pthread_mutex_init(&invocation.mutex, NULL);
+    pthread_cond_init(&invocation.cond, NULL);
+
+    dbus_loop_attach_invocation(&invocation, dbus_loop_finish_invocation);
+
+    pthread_mutex_lock(&invocation.mutex);
+    while (!invocation.finished) {
+        pthread_cond_wait(&invocation.cond, &invocation.mutex);
+    }
+
+    pthread_mutex_unlock(&invocation.mutex);
+
+    pthread_cond_destroy(&invocation.cond);
+    pthread_mutex_destroy(&invocation.mutex);
+}
+
+void dbus_call_begin(struct dbus_call_timer* timer, const char* interface, const char* method,
+                     int synchronous) {
+    struct dbus_call_stats* stats;
+    char* name;
+    int blocking;
+
+    name = (char*)malloc(strlen(interface) + strlen(method) + 2);
+    sprintf(name, "%s.%s", interface, method);
+
+    blocking = synchronous && !dbus_loop_is_current_thread();
+
+    pthread_mutex_lock(&dbus_loop->calls_mutex);
+
+    if (map_get(dbus_loop->calls, name, (void**)&stats)) {
+        free(name);
+    } else {
+        stats = (struct dbus_call_stats*)malloc(sizeof(struct dbus_call_stats));
+        memset(stats, 0, sizeof(struct dbus_call_stats));
+
+        stats->name = name;
+        map_insert(dbus_loop->calls, stats->name, stats);
+    }
+
+    stats->calls++;
+    stats->in_flight++;
+
+    if (synchronous) {
+        stats->sync_calls++;
+    }
+
+    // once per method is enough to find it, the stats dump has the count
+    if (blocking && stats->blocking_calls++ == 0) {
+        fprintf(stderr, "Synchronous D-Bus call to %s made off the dbus thread\n", stats->name);
+    }
+
+    pthread_mutex_unlock(&dbus_loop->calls_mutex);
+
+    timer->stats = stats;
+    timer->start_us = util_get_monotonic_us();
+}
+
+void dbus_call_end(struct dbus_call_timer* timer, dbus_call_result result) {
+    struct dbus_call_stats* stats;
+    uint64_t latency_us;
+    uint32_t bucket;
+
+    latency_us = util_get_monotonic_us() - timer->start_us;
+    stats = timer->stats;
+
+    bucket = 0;
+    while (bucket < DBUS_CALL_LATENCY_BUCKETS - 1 && latency_us >= (1000ull << bucket)) {
+        bucket++;
+    }
+
+    pthread_mutex_lock(&dbus_loop->calls_mutex);
+
+    stats->in_flight--;
+
+    switch (result) {
+    case DBUS_CALL_FAILED:
+        stats->errors++;
+        break;
+    case DBUS_CALL_CANCELLED:
+        stats->cancelled++;
+        break;
+    default:
+        break;
+    }
+
+    stats->total_latency_us += latency_us;
+    if (latency_us > stats->max_latency_us) {
+        stats->max_latency_us = latency_us;
+    }
+
+    stats->latency_buckets[bucket]++;
+
+    pthread_mutex_unlock(&dbus_loop->calls_mutex);
+}
+
+char* dbus_service_generate_introspection(const struct dbus_service_spec* spec) {
+    const struct dbus_service_interface_spec* interface;
+    const struct dbus_service_function_signature* signature;
+    const struct dbus_service_argument_spec* argument;
+    GString* xml;
+    uint32_t i, j, k;
+
+    xml = g_string_new("<node>\n");
+    for (i = 0; i < spec->interface_count; i++) {
+        interface = &spec->interfaces[i];
+        g_string_append_printf(xml, "  <interface name=\"%s\">\n", interface->name);
+
+        for (j = 0; j < interface->method_count; j++) {
+            signature = &interface->methods[j].signature;
+            g_string_append_printf(xml, "    <method name=\"%s\">\n", signature->name);
+
+            for (k = 0; k < signature->argument_count; k++) {
+                argument = &signature->arguments[k];
+
+                g_string_append_printf(
+                    xml, "      <arg name=\"%s\" type=\"%s\" direction=\"%s\"/>\n", argument->name,
+                    dbus_service_type_signatures[argument->type],
+                    argument->direction == DBUS_SERVICE_ARGUMENT_IN ? "in" : "out");
+            }
+
+            g_string_append(xml, "    </method>\n");
         }
 
-        g_main_loop_unref(dbus_loop->glib_loop);
+        g_string_append(xml, "  </interface>\n");
     }
 
-    free(dbus_loop);
-    dbus_loop = NULL;
+    g_string_append(xml, "</node>\n");
+
+    // freed with g_free
+    return g_string_free(xml, FALSE);
+}
+// called on the dbus thread
+void dbus_service_method_call(GDBusConnection* connection, const gchar* sender,
+                              const gchar* object_path, const gchar* interface_name,
+                              const gchar* method_name, GVariant* parameters,
+                              GDBusMethodInvocation* invocation, gpointer user_data) {
+    struct dbus_service_interface* interface;
+    struct dbus_service_method_spec* method;
+
+    interface = (struct dbus_service_interface*)user_data;
+
+    // gdbus already rejected methods missing from the introspection data
+    if (!map_get(interface->methods, (void*)g_dbus_method_invocation_get_method_info(invocation),
+                 (void**)&method) ||
+        !method->callback) {
+        g_dbus_method_invocation_return_dbus_error(invocation,
+                                                   "org.freedesktop.DBus.Error.UnknownMethod",
+                                                   "Method not implemented");
+
+        return;
+    }
+
+    method->callback(parameters, invocation, interface->service->spec->user_data);
+}
+
+const GDBusInterfaceVTable dbus_service_vtable = {
+    .method_call = dbus_service_method_call,
+};
+
+int dbus_service_register_interface(dbus_service_t* service, const char* path,
+                                    struct dbus_service_interface* interface,
+                                    GDBusInterfaceInfo* info) {
+    GError* error;
+    uint32_t i;
+
+    // the generated xml lists methods in spec order
+    interface->methods = map_alloc(interface->spec->method_count * 2 + 1, NULL);
+    for (i = 0; i < interface->spec->method_count; i++) {
+        map_insert(interface->methods, info->methods[i], (void*)&interface->spec->methods[i]);
+    }
+
+    error = NULL;
+    interface->registration_id = g_dbus_connection_register_object(
+        service->connection, path, info, &dbus_service_vtable, interface, NULL, &error);
+
+    if (!interface->registration_id) {
+        fprintf(stderr, "Failed to register %s at %s: %s\n", interface->spec->name, path,
+                error->message);
+
+        g_error_free(error);
+        return 0;
+    }
+
+    return 1;
 }
 
-dbus_service_t* dbus_service_register(GDBusConnection* connection,
+dbus_service_t* dbus_service_register(GDBusConnection* connection, const char* path,
                                       const struct dbus_service_spec* spec) {
     dbus_service_t* service;
+    struct dbus_service_interface* interface;
+    GError* error;
+    uint32_t i;
 
     if (!dbus_loop_ref()) {
         return NULL;
     }
 
     service = (dbus_service_t*)malloc(sizeof(dbus_service_t));
+    service->spec = spec;
 
     service->connection = connection;
     g_object_ref(connection);
 
-    // todo: generate introspection XML
-    service->introspection = NULL;
+    service->interface_count = spec->interface_count;
+    service->interfaces = (struct dbus_service_interface*)malloc(
+        spec->interface_count * sizeof(struct dbus_service_interface));
+
+    for (i = 0; i < spec->interface_count; i++) {
+        interface = &service->interfaces[i];
+
+        interface->service = service;
+        interface->spec = &spec->interfaces[i];
+        interface->methods = NULL;
+        interface->registration_id = 0;
+    }
+
+    service->introspection = dbus_service_generate_introspection(spec);
+
+    error = NULL;
+    service->node_info = g_dbus_node_info_new_for_xml(service->introspection, &error);
+
+    if (!service->node_info) {
+        fprintf(stderr, "Failed to parse generated introspection data: %s\n", error->message);
+        g_error_free(error);
 
-    // todo: register
+        dbus_service_unregister(service);
+        return NULL;
+    }
+
+    for (i = 0; i < spec->interface_count; i++) {
+        if (!dbus_service_register_interface(service, path, &service->interfaces[i],
+                                             service->node_info->interfaces[i])) {
+            dbus_service_unregister(service);
+            return NULL;
+        }
+    }
 
     return service;
 }
 
 void dbus_service_unregister(dbus_service_t* service) {
+    struct dbus_service_interface* interface;
+    uint32_t i;
+
     if (!service) {
         return;
     }
 
-    // todo: unregister service
+    for (i = 0; i < service->interface_count; i++) {
+        interface = &service->interfaces[i];
+
+        if (interface->registration_id) {
+            g_dbus_connection_unregister_object(service->connection, interface->registration_id);
+        }
+
+        if (interface->methods) {
+            map_free(interface->methods);
+        }
+    }
+
+    if (service->node_info) {
+        g_dbus_node_info_unref(service->node_info);
+    }
 
     g_object_unref(service->connection);
 
-    free(service->introspection);
+    g_free(service->introspection);
+    free(service->interfaces);
     free(service);
+
+    dbus_loop_unref();
 }
 
 const char* dbus_service_introspect(dbus_service_t* service) { return service->introspection; }
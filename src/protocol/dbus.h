@@ -3,8 +3,13 @@
 
 #include <stdint.h>
 
-// from dbus/dbus.h
+// from gio/gio.h
 typedef struct _GDBusConnection GDBusConnection;
+typedef struct _GDBusMethodInvocation GDBusMethodInvocation;
+typedef struct _GVariant GVariant;
+
+// from glib.h
+typedef struct _GMainContext GMainContext;
 
 typedef enum dbus_service_argument_direction {
     DBUS_SERVICE_ARGUMENT_IN,
@@ -27,7 +32,11 @@ typedef enum dbus_service_argument_type {
     DBUS_SERVICE_ARGUMENT_FILE_DESCRIPTOR,
 } dbus_service_argument_type;
 
-typedef void (* dbus_service_method_callback_t)();
+// called on the dbus thread. the callback must reply through the invocation, e.g. with
+// g_dbus_method_invocation_return_value
+typedef void (*dbus_service_method_callback_t)(GVariant* parameters,
+                                               GDBusMethodInvocation* invocation,
+                                               void* user_data);
 
 struct dbus_service_argument_spec {
     const char* name;
@@ -64,10 +73,50 @@ struct dbus_service_spec {
 
 typedef struct dbus_service dbus_service_t;
 
+typedef void (*dbus_loop_callback_t)(void* user_data);
+
+typedef enum dbus_call_result {
+    DBUS_CALL_SUCCEEDED,
+    DBUS_CALL_FAILED,
+    DBUS_CALL_CANCELLED,
+} dbus_call_result;
+
+typedef struct dbus_call_stats dbus_call_stats_t;
+
+// one method call being timed. filled in by dbus_call_begin
+struct dbus_call_timer {
+    dbus_call_stats_t* stats;
+    uint64_t start_us;
+};
+
 int dbus_loop_ref();
 void dbus_loop_unref();
 
-dbus_service_t* dbus_service_register(GDBusConnection* connection,
+// the context the dbus thread runs. sources meant for the dbus thread are attached to this
+GMainContext* dbus_loop_get_context();
+
+// returns 1 if called on the dbus thread
+int dbus_loop_is_current_thread();
+
+// runs callback on the dbus thread. from any other thread, it is queued and this returns right
+// away. start async calls and signal subscriptions through this, so that they bind to the loop
+void dbus_loop_invoke(dbus_loop_callback_t callback, void* user_data);
+
+// same as dbus_loop_invoke, but returns once callback has returned
+void dbus_loop_invoke_sync(dbus_loop_callback_t callback, void* user_data);
+
+// counts a call to interface.method as in flight and starts timing it. synchronous calls made off
+// the dbus thread block the ui, so they are flagged. only while holding a reference to the loop
+void dbus_call_begin(struct dbus_call_timer* timer, const char* interface, const char* method,
+                     int synchronous);
+
+// records how a call started with dbus_call_begin went and how long it took. safe to call from
+// any thread
+void dbus_call_end(struct dbus_call_timer* timer, dbus_call_result result);
+
+// exports every interface in the spec at the given path. the spec must outlive the service. call
+// from the dbus thread, which is where method calls are dispatched
+dbus_service_t* dbus_service_register(GDBusConnection* connection, const char* path,
                                       const struct dbus_service_spec* spec);
 
 void dbus_service_unregister(dbus_service_t* service);
@@ -1,33 +1,24 @@
-#include "protocol/gpio.h"
+#include "protocol/gpio_backend.h"
 
-#include <stdio.h>
 #include <malloc.h>
 #include <string.h>
 
-#include <gpiod.h>
-
-struct gpio_chip {
-    struct gpiod_chip* chip;
-
-    char* device;
-    char* consumer;
-};
+// device names starting with this open a simulated chip
+#define GPIO_SIM_DEVICE_PREFIX "sim"
 
 gpio_chip_t* gpio_chip_open(const char* device, const char* consumer) {
     gpio_chip_t* chip;
 
-    int error;
-    int len;
-
     chip = (gpio_chip_t*)malloc(sizeof(gpio_chip_t));
-    chip->device = strdup(device);
-    chip->consumer = strdup(consumer);
-
-    chip->chip = gpiod_chip_open(device);
-    if (!chip->chip) {
-        perror("gpiod_chip_open");
+    if (!strncmp(device, GPIO_SIM_DEVICE_PREFIX, strlen(GPIO_SIM_DEVICE_PREFIX))) {
+        chip->backend = &gpio_backend_sim;
+    } else {
+        chip->backend = &gpio_backend_gpiod;
+    }
 
-        gpio_chip_close(chip);
+    chip->data = chip->backend->chip_open(device, consumer);
+    if (!chip->data) {
+        free(chip);
         return NULL;
     }
 
@@ -39,93 +30,61 @@ void gpio_chip_close(gpio_chip_t* chip) {
         return;
     }
 
-    if (chip->chip) {
-        gpiod_chip_close(chip->chip);
-    }
-
-    free(chip->device);
-    free(chip->consumer);
-
+    chip->backend->chip_close(chip->data);
     free(chip);
 }
 
-int gpio_get_lines(gpio_chip_t* chip, size_t pin_count, const unsigned int* pins,
-                   struct gpiod_line_bulk* lines) {
-    int error;
+gpio_line_group_t* gpio_line_group_request(gpio_chip_t* chip, size_t line_count,
+                                           const struct gpio_line_config* lines) {
+    gpio_line_group_t* group;
 
-    unsigned int offsets[pin_count];
-    memcpy(offsets, pins, pin_count * sizeof(unsigned int));
+    group = (gpio_line_group_t*)malloc(sizeof(gpio_line_group_t));
+    group->chip = chip;
 
-    error = gpiod_chip_get_lines(chip->chip, offsets, pin_count, lines);
-    if (error) {
-        perror("gpiod_chip_get_lines");
-        return 0;
+    group->data = chip->backend->line_group_request(chip->data, line_count, lines);
+    if (!group->data) {
+        free(group);
+        return NULL;
     }
 
-    return 1;
+    return group;
 }
 
-int gpio_set_pin_request(gpio_chip_t* chip, size_t pin_count, const unsigned int* pins,
-                         const struct gpio_request_config* config) {
-    struct gpiod_line_request_config gpiod_config;
-    struct gpiod_line_bulk lines;
-
-    int default_values[pin_count];
-    int error;
-
-    if (!gpio_get_lines(chip, pin_count, pins, &lines)) {
-        return 0;
-    }
-
-    memset(&gpiod_config, 0, sizeof(struct gpiod_line_request_config));
-    gpiod_config.consumer = chip->consumer;
-    gpiod_config.request_type = (int)config->type;
-    gpiod_config.flags = (int)config->flags;
-
-    memset(default_values, 0, sizeof(int) * pin_count);
-
-    error = gpiod_line_request_bulk(&lines, &gpiod_config, default_values);
-    if (error) {
-        perror("gpiod_line_request_bulk");
-        return 0;
+void gpio_line_group_release(gpio_line_group_t* group) {
+    if (!group) {
+        return;
     }
 
-    return 1;
+    group->chip->backend->line_group_release(group->data);
+    free(group);
 }
 
-int gpio_set_digital(gpio_chip_t* chip, size_t pin_count, const unsigned int* pins,
-                     const int* values) {
-    struct gpiod_line_bulk lines;
-
-    int error;
-
-    if (!gpio_get_lines(chip, pin_count, pins, &lines)) {
-        return 0;
-    }
-
-    error = gpiod_line_set_value_bulk(&lines, values);
-    if (error) {
-        perror("gpiod_line_set_value_bulk");
-        return 0;
-    }
+int gpio_line_group_set(gpio_line_group_t* group, const int* values) {
+    return group->chip->backend->line_group_set(group->data, values);
+}
 
-    return 1;
+int gpio_line_group_get(gpio_line_group_t* group, int* values) {
+    return group->chip->backend->line_group_get(group->data, values);
 }
 
-int gpio_get_digital(gpio_chip_t* chip, size_t pin_count, const unsigned int* pins, int* values) {
-    struct gpiod_line_bulk lines;
+size_t gpio_line_group_get_fds(gpio_line_group_t* group, int* fds, size_t max_fds) {
+    return group->chip->backend->line_group_get_fds(group->data, fds, max_fds);
+}
 
-    int error;
+ssize_t gpio_line_group_read_events(gpio_line_group_t* group, struct gpio_line_event* events,
+                                    size_t max_events) {
+    return group->chip->backend->line_group_read_events(group->data, events, max_events);
+}
 
-    if (!gpio_get_lines(chip, pin_count, pins, &lines)) {
-        return 0;
-    }
+int gpio_request_is_event(gpio_request_type type) {
+    return type == GPIO_REQUEST_EVENT_FALLING_EDGE || type == GPIO_REQUEST_EVENT_RISING_EDGE ||
+           type == GPIO_REQUEST_EVENT_BOTH_EDGES;
+}
 
-    error = gpiod_line_get_value_bulk(&lines, values);
-    if (error) {
-        perror("gpiod_line_get_value_bulk");
-        return 0;
+int gpio_timestamps_ordered(const struct timespec* lhs, const struct timespec* rhs) {
+    if (lhs->tv_sec != rhs->tv_sec) {
+        return lhs->tv_sec < rhs->tv_sec;
     }
 
-    return 1;
+    return lhs->tv_nsec <= rhs->tv_nsec;
 }
@@ -4,6 +4,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <sys/types.h>
+#include <time.h>
+
 typedef struct gpio_chip gpio_chip_t;
 
 typedef enum gpio_request_type {
@@ -27,6 +30,10 @@ typedef enum gpio_request_flag {
 struct gpio_request_config {
     gpio_request_type type;
     uint32_t flags;
+
+    // edges are only reported once the line has been stable this long. 0 disables debouncing.
+    // applied by the kernel with libgpiod 2.x, and ignored with libgpiod 1.x
+    uint32_t debounce_period_us;
 };
 
 // opens a gpio chip with a consistent consumer. copies strings.
@@ -35,18 +42,48 @@ gpio_chip_t* gpio_chip_open(const char* device, const char* consumer);
 // closes gpio chip
 void gpio_chip_close(gpio_chip_t* chip);
 
-// sets the request of a set of pins
-// return 1 on success, 0 on failure
-int gpio_set_pin_request(gpio_chip_t* chip, size_t pin_count, const unsigned int* pins,
-                         const struct gpio_request_config* config);
+typedef struct gpio_line_group gpio_line_group_t;
+
+struct gpio_line_event {
+    // index of the line within its group
+    size_t line;
+
+    // 1 for a rising edge, 0 for a falling edge
+    int rising;
+
+    // kernel timestamp of the edge
+    struct timespec timestamp;
+};
+
+struct gpio_line_config {
+    unsigned int pin;
+    struct gpio_request_config request;
+};
+
+// resolves and requests a group of lines once, so that reads and writes dont have to. lines which
+// share a request config share a kernel request. returns null on failure
+gpio_line_group_t* gpio_line_group_request(gpio_chip_t* chip, size_t line_count,
+                                           const struct gpio_line_config* lines);
 
-// sets digital state of a set of pins
+// releases the lines of a group and frees it
+void gpio_line_group_release(gpio_line_group_t* group);
+
+// sets digital state of every line in the group, in the order they were requested
 // returns 1 on success, 0 on failure
-int gpio_set_digital(gpio_chip_t* chip, size_t pin_count, const unsigned int* pins,
-                     const int* values);
+int gpio_line_group_set(gpio_line_group_t* group, const int* values);
 
-// gets digital state of a set of pins
+// gets digital state of every line in the group, in the order they were requested
 // returns 1 on success, 0 on failure
-int gpio_get_digital(gpio_chip_t* chip, size_t pin_count, const unsigned int* pins, int* values);
+int gpio_line_group_get(gpio_line_group_t* group, int* values);
+
+// retrieves file descriptors which become readable when edge events are pending, for lines
+// requested with an event request type. writes at most max_fds. returns the number of descriptors
+// the group has. libgpiod 1.x has one per line, libgpiod 2.x one per group
+size_t gpio_line_group_get_fds(gpio_line_group_t* group, int* fds, size_t max_fds);
+
+// reads pending edge events without blocking, ordered by timestamp. returns the number of events
+// read, or -1 on failure
+ssize_t gpio_line_group_read_events(gpio_line_group_t* group, struct gpio_line_event* events,
+                                    size_t max_events);
 
 #endif
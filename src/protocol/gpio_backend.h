@@ -0,0 +1,49 @@
+#ifndef GPIO_BACKEND_H
+#define GPIO_BACKEND_H
+
+#include "protocol/gpio.h"
+
+// implementation of a gpio chip, and of the line groups requested from it. objects are opaque to
+// the front end in gpio.c
+struct gpio_backend {
+    // returns null on failure
+    void* (*chip_open)(const char* device, const char* consumer);
+    void (*chip_close)(void* chip);
+
+    // returns null on failure
+    void* (*line_group_request)(void* chip, size_t line_count,
+                                const struct gpio_line_config* lines);
+
+    void (*line_group_release)(void* group);
+
+    int (*line_group_set)(void* group, const int* values);
+    int (*line_group_get)(void* group, int* values);
+
+    size_t (*line_group_get_fds)(void* group, int* fds, size_t max_fds);
+    ssize_t (*line_group_read_events)(void* group, struct gpio_line_event* events,
+                                      size_t max_events);
+};
+
+struct gpio_chip {
+    const struct gpio_backend* backend;
+    void* data;
+};
+
+struct gpio_line_group {
+    gpio_chip_t* chip;
+    void* data;
+};
+
+// whichever libgpiod implementation was built
+extern const struct gpio_backend gpio_backend_gpiod;
+
+// an in-memory chip driven by scripts or by protocol/gpio_sim.h
+extern const struct gpio_backend gpio_backend_sim;
+
+// does a request of this type report edges?
+int gpio_request_is_event(gpio_request_type type);
+
+// returns 1 if lhs is no later than rhs, for merging edges read from separate queues
+int gpio_timestamps_ordered(const struct timespec* lhs, const struct timespec* rhs);
+
+#endif
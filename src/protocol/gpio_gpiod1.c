@@ -0,0 +1,457 @@
+#include "protocol/gpio_backend.h"
+
+#include <stdio.h>
+#include <malloc.h>
+#include <string.h>
+
+#include <poll.h>
+
+#include <gpiod.h>
+
+// the kernel hands out at most this many events per read
+#define GPIO_EVENT_BATCH_SIZE 16
+
+typedef struct gpio_gpiod_chip gpio_gpiod_chip_t;
+typedef struct gpio_gpiod_line_group gpio_gpiod_line_group_t;
+
+struct gpio_gpiod_chip {
+    struct gpiod_chip* chip;
+
+    char* device;
+    char* consumer;
+};
+
+void gpio_gpiod_chip_close(void* data);
+
+void* gpio_gpiod_chip_open(const char* device, const char* consumer) {
+    gpio_gpiod_chip_t* chip;
+
+    int error;
+    int len;
+
+    chip = (gpio_gpiod_chip_t*)malloc(sizeof(gpio_gpiod_chip_t));
+    chip->device = strdup(device);
+    chip->consumer = strdup(consumer);
+
+    chip->chip = gpiod_chip_open(device);
+    if (!chip->chip) {
+        perror("gpiod_chip_open");
+
+        gpio_gpiod_chip_close(chip);
+        return NULL;
+    }
+
+    return chip;
+}
+
+void gpio_gpiod_chip_close(void* data) {
+    gpio_gpiod_chip_t* chip;
+
+    chip = (gpio_gpiod_chip_t*)data;
+
+    if (!chip) {
+        return;
+    }
+
+    if (chip->chip) {
+        gpiod_chip_close(chip->chip);
+    }
+
+    free(chip->device);
+    free(chip->consumer);
+
+    free(chip);
+}
+
+// lines of a group which share a request config
+struct gpio_line_request {
+    struct gpio_request_config config;
+    struct gpiod_line_bulk lines;
+    int requested;
+
+    // index into the group's values for each line
+    size_t indices[GPIOD_LINE_BULK_MAX_LINES];
+};
+
+// edges drained from one line which haven't been handed out yet, oldest first
+struct gpio_line_queue {
+    struct gpio_line_event* events;
+    size_t head;
+    size_t count;
+    size_t capacity;
+};
+
+struct gpio_gpiod_line_group {
+    gpio_gpiod_chip_t* chip;
+    size_t line_count;
+
+    struct gpio_line_request* requests;
+    size_t request_count;
+
+    // indexed like the group's values. every line is drained before any edge is handed out, so
+    // that edges come out in order even when they don't all fit in one read
+    struct gpio_line_queue* queues;
+};
+
+int gpio_request_configs_equal(const struct gpio_request_config* lhs,
+                               const struct gpio_request_config* rhs) {
+    return lhs->type == rhs->type && lhs->flags == rhs->flags;
+}
+
+struct gpio_line_request*
+gpio_gpiod_line_group_find_request(gpio_gpiod_line_group_t* group,
+                                   const struct gpio_request_config* config) {
+    struct gpio_line_request* request;
+    size_t i;
+
+    for (i = 0; i < group->request_count; i++) {
+        request = &group->requests[i];
+
+        if (gpio_request_configs_equal(&request->config, config)) {
+            return request;
+        }
+    }
+
+    request = &group->requests[group->request_count++];
+    memcpy(&request->config, config, sizeof(struct gpio_request_config));
+    gpiod_line_bulk_init(&request->lines);
+    request->requested = 0;
+
+    return request;
+}
+
+int gpio_line_request_submit(gpio_gpiod_chip_t* chip, struct gpio_line_request* request) {
+    struct gpiod_line_request_config gpiod_config;
+    unsigned int line_count;
+    int error;
+
+    line_count = gpiod_line_bulk_num_lines(&request->lines);
+    int default_values[line_count];
+
+    memset(&gpiod_config, 0, sizeof(struct gpiod_line_request_config));
+    gpiod_config.consumer = chip->consumer;
+    gpiod_config.request_type = (int)request->config.type;
+    gpiod_config.flags = (int)request->config.flags;
+
+    memset(default_values, 0, sizeof(int) * line_count);
+
+    error = gpiod_line_request_bulk(&request->lines, &gpiod_config, default_values);
+    if (error) {
+        perror("gpiod_line_request_bulk");
+        return 0;
+    }
+
+    request->requested = 1;
+    return 1;
+}
+
+void gpio_gpiod_line_group_release(void* data);
+
+void* gpio_gpiod_line_group_request(void* data, size_t line_count,
+                                    const struct gpio_line_config* lines) {
+    gpio_gpiod_chip_t* chip;
+    gpio_gpiod_line_group_t* group;
+    struct gpio_line_request* request;
+    struct gpiod_line* line;
+    size_t i;
+
+    chip = (gpio_gpiod_chip_t*)data;
+
+    if (line_count == 0 || line_count > GPIOD_LINE_BULK_MAX_LINES) {
+        fprintf(stderr, "Invalid GPIO line group size: %zu\n", line_count);
+        return NULL;
+    }
+
+    group = (gpio_gpiod_line_group_t*)malloc(sizeof(gpio_gpiod_line_group_t));
+    group->chip = chip;
+    group->line_count = line_count;
+
+    // at most one request per line
+    group->requests =
+        (struct gpio_line_request*)malloc(line_count * sizeof(struct gpio_line_request));
+    group->request_count = 0;
+
+    group->queues = (struct gpio_line_queue*)malloc(line_count * sizeof(struct gpio_line_queue));
+    memset(group->queues, 0, line_count * sizeof(struct gpio_line_queue));
+
+    for (i = 0; i < line_count; i++) {
+        line = gpiod_chip_get_line(chip->chip, lines[i].pin);
+        if (!line) {
+            perror("gpiod_chip_get_line");
+
+            gpio_gpiod_line_group_release(group);
+            return NULL;
+        }
+
+        request = gpio_gpiod_line_group_find_request(group, &lines[i].request);
+        request->indices[gpiod_line_bulk_num_lines(&request->lines)] = i;
+        gpiod_line_bulk_add(&request->lines, line);
+    }
+
+    for (i = 0; i < group->request_count; i++) {
+        if (!gpio_line_request_submit(chip, &group->requests[i])) {
+            gpio_gpiod_line_group_release(group);
+            return NULL;
+        }
+    }
+
+    return group;
+}
+
+void gpio_gpiod_line_group_release(void* data) {
+    gpio_gpiod_line_group_t* group;
+    size_t i;
+
+    group = (gpio_gpiod_line_group_t*)data;
+
+    if (!group) {
+        return;
+    }
+
+    for (i = 0; i < group->request_count; i++) {
+        if (group->requests[i].requested) {
+            gpiod_line_release_bulk(&group->requests[i].lines);
+        }
+    }
+
+    for (i = 0; i < group->line_count; i++) {
+        free(group->queues[i].events);
+    }
+
+    free(group->queues);
+    free(group->requests);
+    free(group);
+}
+
+int gpio_gpiod_line_group_set(void* data, const int* values) {
+    gpio_gpiod_line_group_t* group;
+    struct gpio_line_request* request;
+    unsigned int line_count, j;
+    size_t i;
+
+    int error;
+
+    group = (gpio_gpiod_line_group_t*)data;
+
+    for (i = 0; i < group->request_count; i++) {
+        request = &group->requests[i];
+        line_count = gpiod_line_bulk_num_lines(&request->lines);
+
+        int request_values[line_count];
+        for (j = 0; j < line_count; j++) {
+            request_values[j] = values[request->indices[j]];
+        }
+
+        error = gpiod_line_set_value_bulk(&request->lines, request_values);
+        if (error) {
+            perror("gpiod_line_set_value_bulk");
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int gpio_gpiod_line_group_get(void* data, int* values) {
+    gpio_gpiod_line_group_t* group;
+    struct gpio_line_request* request;
+    unsigned int line_count, j;
+    size_t i;
+
+    int error;
+
+    group = (gpio_gpiod_line_group_t*)data;
+
+    for (i = 0; i < group->request_count; i++) {
+        request = &group->requests[i];
+        line_count = gpiod_line_bulk_num_lines(&request->lines);
+
+        int request_values[line_count];
+
+        error = gpiod_line_get_value_bulk(&request->lines, request_values);
+        if (error) {
+            perror("gpiod_line_get_value_bulk");
+            return 0;
+        }
+
+        for (j = 0; j < line_count; j++) {
+            values[request->indices[j]] = request_values[j];
+        }
+    }
+
+    return 1;
+}
+
+size_t gpio_gpiod_line_group_get_fds(void* data, int* fds, size_t max_fds) {
+    gpio_gpiod_line_group_t* group;
+    struct gpio_line_request* request;
+    struct gpiod_line* line;
+    unsigned int j;
+    size_t i, fd_count;
+
+    group = (gpio_gpiod_line_group_t*)data;
+
+    fd_count = 0;
+    for (i = 0; i < group->request_count; i++) {
+        request = &group->requests[i];
+        if (!gpio_request_is_event(request->config.type)) {
+            continue;
+        }
+
+        // one descriptor per line with libgpiod 1.x
+        for (j = 0; j < gpiod_line_bulk_num_lines(&request->lines); j++) {
+            line = gpiod_line_bulk_get_line(&request->lines, j);
+            if (fd_count < max_fds) {
+                fds[fd_count] = gpiod_line_event_get_fd(line);
+            }
+
+            fd_count++;
+        }
+    }
+
+    return fd_count;
+}
+
+ssize_t gpio_line_read_events(struct gpiod_line* line, size_t index,
+                              struct gpio_line_event* events, size_t max_events) {
+    struct gpiod_line_event batch[GPIO_EVENT_BATCH_SIZE];
+    struct pollfd pfd;
+
+    size_t event_count, batch_size;
+    int i, read_count;
+
+    pfd.fd = gpiod_line_event_get_fd(line);
+    pfd.events = POLLIN;
+
+    event_count = 0;
+    while (event_count < max_events) {
+        // gpiod_line_event_read_multiple blocks if nothing is pending
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN)) {
+            break;
+        }
+
+        batch_size = max_events - event_count;
+        if (batch_size > GPIO_EVENT_BATCH_SIZE) {
+            batch_size = GPIO_EVENT_BATCH_SIZE;
+        }
+
+        read_count = gpiod_line_event_read_multiple(line, batch, (unsigned int)batch_size);
+        if (read_count < 0) {
+            perror("gpiod_line_event_read_multiple");
+            return -1;
+        }
+
+        for (i = 0; i < read_count; i++) {
+            events[event_count].line = index;
+            events[event_count].rising = batch[i].event_type == GPIOD_LINE_EVENT_RISING_EDGE;
+            memcpy(&events[event_count].timestamp, &batch[i].ts, sizeof(struct timespec));
+
+            event_count++;
+        }
+
+        if (read_count < batch_size) {
+            break;
+        }
+    }
+
+    return (ssize_t)event_count;
+}
+
+// reads every pending edge of the line into its queue. returns 0 on failure
+int gpio_line_queue_drain(struct gpio_line_queue* queue, struct gpiod_line* line, size_t index) {
+    ssize_t read_count;
+    size_t space;
+
+    // handed out edges make room first
+    if (queue->head > 0) {
+        memmove(queue->events, queue->events + queue->head,
+                queue->count * sizeof(struct gpio_line_event));
+        queue->head = 0;
+    }
+
+    do {
+        if (queue->count == queue->capacity) {
+            queue->capacity = queue->capacity ? queue->capacity * 2 : GPIO_EVENT_BATCH_SIZE;
+            queue->events = (struct gpio_line_event*)realloc(
+                queue->events, queue->capacity * sizeof(struct gpio_line_event));
+        }
+
+        space = queue->capacity - queue->count;
+        read_count = gpio_line_read_events(line, index, queue->events + queue->count, space);
+        if (read_count < 0) {
+            return 0;
+        }
+
+        queue->count += read_count;
+    } while ((size_t)read_count == space);
+
+    return 1;
+}
+
+ssize_t gpio_gpiod_line_group_read_events(void* data, struct gpio_line_event* events,
+                                          size_t max_events) {
+    gpio_gpiod_line_group_t* group;
+    struct gpio_line_request* request;
+    struct gpio_line_queue* queue;
+    struct gpio_line_queue* oldest;
+    unsigned int j;
+    size_t i, event_count;
+
+    group = (gpio_gpiod_line_group_t*)data;
+
+    for (i = 0; i < group->request_count; i++) {
+        request = &group->requests[i];
+        if (!gpio_request_is_event(request->config.type)) {
+            continue;
+        }
+
+        for (j = 0; j < gpiod_line_bulk_num_lines(&request->lines); j++) {
+            if (!gpio_line_queue_drain(&group->queues[request->indices[j]],
+                                       gpiod_line_bulk_get_line(&request->lines, j),
+                                       request->indices[j])) {
+                return -1;
+            }
+        }
+    }
+
+    // each queue is in order, so merging them interleaves the lines. whatever doesn't fit waits
+    // for the next read, ahead of anything newer
+    for (event_count = 0; event_count < max_events; event_count++) {
+        oldest = NULL;
+        for (i = 0; i < group->line_count; i++) {
+            queue = &group->queues[i];
+            if (queue->count == 0) {
+                continue;
+            }
+
+            if (!oldest || !gpio_timestamps_ordered(&oldest->events[oldest->head].timestamp,
+                                                    &queue->events[queue->head].timestamp)) {
+                oldest = queue;
+            }
+        }
+
+        if (!oldest) {
+            break;
+        }
+
+        memcpy(&events[event_count], &oldest->events[oldest->head],
+               sizeof(struct gpio_line_event));
+
+        oldest->head++;
+        oldest->count--;
+    }
+
+    return (ssize_t)event_count;
+}
+
+const struct gpio_backend gpio_backend_gpiod = {
+    .chip_open = gpio_gpiod_chip_open,
+    .chip_close = gpio_gpiod_chip_close,
+    .line_group_request = gpio_gpiod_line_group_request,
+    .line_group_release = gpio_gpiod_line_group_release,
+    .line_group_set = gpio_gpiod_line_group_set,
+    .line_group_get = gpio_gpiod_line_group_get,
+    .line_group_get_fds = gpio_gpiod_line_group_get_fds,
+    .line_group_read_events = gpio_gpiod_line_group_read_events,
+};
@@ -0,0 +1,432 @@
+#include "protocol/gpio_backend.h"
+
+#include <stdio.h>
+#include <malloc.h>
+#include <string.h>
+
+#include <gpiod.h>
+
+// edge events the kernel queues per request, and the most read at once
+#define GPIO_EVENT_BUFFER_SIZE 64
+
+typedef struct gpio_gpiod_chip gpio_gpiod_chip_t;
+typedef struct gpio_gpiod_line_group gpio_gpiod_line_group_t;
+
+struct gpio_gpiod_chip {
+    struct gpiod_chip* chip;
+
+    char* device;
+    char* consumer;
+};
+
+void gpio_gpiod_chip_close(void* data);
+
+void* gpio_gpiod_chip_open(const char* device, const char* consumer) {
+    gpio_gpiod_chip_t* chip;
+
+    chip = (gpio_gpiod_chip_t*)malloc(sizeof(gpio_gpiod_chip_t));
+    chip->device = strdup(device);
+    chip->consumer = strdup(consumer);
+
+    chip->chip = gpiod_chip_open(device);
+    if (!chip->chip) {
+        perror("gpiod_chip_open");
+
+        gpio_gpiod_chip_close(chip);
+        return NULL;
+    }
+
+    return chip;
+}
+
+void gpio_gpiod_chip_close(void* data) {
+    gpio_gpiod_chip_t* chip;
+
+    chip = (gpio_gpiod_chip_t*)data;
+
+    if (!chip) {
+        return;
+    }
+
+    if (chip->chip) {
+        gpiod_chip_close(chip->chip);
+    }
+
+    free(chip->device);
+    free(chip->consumer);
+
+    free(chip);
+}
+
+// libgpiod 2.x configures each line separately, so one request covers the whole group
+struct gpio_gpiod_line_group {
+    gpio_gpiod_chip_t* chip;
+    size_t line_count;
+
+    // offset on the chip of each line, in the order they were requested
+    unsigned int* offsets;
+
+    // one per line. reused by every get and set, so that sampling allocates nothing
+    enum gpiod_line_value* values;
+
+    struct gpiod_line_request* request;
+    int has_events;
+
+    // reused by every read, so that reading allocates nothing
+    struct gpiod_edge_event_buffer* event_buffer;
+};
+
+int gpio_line_settings_apply(struct gpiod_line_settings* settings,
+                             const struct gpio_request_config* config) {
+    enum gpiod_line_direction direction;
+    enum gpiod_line_edge edge;
+    enum gpiod_line_bias bias;
+    enum gpiod_line_drive drive;
+    int active_low;
+
+    edge = GPIOD_LINE_EDGE_NONE;
+    switch (config->type) {
+    case GPIO_REQUEST_DIRECTION_AS_IS:
+        direction = GPIOD_LINE_DIRECTION_AS_IS;
+        break;
+    case GPIO_REQUEST_DIRECTION_INPUT:
+        direction = GPIOD_LINE_DIRECTION_INPUT;
+        break;
+    case GPIO_REQUEST_DIRECTION_OUTPUT:
+        direction = GPIOD_LINE_DIRECTION_OUTPUT;
+        break;
+    case GPIO_REQUEST_EVENT_FALLING_EDGE:
+        direction = GPIOD_LINE_DIRECTION_INPUT;
+        edge = GPIOD_LINE_EDGE_FALLING;
+        break;
+    case GPIO_REQUEST_EVENT_RISING_EDGE:
+        direction = GPIOD_LINE_DIRECTION_INPUT;
+        edge = GPIOD_LINE_EDGE_RISING;
+        break;
+    case GPIO_REQUEST_EVENT_BOTH_EDGES:
+        direction = GPIOD_LINE_DIRECTION_INPUT;
+        edge = GPIOD_LINE_EDGE_BOTH;
+        break;
+    default:
+        fprintf(stderr, "Invalid GPIO request type: %d\n", (int)config->type);
+        return 0;
+    }
+
+    bias = GPIOD_LINE_BIAS_AS_IS;
+    if (config->flags & GPIO_REQUEST_FLAG_BIAS_DISABLE) {
+        bias = GPIOD_LINE_BIAS_DISABLED;
+    } else if (config->flags & GPIO_REQUEST_FLAG_BIAS_PULL_DOWN) {
+        bias = GPIOD_LINE_BIAS_PULL_DOWN;
+    } else if (config->flags & GPIO_REQUEST_FLAG_BIAS_PULL_UP) {
+        bias = GPIOD_LINE_BIAS_PULL_UP;
+    }
+
+    drive = GPIOD_LINE_DRIVE_PUSH_PULL;
+    if (config->flags & GPIO_REQUEST_FLAG_OPEN_DRAIN) {
+        drive = GPIOD_LINE_DRIVE_OPEN_DRAIN;
+    } else if (config->flags & GPIO_REQUEST_FLAG_OPEN_SOURCE) {
+        drive = GPIOD_LINE_DRIVE_OPEN_SOURCE;
+    }
+
+    if (gpiod_line_settings_set_direction(settings, direction) ||
+        gpiod_line_settings_set_edge_detection(settings, edge) ||
+        gpiod_line_settings_set_bias(settings, bias)) {
+        perror("gpiod_line_settings");
+        return 0;
+    }
+
+    // drive only applies to outputs
+    if (direction == GPIOD_LINE_DIRECTION_OUTPUT &&
+        (gpiod_line_settings_set_drive(settings, drive) ||
+         gpiod_line_settings_set_output_value(settings, GPIOD_LINE_VALUE_INACTIVE))) {
+        perror("gpiod_line_settings");
+        return 0;
+    }
+
+    // edge timestamps are compared against CLOCK_MONOTONIC
+    if (edge != GPIOD_LINE_EDGE_NONE &&
+        gpiod_line_settings_set_event_clock(settings, GPIOD_LINE_CLOCK_MONOTONIC)) {
+        perror("gpiod_line_settings_set_event_clock");
+        return 0;
+    }
+
+    active_low = (config->flags & GPIO_REQUEST_FLAG_ACTIVE_LOW) != 0;
+    gpiod_line_settings_set_active_low(settings, active_low);
+    gpiod_line_settings_set_debounce_period_us(settings, config->debounce_period_us);
+
+    return 1;
+}
+
+struct gpiod_line_config* gpio_gpiod_line_group_build_config(gpio_gpiod_line_group_t* group,
+                                                             const struct gpio_line_config* lines) {
+    struct gpiod_line_config* line_config;
+    struct gpiod_line_settings* settings;
+    size_t i;
+
+    line_config = gpiod_line_config_new();
+    settings = gpiod_line_settings_new();
+
+    if (!line_config || !settings) {
+        perror("gpiod_line_config_new");
+
+        gpiod_line_settings_free(settings);
+        gpiod_line_config_free(line_config);
+        return NULL;
+    }
+
+    for (i = 0; i < group->line_count; i++) {
+        // add_line_settings copies, so the settings object can be reused
+        if (!gpio_line_settings_apply(settings, &lines[i].request) ||
+            gpiod_line_config_add_line_settings(line_config, &group->offsets[i], 1, settings)) {
+            fprintf(stderr, "Failed to configure GPIO line %u\n", group->offsets[i]);
+
+            gpiod_line_settings_free(settings);
+            gpiod_line_config_free(line_config);
+            return NULL;
+        }
+    }
+
+    gpiod_line_settings_free(settings);
+    return line_config;
+}
+
+void gpio_gpiod_line_group_release(void* data);
+
+void* gpio_gpiod_line_group_request(void* data, size_t line_count,
+                                    const struct gpio_line_config* lines) {
+    gpio_gpiod_chip_t* chip;
+    gpio_gpiod_line_group_t* group;
+    struct gpiod_line_config* line_config;
+    struct gpiod_request_config* request_config;
+    size_t i;
+
+    chip = (gpio_gpiod_chip_t*)data;
+
+    if (line_count == 0) {
+        fprintf(stderr, "Invalid GPIO line group size: %zu\n", line_count);
+        return NULL;
+    }
+
+    group = (gpio_gpiod_line_group_t*)malloc(sizeof(gpio_gpiod_line_group_t));
+    group->chip = chip;
+    group->line_count = line_count;
+    group->request = NULL;
+    group->event_buffer = NULL;
+    group->has_events = 0;
+
+    group->offsets = (unsigned int*)malloc(line_count * sizeof(unsigned int));
+    group->values = (enum gpiod_line_value*)malloc(line_count * sizeof(enum gpiod_line_value));
+    for (i = 0; i < line_count; i++) {
+        group->offsets[i] = lines[i].pin;
+
+        if (gpio_request_is_event(lines[i].request.type)) {
+            group->has_events = 1;
+        }
+    }
+
+    line_config = gpio_gpiod_line_group_build_config(group, lines);
+    if (!line_config) {
+        gpio_gpiod_line_group_release(group);
+        return NULL;
+    }
+
+    request_config = gpiod_request_config_new();
+    if (!request_config) {
+        perror("gpiod_request_config_new");
+
+        gpiod_line_config_free(line_config);
+        gpio_gpiod_line_group_release(group);
+        return NULL;
+    }
+
+    gpiod_request_config_set_consumer(request_config, chip->consumer);
+    gpiod_request_config_set_event_buffer_size(request_config, GPIO_EVENT_BUFFER_SIZE);
+
+    group->request = gpiod_chip_request_lines(chip->chip, request_config, line_config);
+
+    gpiod_request_config_free(request_config);
+    gpiod_line_config_free(line_config);
+
+    if (!group->request) {
+        perror("gpiod_chip_request_lines");
+
+        gpio_gpiod_line_group_release(group);
+        return NULL;
+    }
+
+    if (group->has_events) {
+        group->event_buffer = gpiod_edge_event_buffer_new(GPIO_EVENT_BUFFER_SIZE);
+        if (!group->event_buffer) {
+            perror("gpiod_edge_event_buffer_new");
+
+            gpio_gpiod_line_group_release(group);
+            return NULL;
+        }
+    }
+
+    return group;
+}
+
+void gpio_gpiod_line_group_release(void* data) {
+    gpio_gpiod_line_group_t* group;
+
+    group = (gpio_gpiod_line_group_t*)data;
+
+    if (!group) {
+        return;
+    }
+
+    if (group->event_buffer) {
+        gpiod_edge_event_buffer_free(group->event_buffer);
+    }
+
+    if (group->request) {
+        gpiod_line_request_release(group->request);
+    }
+
+    free(group->offsets);
+    free(group->values);
+    free(group);
+}
+
+int gpio_gpiod_line_group_set(void* data, const int* values) {
+    gpio_gpiod_line_group_t* group;
+    size_t i;
+
+    group = (gpio_gpiod_line_group_t*)data;
+
+    for (i = 0; i < group->line_count; i++) {
+        group->values[i] = values[i] ? GPIOD_LINE_VALUE_ACTIVE : GPIOD_LINE_VALUE_INACTIVE;
+    }
+
+    if (gpiod_line_request_set_values_subset(group->request, group->line_count, group->offsets,
+                                             group->values)) {
+        perror("gpiod_line_request_set_values_subset");
+        return 0;
+    }
+
+    return 1;
+}
+
+int gpio_gpiod_line_group_get(void* data, int* values) {
+    gpio_gpiod_line_group_t* group;
+    size_t i;
+
+    group = (gpio_gpiod_line_group_t*)data;
+
+    if (gpiod_line_request_get_values_subset(group->request, group->line_count, group->offsets,
+                                             group->values)) {
+        perror("gpiod_line_request_get_values_subset");
+        return 0;
+    }
+
+    for (i = 0; i < group->line_count; i++) {
+        values[i] = group->values[i] == GPIOD_LINE_VALUE_ACTIVE;
+    }
+
+    return 1;
+}
+
+size_t gpio_gpiod_line_group_get_fds(void* data, int* fds, size_t max_fds) {
+    gpio_gpiod_line_group_t* group;
+
+    group = (gpio_gpiod_line_group_t*)data;
+
+    if (!group->has_events) {
+        return 0;
+    }
+
+    // one descriptor for the whole request
+    if (max_fds > 0) {
+        fds[0] = gpiod_line_request_get_fd(group->request);
+    }
+
+    return 1;
+}
+
+size_t gpio_gpiod_line_group_find_line(gpio_gpiod_line_group_t* group, unsigned int offset) {
+    size_t i;
+
+    for (i = 0; i < group->line_count; i++) {
+        if (group->offsets[i] == offset) {
+            return i;
+        }
+    }
+
+    return group->line_count;
+}
+
+ssize_t gpio_gpiod_line_group_read_events(void* data, struct gpio_line_event* events,
+                                          size_t max_events) {
+    gpio_gpiod_line_group_t* group;
+    struct gpiod_edge_event* edge_event;
+    size_t event_count, batch_size;
+    uint64_t timestamp_ns;
+    unsigned int offset;
+    int i, pending, read_count;
+
+    group = (gpio_gpiod_line_group_t*)data;
+
+    if (!group->has_events) {
+        return 0;
+    }
+
+    event_count = 0;
+    while (event_count < max_events) {
+        // reading blocks if nothing is pending
+        pending = gpiod_line_request_wait_edge_events(group->request, 0);
+        if (pending < 0) {
+            perror("gpiod_line_request_wait_edge_events");
+            return -1;
+        } else if (pending == 0) {
+            break;
+        }
+
+        batch_size = max_events - event_count;
+        if (batch_size > GPIO_EVENT_BUFFER_SIZE) {
+            batch_size = GPIO_EVENT_BUFFER_SIZE;
+        }
+
+        read_count =
+            gpiod_line_request_read_edge_events(group->request, group->event_buffer, batch_size);
+
+        if (read_count < 0) {
+            perror("gpiod_line_request_read_edge_events");
+            return -1;
+        }
+
+        // the kernel queues edges of every line in a request in order, so no sorting is needed
+        for (i = 0; i < read_count; i++) {
+            edge_event = gpiod_edge_event_buffer_get_event(group->event_buffer, i);
+            timestamp_ns = gpiod_edge_event_get_timestamp_ns(edge_event);
+
+            offset = gpiod_edge_event_get_line_offset(edge_event);
+            events[event_count].line = gpio_gpiod_line_group_find_line(group, offset);
+
+            events[event_count].rising =
+                gpiod_edge_event_get_event_type(edge_event) == GPIOD_EDGE_EVENT_RISING_EDGE;
+
+            events[event_count].timestamp.tv_sec = (time_t)(timestamp_ns / 1000000000);
+            events[event_count].timestamp.tv_nsec = (long)(timestamp_ns % 1000000000);
+
+            event_count++;
+        }
+
+        if (read_count < batch_size) {
+            break;
+        }
+    }
+
+    return (ssize_t)event_count;
+}
+
+const struct gpio_backend gpio_backend_gpiod = {
+    .chip_open = gpio_gpiod_chip_open,
+    .chip_close = gpio_gpiod_chip_close,
+    .line_group_request = gpio_gpiod_line_group_request,
+    .line_group_release = gpio_gpiod_line_group_release,
+    .line_group_set = gpio_gpiod_line_group_set,
+    .line_group_get = gpio_gpiod_line_group_get,
+    .line_group_get_fds = gpio_gpiod_line_group_get_fds,
+    .line_group_read_events = gpio_gpiod_line_group_read_events,
+};
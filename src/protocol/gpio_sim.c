@@ -0,0 +1,540 @@
+#include "protocol/gpio_sim.h"
+#include "protocol/gpio_backend.h"
+
+#include "core/list.h"
+#include "core/util.h"
+
+#include <stdio.h>
+#include <malloc.h>
+#include <string.h>
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <sys/eventfd.h>
+
+// edges queued per line group before new ones are dropped, like the kernel does
+#define GPIO_SIM_EVENT_QUEUE_SIZE 1024
+
+typedef struct gpio_sim_chip gpio_sim_chip_t;
+typedef struct gpio_sim_line_group gpio_sim_line_group_t;
+
+struct gpio_sim_line {
+    int level;
+
+    // lines which were never driven follow the bias of their request
+    int driven;
+};
+
+struct gpio_sim_step {
+    uint64_t time_us;
+    unsigned int pin;
+    int value;
+};
+
+struct gpio_sim_chip {
+    // guards lines, groups, and the event queues of every group
+    pthread_mutex_t mutex;
+
+    struct gpio_sim_line lines[GPIO_SIM_LINE_COUNT];
+    list_t* groups;
+
+    struct gpio_sim_step* steps;
+    size_t step_count;
+
+    pthread_t thread;
+    int thread_started;
+    int stop_fd;
+
+    atomic_int script_finished;
+};
+
+struct gpio_sim_line_group {
+    gpio_sim_chip_t* chip;
+    list_node_t* node;
+
+    struct gpio_line_config* lines;
+    size_t line_count;
+
+    // readable while events are queued
+    int event_fd;
+    int has_events;
+
+    struct gpio_line_event events[GPIO_SIM_EVENT_QUEUE_SIZE];
+    size_t event_head, event_count;
+};
+
+void gpio_sim_signal(int fd) {
+    uint64_t value;
+
+    value = 1;
+    if (write(fd, &value, sizeof(uint64_t)) < 0 && errno != EAGAIN) {
+        perror("write");
+    }
+}
+
+void gpio_sim_clear_signal(int fd) {
+    uint64_t value;
+
+    if (read(fd, &value, sizeof(uint64_t)) < 0 && errno != EAGAIN) {
+        perror("read");
+    }
+}
+
+int gpio_sim_edge_matches(gpio_request_type type, int rising) {
+    switch (type) {
+    case GPIO_REQUEST_EVENT_RISING_EDGE:
+        return rising;
+    case GPIO_REQUEST_EVENT_FALLING_EDGE:
+        return !rising;
+    case GPIO_REQUEST_EVENT_BOTH_EDGES:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+int gpio_sim_is_active_low(const struct gpio_line_config* line) {
+    return (line->request.flags & GPIO_REQUEST_FLAG_ACTIVE_LOW) != 0;
+}
+
+void gpio_sim_line_group_queue(gpio_sim_line_group_t* group, size_t line, int rising,
+                               uint64_t timestamp_us) {
+    struct gpio_line_event* event;
+    size_t index;
+
+    if (group->event_count >= GPIO_SIM_EVENT_QUEUE_SIZE) {
+        return;
+    }
+
+    index = (group->event_head + group->event_count) % GPIO_SIM_EVENT_QUEUE_SIZE;
+    event = &group->events[index];
+
+    event->line = line;
+    event->rising = rising;
+    event->timestamp.tv_sec = (time_t)(timestamp_us / 1000000);
+    event->timestamp.tv_nsec = (long)(timestamp_us % 1000000) * 1000;
+
+    // only the first event needs a syscall
+    if (group->event_count++ == 0) {
+        gpio_sim_signal(group->event_fd);
+    }
+}
+
+// chip mutex must be held
+void gpio_sim_chip_drive(gpio_sim_chip_t* chip, unsigned int pin, int value,
+                         uint64_t timestamp_us) {
+    gpio_sim_line_group_t* group;
+    list_node_t* current_node;
+    int logical;
+    size_t i;
+
+    value = value ? 1 : 0;
+    chip->lines[pin].driven = 1;
+
+    if (chip->lines[pin].level == value) {
+        return;
+    }
+
+    chip->lines[pin].level = value;
+
+    current_node = list_begin(chip->groups);
+    while (current_node) {
+        group = (gpio_sim_line_group_t*)list_node_get(current_node);
+
+        for (i = 0; i < group->line_count; i++) {
+            if (group->lines[i].pin != pin) {
+                continue;
+            }
+
+            // edges are reported on the logical value, as the kernel does
+            logical = value ^ gpio_sim_is_active_low(&group->lines[i]);
+            if (gpio_sim_edge_matches(group->lines[i].request.type, logical)) {
+                gpio_sim_line_group_queue(group, i, logical, timestamp_us);
+            }
+        }
+
+        current_node = list_node_next(current_node);
+    }
+}
+
+int gpio_sim_parse_script(gpio_sim_chip_t* chip, const char* path) {
+    FILE* file;
+    char line[256];
+    unsigned long long time_us;
+    unsigned int pin;
+    int value, line_number;
+    size_t capacity;
+
+    file = fopen(path, "r");
+    if (!file) {
+        perror("fopen");
+        return 0;
+    }
+
+    capacity = 0;
+    line_number = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[strspn(line, " \t")] == '#') {
+            continue;
+        }
+
+        if (sscanf(line, "%llu %u %d", &time_us, &pin, &value) != 3 ||
+            pin >= GPIO_SIM_LINE_COUNT ||
+            (chip->step_count > 0 && time_us < chip->steps[chip->step_count - 1].time_us)) {
+            fprintf(stderr, "Invalid GPIO script transition at %s:%d\n", path, line_number);
+
+            fclose(file);
+            return 0;
+        }
+
+        if (chip->step_count == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 64;
+            chip->steps = (struct gpio_sim_step*)realloc(chip->steps,
+                                                         capacity * sizeof(struct gpio_sim_step));
+        }
+
+        chip->steps[chip->step_count].time_us = (uint64_t)time_us;
+        chip->steps[chip->step_count].pin = pin;
+        chip->steps[chip->step_count].value = value;
+        chip->step_count++;
+    }
+
+    fclose(file);
+    return 1;
+}
+
+void* gpio_sim_play_script(void* arg) {
+    gpio_sim_chip_t* chip;
+    struct gpio_sim_step* step;
+    struct pollfd pfd;
+
+    uint64_t start_us, due_us, now_us;
+    size_t i;
+
+    chip = (gpio_sim_chip_t*)arg;
+    start_us = util_get_monotonic_us();
+
+    pfd.fd = chip->stop_fd;
+    pfd.events = POLLIN;
+
+    for (i = 0; i < chip->step_count; i++) {
+        step = &chip->steps[i];
+        due_us = start_us + step->time_us;
+
+        // sleep until the transition is due, unless asked to stop
+        while ((now_us = util_get_monotonic_us()) < due_us) {
+            pfd.revents = 0;
+            poll(&pfd, 1, (int)((due_us - now_us + 999) / 1000));
+
+            if (pfd.revents & POLLIN) {
+                return NULL;
+            }
+        }
+
+        // stamp edges with the scheduled time, so that waveforms are exact
+        pthread_mutex_lock(&chip->mutex);
+        gpio_sim_chip_drive(chip, step->pin, step->value, due_us);
+        pthread_mutex_unlock(&chip->mutex);
+    }
+
+    atomic_store(&chip->script_finished, 1);
+    return NULL;
+}
+
+void gpio_sim_chip_close(void* data);
+
+void* gpio_sim_chip_open(const char* device, const char* consumer) {
+    gpio_sim_chip_t* chip;
+    const char* script;
+
+    chip = (gpio_sim_chip_t*)malloc(sizeof(gpio_sim_chip_t));
+    memset(chip, 0, sizeof(gpio_sim_chip_t));
+
+    pthread_mutex_init(&chip->mutex, NULL);
+    chip->groups = list_alloc();
+    chip->stop_fd = -1;
+    atomic_init(&chip->script_finished, 1);
+
+    // "sim:<path>"
+    script = strchr(device, ':');
+    if (!script) {
+        return chip;
+    }
+
+    if (!gpio_sim_parse_script(chip, script + 1)) {
+        gpio_sim_chip_close(chip);
+        return NULL;
+    }
+
+    chip->stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (chip->stop_fd < 0) {
+        perror("eventfd");
+
+        gpio_sim_chip_close(chip);
+        return NULL;
+    }
+
+    atomic_store(&chip->script_finished, 0);
+    if (pthread_create(&chip->thread, NULL, gpio_sim_play_script, chip)) {
+        perror("pthread_create");
+
+        gpio_sim_chip_close(chip);
+        return NULL;
+    }
+
+    chip->thread_started = 1;
+    return chip;
+}
+
+void gpio_sim_chip_close(void* data) {
+    gpio_sim_chip_t* chip;
+
+    chip = (gpio_sim_chip_t*)data;
+
+    if (chip->thread_started) {
+        gpio_sim_signal(chip->stop_fd);
+        pthread_join(chip->thread, NULL);
+    }
+
+    if (chip->stop_fd >= 0) {
+        close(chip->stop_fd);
+    }
+
+    // groups must be released before their chip
+    list_free(chip->groups);
+    pthread_mutex_destroy(&chip->mutex);
+
+    free(chip->steps);
+    free(chip);
+}
+
+void gpio_sim_line_group_release(void* data);
+
+void* gpio_sim_line_group_request(void* data, size_t line_count,
+                                  const struct gpio_line_config* lines) {
+    gpio_sim_chip_t* chip;
+    gpio_sim_line_group_t* group;
+    struct gpio_sim_line* line;
+    size_t i;
+
+    chip = (gpio_sim_chip_t*)data;
+
+    if (line_count == 0) {
+        fprintf(stderr, "Invalid GPIO line group size: %zu\n", line_count);
+        return NULL;
+    }
+
+    for (i = 0; i < line_count; i++) {
+        if (lines[i].pin >= GPIO_SIM_LINE_COUNT) {
+            fprintf(stderr, "Simulated GPIO chip has no line %u\n", lines[i].pin);
+            return NULL;
+        }
+    }
+
+    group = (gpio_sim_line_group_t*)malloc(sizeof(gpio_sim_line_group_t));
+    group->chip = chip;
+    group->line_count = line_count;
+    group->event_head = group->event_count = 0;
+    group->has_events = 0;
+
+    group->lines = (struct gpio_line_config*)malloc(line_count * sizeof(struct gpio_line_config));
+    memcpy(group->lines, lines, line_count * sizeof(struct gpio_line_config));
+
+    group->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (group->event_fd < 0) {
+        perror("eventfd");
+
+        free(group->lines);
+        free(group);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&chip->mutex);
+
+    for (i = 0; i < line_count; i++) {
+        if (gpio_request_is_event(lines[i].request.type)) {
+            group->has_events = 1;
+        }
+
+        // an undriven line floats to its bias
+        line = &chip->lines[lines[i].pin];
+        if (!line->driven && (lines[i].request.flags & GPIO_REQUEST_FLAG_BIAS_PULL_UP)) {
+            line->level = 1;
+        } else if (!line->driven && (lines[i].request.flags & GPIO_REQUEST_FLAG_BIAS_PULL_DOWN)) {
+            line->level = 0;
+        }
+    }
+
+    group->node = list_insert(chip->groups, list_end(chip->groups), group);
+
+    pthread_mutex_unlock(&chip->mutex);
+    return group;
+}
+
+void gpio_sim_line_group_release(void* data) {
+    gpio_sim_line_group_t* group;
+    gpio_sim_chip_t* chip;
+
+    group = (gpio_sim_line_group_t*)data;
+    chip = group->chip;
+
+    pthread_mutex_lock(&chip->mutex);
+    list_remove(chip->groups, group->node);
+    pthread_mutex_unlock(&chip->mutex);
+
+    close(group->event_fd);
+
+    free(group->lines);
+    free(group);
+}
+
+int gpio_sim_line_group_set(void* data, const int* values) {
+    gpio_sim_line_group_t* group;
+    uint64_t now_us;
+    size_t i;
+
+    group = (gpio_sim_line_group_t*)data;
+
+    for (i = 0; i < group->line_count; i++) {
+        if (group->lines[i].request.type != GPIO_REQUEST_DIRECTION_OUTPUT) {
+            fprintf(stderr, "Cannot set simulated GPIO input line %u\n", group->lines[i].pin);
+            return 0;
+        }
+    }
+
+    now_us = util_get_monotonic_us();
+    pthread_mutex_lock(&group->chip->mutex);
+
+    for (i = 0; i < group->line_count; i++) {
+        gpio_sim_chip_drive(group->chip, group->lines[i].pin,
+                            (values[i] ? 1 : 0) ^ gpio_sim_is_active_low(&group->lines[i]),
+                            now_us);
+    }
+
+    pthread_mutex_unlock(&group->chip->mutex);
+    return 1;
+}
+
+int gpio_sim_line_group_get(void* data, int* values) {
+    gpio_sim_line_group_t* group;
+    size_t i;
+
+    group = (gpio_sim_line_group_t*)data;
+
+    pthread_mutex_lock(&group->chip->mutex);
+
+    for (i = 0; i < group->line_count; i++) {
+        values[i] = group->chip->lines[group->lines[i].pin].level ^
+                    gpio_sim_is_active_low(&group->lines[i]);
+    }
+
+    pthread_mutex_unlock(&group->chip->mutex);
+    return 1;
+}
+
+size_t gpio_sim_line_group_get_fds(void* data, int* fds, size_t max_fds) {
+    gpio_sim_line_group_t* group;
+
+    group = (gpio_sim_line_group_t*)data;
+    if (!group->has_events) {
+        return 0;
+    }
+
+    if (max_fds > 0) {
+        fds[0] = group->event_fd;
+    }
+
+    return 1;
+}
+
+ssize_t gpio_sim_line_group_read_events(void* data, struct gpio_line_event* events,
+                                        size_t max_events) {
+    gpio_sim_line_group_t* group;
+    size_t event_count;
+
+    group = (gpio_sim_line_group_t*)data;
+
+    pthread_mutex_lock(&group->chip->mutex);
+
+    // already in order, as they were queued
+    event_count = 0;
+    while (event_count < max_events && group->event_count > 0) {
+        memcpy(&events[event_count++], &group->events[group->event_head],
+               sizeof(struct gpio_line_event));
+
+        group->event_head = (group->event_head + 1) % GPIO_SIM_EVENT_QUEUE_SIZE;
+        group->event_count--;
+    }
+
+    if (group->event_count == 0) {
+        gpio_sim_clear_signal(group->event_fd);
+    }
+
+    pthread_mutex_unlock(&group->chip->mutex);
+    return (ssize_t)event_count;
+}
+
+const struct gpio_backend gpio_backend_sim = {
+    .chip_open = gpio_sim_chip_open,
+    .chip_close = gpio_sim_chip_close,
+    .line_group_request = gpio_sim_line_group_request,
+    .line_group_release = gpio_sim_line_group_release,
+    .line_group_set = gpio_sim_line_group_set,
+    .line_group_get = gpio_sim_line_group_get,
+    .line_group_get_fds = gpio_sim_line_group_get_fds,
+    .line_group_read_events = gpio_sim_line_group_read_events,
+};
+
+int gpio_chip_is_simulated(gpio_chip_t* chip) { return chip->backend == &gpio_backend_sim; }
+
+int gpio_sim_set_line(gpio_chip_t* chip, unsigned int pin, int value, uint64_t timestamp_us) {
+    gpio_sim_chip_t* sim;
+
+    if (!gpio_chip_is_simulated(chip) || pin >= GPIO_SIM_LINE_COUNT) {
+        return 0;
+    }
+
+    sim = (gpio_sim_chip_t*)chip->data;
+
+    pthread_mutex_lock(&sim->mutex);
+    gpio_sim_chip_drive(sim, pin, value, timestamp_us);
+    pthread_mutex_unlock(&sim->mutex);
+
+    return 1;
+}
+
+int gpio_sim_get_line(gpio_chip_t* chip, unsigned int pin) {
+    gpio_sim_chip_t* sim;
+    int level;
+
+    if (!gpio_chip_is_simulated(chip) || pin >= GPIO_SIM_LINE_COUNT) {
+        return -1;
+    }
+
+    sim = (gpio_sim_chip_t*)chip->data;
+
+    pthread_mutex_lock(&sim->mutex);
+    level = sim->lines[pin].level;
+    pthread_mutex_unlock(&sim->mutex);
+
+    return level;
+}
+
+int gpio_sim_script_finished(gpio_chip_t* chip) {
+    gpio_sim_chip_t* sim;
+
+    if (!gpio_chip_is_simulated(chip)) {
+        return 1;
+    }
+
+    sim = (gpio_sim_chip_t*)chip->data;
+    return atomic_load(&sim->script_finished);
+}
@@ -0,0 +1,30 @@
+#ifndef GPIO_SIM_H
+#define GPIO_SIM_H
+
+#include "protocol/gpio.h"
+
+#include <stdint.h>
+
+// gpio_chip_open opens a simulated chip when the device is "sim". with "sim:<path>", the chip also
+// plays the script at path in real time, starting when the chip is opened. each line of a script
+// is a transition, "<time_us> <pin> <0|1>", with times relative to the start and in order. lines
+// starting with # are comments
+
+// lines per simulated chip
+#define GPIO_SIM_LINE_COUNT 64
+
+// returns 1 if chip is simulated
+int gpio_chip_is_simulated(gpio_chip_t* chip);
+
+// drives a line of a simulated chip at timestamp_us, on CLOCK_MONOTONIC. queues an edge for every
+// line requested for events. timestamps should not go backwards. returns 1 on success, 0 on failure
+int gpio_sim_set_line(gpio_chip_t* chip, unsigned int pin, int value, uint64_t timestamp_us);
+
+// retrieves the physical level of a line of a simulated chip, such as one requested as an output.
+// returns -1 on failure
+int gpio_sim_get_line(gpio_chip_t* chip, unsigned int pin);
+
+// returns 1 once the script of a simulated chip has played to the end, or if it has none
+int gpio_sim_script_finished(gpio_chip_t* chip);
+
+#endif
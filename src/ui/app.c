@@ -6,9 +6,12 @@
 #include "core/config.h"
 
 #include "ui/menu.h"
+#include "ui/input_log.h"
 #include "ui/menus/menus.h"
 #include "ui/backends/backends.h"
 
+#include "devices/debounce.h"
+
 #include <malloc.h>
 #include <string.h>
 
@@ -16,6 +19,32 @@
 
 #define EMBEDDED_BACKEND_NAME "embedded"
 #define CURSES_BACKEND_NAME "curses"
+#define NULL_BACKEND_NAME "null"
+
+// marquee scroll speed, and how many steps to rest at either end of the name
+#define MARQUEE_INTERVAL_MS 350
+#define MARQUEE_HOLD_STEPS 3
+
+// scrolling faster than this many steps per second is accelerated
+#define SCROLL_ACCELERATION_THRESHOLD 8.0f
+
+// extra items moved per step, for each step per second beyond the threshold
+#define SCROLL_ACCELERATION_GAIN 0.25f
+
+// upper bound on items moved per step
+#define SCROLL_ACCELERATION_MAX 8.0f
+
+struct app_timer {
+    int id;
+    int removed;
+    uint32_t flags;
+
+    uint32_t interval_ms;
+    uint64_t next_fire_us;
+
+    app_timer_callback_t callback;
+    void* user_data;
+};
 
 struct app {
     struct robot_util_config* config;
@@ -29,9 +58,74 @@ struct app {
     int status;
 
     int button_pressed;
+
+    // set when the current press has already been handled as a long press
+    int button_long_pressed;
+
+    int idle;
+    uint64_t last_input_us;
+
+    list_t* timers;
+    int next_timer_id;
+
+    // records every input, if enabled
+    input_log_t* input_log;
+
+    // scroll state of the hovered item if its name does not fit on screen
+    size_t marquee_offset;
+    uint32_t marquee_hold;
 };
 
+void app_marquee_reset(app_t* app) {
+    app->marquee_offset = 0;
+    app->marquee_hold = MARQUEE_HOLD_STEPS;
+}
+
+void app_marquee_step(void* user_data, app_t* app) {
+    menu_t* top;
+    const char* name;
+    uint32_t width;
+    size_t name_len, max_name_len;
+
+    top = app_get_top(app);
+    if (!top) {
+        return;
+    }
+
+    name = menu_get_current_item_name(top);
+    if (!name) {
+        return;
+    }
+
+    app_get_screen_size(app, &width, NULL);
+    max_name_len = width - 2;
+
+    name_len = strlen(name);
+    if (name_len <= max_name_len) {
+        return;
+    }
+
+    if (app->marquee_hold > 0) {
+        app->marquee_hold--;
+        return;
+    }
+
+    if (app->marquee_offset + max_name_len < name_len) {
+        app->marquee_offset++;
+
+        // rest on the end of the name before wrapping around
+        if (app->marquee_offset + max_name_len == name_len) {
+            app->marquee_hold = MARQUEE_HOLD_STEPS;
+        }
+    } else {
+        app_marquee_reset(app);
+    }
+
+    app->should_redraw = 1;
+}
+
 void app_backend_create(app_t* app) {
+    const struct input_log_config* input_log;
     const char* backend_name;
     app_backend_t* backend;
 
@@ -43,11 +137,29 @@ void app_backend_create(app_t* app) {
     if (!strcmp(backend_name, EMBEDDED_BACKEND_NAME)) {
         app->backend = app_backend_embedded(app->config);
     } else if (!strcmp(backend_name, CURSES_BACKEND_NAME)) {
-        app->backend = app_backend_curses();
+        app->backend = app_backend_curses(app->config);
+    } else if (!strcmp(backend_name, NULL_BACKEND_NAME)) {
+        app->backend = app_backend_null();
     } else {
         fprintf(stderr, "Invalid backend name: %s\n", backend_name);
         app->backend = NULL;
     }
+
+    // replayed input is fed in on top of the real backend, so that it drives the same screen
+    input_log = &app->config->input_log;
+    if (app->backend && input_log->replay_path) {
+        backend =
+            app_backend_replay(app->backend, input_log->replay_path, input_log->replay_timing);
+        if (!backend) {
+            if (app->backend->backend_destroy) {
+                app->backend->backend_destroy(app->backend->data);
+            }
+
+            free(app->backend);
+        }
+
+        app->backend = backend;
+    }
 }
 
 app_t* app_create(struct robot_util_config* config) {
@@ -59,6 +171,17 @@ app_t* app_create(struct robot_util_config* config) {
 
     app->menus = NULL;
     app->backend = NULL;
+    app->input_log = NULL;
+
+    app->timers = list_alloc();
+    app->next_timer_id = 1;
+
+    app->button_long_pressed = 0;
+
+    app->idle = 0;
+    app->last_input_us = util_get_monotonic_us();
+
+    app_marquee_reset(app);
 
     app_backend_create(app);
     if (!app->backend) {
@@ -68,12 +191,24 @@ app_t* app_create(struct robot_util_config* config) {
         return NULL;
     }
 
+    if (config->input_log.record_path) {
+        app->input_log = input_log_open(config->input_log.record_path, INPUT_LOG_MODE_WRITE);
+        if (!app->input_log) {
+            fprintf(stderr, "Failed to open input log for recording!\n");
+
+            app_destroy(app);
+            return NULL;
+        }
+    }
+
     app->menus = list_alloc();
     app->should_redraw = 1;
 
     app->should_exit = 0;
     app->status = 0;
 
+    app_add_timer(app, MARQUEE_INTERVAL_MS, 0, app_marquee_step, NULL);
+
     menu = menus_main(config, app);
     if (!menu) {
         fprintf(stderr, "Failed to push main menu!\n");
@@ -89,6 +224,7 @@ app_t* app_create(struct robot_util_config* config) {
 void app_destroy(app_t* app) {
     list_node_t* current_node;
     menu_t* menu;
+    struct app_timer* timer;
 
     if (!app) {
         return;
@@ -113,11 +249,22 @@ void app_destroy(app_t* app) {
         free(app->backend);
     }
 
+    if (app->timers) {
+        for (current_node = list_begin(app->timers); current_node != NULL;
+             current_node = list_node_next(current_node)) {
+            timer = (struct app_timer*)list_node_get(current_node);
+            free(timer);
+        }
+
+        list_free(app->timers);
+    }
+
+    input_log_close(app->input_log);
     free(app);
 }
 
 char* app_build_menu_render_data(menu_t* menu, uint32_t width, uint32_t height,
-                                 char cursor_character) {
+                                 char cursor_character, size_t marquee_offset) {
     const char** items;
     size_t item_count, cursor;
     size_t current_item;
@@ -135,6 +282,7 @@ char* app_build_menu_render_data(menu_t* menu, uint32_t width, uint32_t height,
     char line_buffer[width + 1];
 
     item_count = menu_get_menu_items(menu, height, NULL, NULL);
+    cursor = item_count;
 
     items = (const char**)malloc(item_count * sizeof(void*));
     item_count = menu_get_menu_items(menu, height, items, &cursor);
@@ -148,6 +296,14 @@ char* app_build_menu_render_data(menu_t* menu, uint32_t width, uint32_t height,
         line_len = strlen(items[current_item]);
         if (line_len <= max_name_len) {
             strncpy(line_buffer, items[current_item], line_len);
+        } else if (current_item == cursor) {
+            // scroll the hovered item instead of truncating it
+            if (marquee_offset > line_len - max_name_len) {
+                marquee_offset = line_len - max_name_len;
+            }
+
+            strncpy(line_buffer, items[current_item] + marquee_offset, max_name_len);
+            line_len = max_name_len;
         } else {
             char temp_name_buffer[line_len + 1];
             memset(temp_name_buffer, 0, sizeof(temp_name_buffer));
@@ -205,7 +361,8 @@ void app_render_menu(app_t* app, menu_t* top) {
     }
 
     app->backend->backend_get_screen_size(app->backend->data, &width, &height);
-    render_data = app_build_menu_render_data(top, width, height, cursor_character);
+    render_data =
+        app_build_menu_render_data(top, width, height, cursor_character, app->marquee_offset);
 
     app->backend->backend_render(app->backend->data, app, render_data);
     free(render_data);
@@ -222,6 +379,104 @@ menu_t* app_get_top(app_t* app) {
     return (menu_t*)list_node_get(node);
 }
 
+void app_update_timers(app_t* app) {
+    list_node_t* current_node;
+    list_node_t* next_node;
+    struct app_timer* timer;
+    uint64_t now;
+
+    now = util_get_monotonic_us();
+    for (current_node = list_begin(app->timers); current_node != NULL;
+         current_node = list_node_next(current_node)) {
+        timer = (struct app_timer*)list_node_get(current_node);
+        if (timer->removed || now < timer->next_fire_us) {
+            continue;
+        }
+
+        if (app->idle && !(timer->flags & APP_TIMER_FLAG_RUN_WHEN_IDLE)) {
+            continue;
+        }
+
+        timer->next_fire_us = now + (uint64_t)timer->interval_ms * 1000;
+        timer->callback(timer->user_data, app);
+    }
+
+    // timers may be removed from within callbacks, so free them afterward
+    current_node = list_begin(app->timers);
+    while (current_node) {
+        next_node = list_node_next(current_node);
+        timer = (struct app_timer*)list_node_get(current_node);
+
+        if (timer->removed) {
+            list_remove(app->timers, current_node);
+            free(timer);
+        }
+
+        current_node = next_node;
+    }
+}
+
+void app_set_idle(app_t* app, int idle) {
+    list_node_t* current_node;
+    struct app_timer* timer;
+    uint64_t now;
+
+    if (app->idle == idle) {
+        return;
+    }
+
+    app->idle = idle;
+    if (app->backend->backend_set_idle) {
+        app->backend->backend_set_idle(app->backend->data, idle);
+    }
+
+    if (idle) {
+        return;
+    }
+
+    // paused timers resume a full interval from now rather than all firing at once
+    now = util_get_monotonic_us();
+    for (current_node = list_begin(app->timers); current_node != NULL;
+         current_node = list_node_next(current_node)) {
+        timer = (struct app_timer*)list_node_get(current_node);
+
+        if (!(timer->flags & APP_TIMER_FLAG_RUN_WHEN_IDLE)) {
+            timer->next_fire_us = now + (uint64_t)timer->interval_ms * 1000;
+        }
+    }
+
+    app_marquee_reset(app);
+    app->should_redraw = 1;
+}
+
+// returns 1 if the input woke the app, in which case it should be discarded. the screen may be
+// dark, so the user cant see what they would be selecting
+int app_register_input(app_t* app) {
+    app->last_input_us = util_get_monotonic_us();
+
+    if (!app->idle) {
+        return 0;
+    }
+
+    app_set_idle(app, 0);
+    return 1;
+}
+
+void app_update_idle(app_t* app) {
+    uint32_t timeout_ms;
+    uint64_t now;
+
+    timeout_ms = app->config->idle.timeout_ms;
+    if (app->idle || timeout_ms == 0) {
+        return;
+    }
+
+    now = util_get_monotonic_us();
+    if (now - app->last_input_us >= (uint64_t)timeout_ms * 1000) {
+        app_set_idle(app, 1);
+    }
+}
+
 void app_update_menus(app_t* app) {
     menu_t* top;
 
@@ -240,6 +495,9 @@ void app_update_menus(app_t* app) {
         }
     }
 
+    app_update_idle(app);
+    app_update_timers(app);
+
     top = app_get_top(app);
     if (!top) {
         app->should_exit = 1;
@@ -252,10 +510,19 @@ void app_update_menus(app_t* app) {
     }
 }
 
+void app_wait(app_t* app, uint32_t timeout_us) {
+    if (app->backend->backend_wait) {
+        app->backend->backend_wait(app->backend->data, timeout_us);
+    } else {
+        util_sleep_us(timeout_us);
+    }
+}
+
 void app_update(app_t* app) {
-    static const uint32_t tick_interval_us = 5e3;
+    static const uint32_t active_tick_interval_us = 5e3;
 
     menu_t* top;
+    uint32_t tick_interval_us;
 
     struct timespec t0, t1, delta;
     uint32_t delta_us;
@@ -264,13 +531,19 @@ void app_update(app_t* app) {
 
     app_update_menus(app);
 
+    // sample input less often while nobody is around
+    tick_interval_us = active_tick_interval_us;
+    if (app->idle && app->config->idle.tick_interval_ms * 1000 > tick_interval_us) {
+        tick_interval_us = app->config->idle.tick_interval_ms * 1000;
+    }
+
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t1);
     util_time_diff(&t0, &t1, &delta);
 
     if (delta.tv_sec == 0) {
         delta_us = delta.tv_nsec / 1e3;
         if (delta_us < tick_interval_us) {
-            util_sleep_us(tick_interval_us - delta_us);
+            app_wait(app, tick_interval_us - delta_us);
         }
     }
 }
@@ -290,6 +563,7 @@ void app_push_menu(app_t* app, menu_t* menu) {
     list_insert(app->menus, end, menu);
 
     app->should_redraw = 1;
+    app_marquee_reset(app);
 }
 
 void app_pop_menu(app_t* app) {
@@ -305,17 +579,18 @@ void app_pop_menu(app_t* app) {
     list_remove(app->menus, end);
 
     app->should_redraw = 1;
+    app_marquee_reset(app);
 
     menu_free(menu);
 }
 
-void app_move_cursor(app_t* app, int32_t increment) {
+void app_apply_move_cursor(app_t* app, int32_t increment) {
     menu_t* top;
     int32_t i, count;
     int clockwise;
 
     top = app_get_top(app);
-    if (!top) {
+    if (!top || increment == 0) {
         return;
     }
 
@@ -326,10 +601,28 @@ void app_move_cursor(app_t* app, int32_t increment) {
         menu_move_cursor(top, clockwise);
     }
 
-    app->should_redraw |= increment != 0;
+    app->should_redraw = 1;
+    app_marquee_reset(app);
 }
 
-void app_select(app_t* app) {
+void app_apply_scroll(app_t* app, int32_t steps, float velocity) {
+    float speed, multiplier;
+
+    speed = velocity < 0 ? -velocity : velocity;
+
+    multiplier = 1.0f;
+    if (speed > SCROLL_ACCELERATION_THRESHOLD) {
+        multiplier += (speed - SCROLL_ACCELERATION_THRESHOLD) * SCROLL_ACCELERATION_GAIN;
+    }
+
+    if (multiplier > SCROLL_ACCELERATION_MAX) {
+        multiplier = SCROLL_ACCELERATION_MAX;
+    }
+
+    app_apply_move_cursor(app, (int32_t)((float)steps * multiplier));
+}
+
+void app_apply_select(app_t* app) {
     menu_t* top;
 
     top = app_get_top(app);
@@ -340,6 +633,154 @@ void app_select(app_t* app) {
     menu_select(top);
 }
 
+void app_apply_back(app_t* app) {
+    list_node_t* end;
+
+    end = list_end(app->menus);
+    if (!end) {
+        return;
+    }
+
+    // never close the main menu this way
+    if (list_node_previous(end)) {
+        app_pop_menu(app);
+    }
+}
+
+void app_record_input(app_t* app, const struct app_input_event* event) {
+    if (app->input_log && !input_log_write(app->input_log, event)) {
+        // keep running without the log rather than failing every input
+        fprintf(stderr, "Failed to record input! Recording stopped\n");
+
+        input_log_close(app->input_log);
+        app->input_log = NULL;
+    }
+}
+
+void app_handle_input(app_t* app, const struct app_input_event* event) {
+    struct app_input_event wake;
+
+    // an input which wakes the app is discarded, so it is recorded as the wake it turned into. a
+    // replay then wakes where the session did, even if it never went idle itself
+    if (app_register_input(app) || event->type == APP_INPUT_WAKE) {
+        wake = *event;
+        wake.type = APP_INPUT_WAKE;
+        wake.steps = 0;
+        wake.velocity = 0.0f;
+
+        app_record_input(app, &wake);
+        return;
+    }
+
+    app_record_input(app, event);
+
+    switch (event->type) {
+    case APP_INPUT_MOVE_CURSOR:
+        app_apply_move_cursor(app, event->steps);
+        break;
+    case APP_INPUT_SCROLL:
+        app_apply_scroll(app, event->steps, event->velocity);
+        break;
+    case APP_INPUT_SELECT:
+        app_apply_select(app);
+        break;
+    case APP_INPUT_BACK:
+        app_apply_back(app);
+        break;
+    default:
+        fprintf(stderr, "Invalid input event type: %d\n", (int)event->type);
+        break;
+    }
+}
+
+void app_send_input(app_t* app, app_input_type type, int32_t steps, float velocity) {
+    struct app_input_event event;
+
+    event.type = type;
+    event.timestamp_us = util_get_monotonic_us();
+    event.steps = steps;
+    event.velocity = velocity;
+
+    app_handle_input(app, &event);
+}
+
+void app_move_cursor(app_t* app, int32_t increment) {
+    if (increment != 0) {
+        app_send_input(app, APP_INPUT_MOVE_CURSOR, increment, 0.0f);
+    }
+}
+
+void app_scroll(app_t* app, int32_t steps, float velocity) {
+    if (steps != 0) {
+        app_send_input(app, APP_INPUT_SCROLL, steps, velocity);
+    }
+}
+
+void app_select(app_t* app) { app_send_input(app, APP_INPUT_SELECT, 0, 0.0f); }
+void app_back(app_t* app) { app_send_input(app, APP_INPUT_BACK, 0, 0.0f); }
+
+void app_handle_button(app_t* app, const struct debounce_event* event) {
+    switch (event->type) {
+    case DEBOUNCE_EVENT_PRESS:
+        app->button_long_pressed = 0;
+        break;
+    case DEBOUNCE_EVENT_RELEASE:
+        // trigger on release, unless the press already went back
+        if (!app->button_long_pressed) {
+            app_select(app);
+        }
+
+        break;
+    case DEBOUNCE_EVENT_LONG_PRESS:
+        app->button_long_pressed = 1;
+        app_back(app);
+
+        break;
+    }
+}
+
+int app_is_idle(app_t* app) { return app->idle; }
+
 void app_get_screen_size(app_t* app, uint32_t* width, uint32_t* height) {
     app->backend->backend_get_screen_size(app->backend->data, width, height);
 }
+
+int app_add_timer(app_t* app, uint32_t interval_ms, uint32_t flags, app_timer_callback_t callback,
+                  void* user_data) {
+    struct app_timer* timer;
+
+    if (!callback) {
+        return 0;
+    }
+
+    timer = (struct app_timer*)malloc(sizeof(struct app_timer));
+    timer->id = app->next_timer_id++;
+    timer->removed = 0;
+    timer->flags = flags;
+
+    timer->interval_ms = interval_ms;
+    timer->next_fire_us = util_get_monotonic_us() + (uint64_t)interval_ms * 1000;
+
+    timer->callback = callback;
+    timer->user_data = user_data;
+
+    list_insert(app->timers, list_end(app->timers), timer);
+    return timer->id;
+}
+
+void app_remove_timer(app_t* app, int id) {
+    list_node_t* current_node;
+    struct app_timer* timer;
+
+    for (current_node = list_begin(app->timers); current_node != NULL;
+         current_node = list_node_next(current_node)) {
+        timer = (struct app_timer*)list_node_get(current_node);
+
+        if (timer->id == id) {
+            timer->removed = 1;
+            break;
+        }
+    }
+}
+
+void app_invalidate(app_t* app) { app->should_redraw = 1; }
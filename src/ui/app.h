@@ -9,17 +9,56 @@ struct robot_util_config;
 // from ui/menu.h
 typedef struct menu menu_t;
 
+// from devices/debounce.h
+struct debounce_event;
+
 typedef struct app app_t;
 
+typedef void (*app_timer_callback_t)(void* user_data, app_t* app);
+
+typedef enum app_timer_flag {
+    // keep firing while the app is idle. other timers are paused until the next input
+    APP_TIMER_FLAG_RUN_WHEN_IDLE = 1 << 0,
+} app_timer_flag;
+
+typedef enum app_input_type {
+    // move the cursor by steps
+    APP_INPUT_MOVE_CURSOR = 0,
+
+    // move the cursor by steps, accelerated by velocity
+    APP_INPUT_SCROLL,
+
+    APP_INPUT_SELECT,
+    APP_INPUT_BACK,
+
+    // only wakes the app from idle. recorded in place of an input which was discarded to do so
+    APP_INPUT_WAKE,
+} app_input_type;
+
+struct app_input_event {
+    app_input_type type;
+
+    // monotonic time the input was handled
+    uint64_t timestamp_us;
+
+    // for APP_INPUT_MOVE_CURSOR and APP_INPUT_SCROLL. velocity is in signed steps per second
+    int32_t steps;
+    float velocity;
+};
+
 typedef struct app_backend {
     void* data;
 
     // can be null. called on app_destroy
     void (*backend_destroy)(void* data);
 
-    // can be null. update io. self-regulates ticks per second
+    // can be null. update io
     void (*backend_update)(void* data, app_t* app);
 
+    // can be null. block until input is available or timeout_us microseconds pass. the app
+    // sleeps between ticks if this is null
+    void (*backend_wait)(void* data, uint32_t timeout_us);
+
     // can be null. clear screen render data to it. each line is passed as multiple NUL-terminated
     // string laid out in sequence. the end of the data is denoted as an extra NUL character.
     void (*backend_render)(void* data, app_t* app, const char* render_data);
@@ -30,6 +69,9 @@ typedef struct app_backend {
 
     // can be null. return 1 if cursor_character was set
     int (*backend_get_cursor_character)(void* data, char* cursor_character);
+
+    // can be null. called when the app goes idle after a period without input, and when it wakes
+    void (*backend_set_idle)(void* data, int idle);
 } app_backend_t;
 
 // initializes a UI application. assumes ownership of config.
@@ -56,13 +98,45 @@ void app_push_menu(app_t* app, menu_t* menu);
 // pop menu from stack. frees menu. returns 1 on success, 0 on failure
 void app_pop_menu(app_t* app);
 
-// move the current menu's cursor
+// the menu on top of the stack, or null if there are none
+menu_t* app_get_top(app_t* app);
+
+// every input goes through here, so that it can be recorded. the functions below build an event
+// with the current time and pass it on
+void app_handle_input(app_t* app, const struct app_input_event* event);
+
+// move the current menu's cursor. if the app is idle, wakes it instead
 void app_move_cursor(app_t* app, int32_t increment);
 
-// select the hovered menu item
+// move the current menu's cursor by steps from an input device moving at velocity steps per second.
+// fast motion is accelerated, so that long lists take one flick rather than dozens of detents
+void app_scroll(app_t* app, int32_t steps, float velocity);
+
+// select the hovered menu item. if the app is idle, wakes it instead
 void app_select(app_t* app);
 
+// close the current menu, unless it is the main menu. if the app is idle, wakes it instead
+void app_back(app_t* app);
+
+// maps an encoder button event to input. a click selects and a long press goes back, without
+// selecting again on release
+void app_handle_button(app_t* app, const struct debounce_event* event);
+
+// is the app idle?
+int app_is_idle(app_t* app);
+
 // get the logical size of the screen in characters
 void app_get_screen_size(app_t* app, uint32_t* width, uint32_t* height);
 
+// registers a callback which is called from app_update every interval_ms milliseconds. flags is a
+// combination of app_timer_flag values. returns a timer id, or 0 on failure
+int app_add_timer(app_t* app, uint32_t interval_ms, uint32_t flags, app_timer_callback_t callback,
+                  void* user_data);
+
+// removes a timer. safe to call from within a timer callback
+void app_remove_timer(app_t* app, int id);
+
+// request that the screen is redrawn on the next tick
+void app_invalidate(app_t* app);
+
 #endif
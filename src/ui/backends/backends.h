@@ -1,6 +1,8 @@
 #ifndef BACKENDS_H
 #define BACKENDS_H
 
+#include "ui/input_log.h"
+
 #include <stdint.h>
 
 // from ui/app.h
@@ -10,6 +12,15 @@ struct robot_util_config;
 
 app_backend_t* app_backend_embedded(const struct robot_util_config* config);
 
-app_backend_t* app_backend_curses();
+// reads keys. if config->gpio_chip names a simulated chip, keys are turned into edges on it and
+// read back through a rotary encoder instead: j and k turn, enter clicks, and h long presses
+app_backend_t* app_backend_curses(const struct robot_util_config* config);
+
+// draws nowhere and reads no input, for running without a screen or a terminal
+app_backend_t* app_backend_null();
+
+// feeds the input recorded at path into the app on top of inner, which still renders and reads
+// live input. assumes ownership of inner on success. the app exits once the log has played
+app_backend_t* app_backend_replay(app_backend_t* inner, const char* path, input_log_timing timing);
 
 #endif
@@ -2,28 +2,165 @@
 
 #include "ui/app.h"
 
+#include "core/config.h"
+#include "core/util.h"
+
+#include "devices/rotary_encoder.h"
+
+#include "protocol/gpio.h"
+#include "protocol/gpio_sim.h"
+
 #include <locale.h>
+#include <stdio.h>
 
 #include <curses.h>
 
 #include <malloc.h>
 #include <string.h>
 
+// time between the edges a key turns into
+#define CURSES_BACKEND_EDGE_INTERVAL_US 1000
+
 struct curses_backend_data {
-    // todo: data
-    uint32_t placeholder;
+    // null unless the config names a simulated chip. keys then become edges on its lines, and input
+    // goes through the same encoder code as on the device
+    gpio_chip_t* gpio_chip;
+    rotary_encoder_t* encoder;
+
+    struct rotary_encoder_pins pins;
+    struct debounce_settings button;
+
+    // time of the last edge driven, so that edges never go back in time
+    uint64_t last_edge_us;
+
+    // stderr is the terminal curses draws to, so these are reported once curses has ended
+    int read_failed;
+    int script_finished;
 };
 
 void curses_backend_free(void* data) {
+    struct curses_backend_data* backend;
+
+    backend = (struct curses_backend_data*)data;
+
     endwin();
 
-    free(data);
+    if (backend->read_failed) {
+        fprintf(stderr, "Failed to read simulated rotary encoder!\n");
+    }
+
+    if (backend->script_finished) {
+        fprintf(stderr, "Simulated GPIO script finished\n");
+    }
+
+    rotary_encoder_close(backend->encoder);
+    gpio_chip_close(backend->gpio_chip);
+
+    free(backend);
+}
+
+uint64_t curses_backend_next_edge_us(struct curses_backend_data* data) {
+    uint64_t now_us;
+
+    now_us = util_get_monotonic_us();
+    if (data->last_edge_us && now_us < data->last_edge_us + CURSES_BACKEND_EDGE_INTERVAL_US) {
+        now_us = data->last_edge_us + CURSES_BACKEND_EDGE_INTERVAL_US;
+    }
+
+    data->last_edge_us = now_us;
+    return now_us;
+}
+
+// one full quadrature cycle, clockwise for positive direction. starts from wherever the lines are,
+// which a script may have left mid cycle
+void curses_backend_turn(struct curses_backend_data* data, int direction) {
+    // next state clockwise, indexed by (a << 1) | b. clockwise is 00 -> 10 -> 11 -> 01 -> 00
+    static const uint8_t clockwise[4] = { 2, 0, 3, 1 };
+    static const uint8_t counter_clockwise[4] = { 1, 3, 0, 2 };
+
+    uint8_t state;
+    int a, b, i;
+
+    a = gpio_sim_get_line(data->gpio_chip, data->pins.a);
+    b = gpio_sim_get_line(data->gpio_chip, data->pins.b);
+    if (a < 0 || b < 0) {
+        return;
+    }
+
+    state = (uint8_t)((a ? 2 : 0) | (b ? 1 : 0));
+    for (i = 0; i < 4; i++) {
+        state = direction > 0 ? clockwise[state] : counter_clockwise[state];
+
+        // only one line changes per quarter step
+        gpio_sim_set_line(data->gpio_chip, data->pins.a, (state & 2) != 0,
+                          curses_backend_next_edge_us(data));
+        gpio_sim_set_line(data->gpio_chip, data->pins.b, (state & 1) != 0, data->last_edge_us);
+    }
+}
+
+// holds the button for hold_us. the switch pulls the line low when pressed
+void curses_backend_click(struct curses_backend_data* data, uint32_t hold_us) {
+    uint64_t press_us;
+
+    press_us = curses_backend_next_edge_us(data);
+    gpio_sim_set_line(data->gpio_chip, data->pins.sw, 0, press_us);
+
+    data->last_edge_us = press_us + hold_us;
+    gpio_sim_set_line(data->gpio_chip, data->pins.sw, 1, data->last_edge_us);
+}
+
+void curses_backend_read_encoder(struct curses_backend_data* data, app_t* app) {
+    struct rotary_encoder_input input;
+    size_t i;
+
+    if (!rotary_encoder_get(data->encoder, &input)) {
+        data->read_failed = 1;
+        app_request_exit(app, 1);
+        return;
+    }
+
+    if (input.motion != 0) {
+        app_scroll(app, input.motion, input.velocity);
+    }
+
+    for (i = 0; i < input.button_event_count; i++) {
+        app_handle_button(app, &input.button_events[i]);
+    }
+
+    if (!data->script_finished) {
+        data->script_finished = gpio_sim_script_finished(data->gpio_chip);
+    }
 }
 
 void curses_backend_update(void* data, app_t* app) {
+    struct curses_backend_data* backend;
     int c;
 
+    backend = (struct curses_backend_data*)data;
+
     while ((c = getch()) != ERR) {
+        if (backend->encoder) {
+            switch (c) {
+            case 'j':
+                curses_backend_turn(backend, 1);
+                break;
+            case 'k':
+                curses_backend_turn(backend, -1);
+                break;
+            case KEY_ENTER:
+            case '\n':
+                // just past the debounce window
+                curses_backend_click(backend, backend->button.window_us + 1000);
+                break;
+            case 'h':
+            case KEY_BACKSPACE:
+                curses_backend_click(backend, backend->button.long_press_us + 1000);
+                break;
+            }
+
+            continue;
+        }
+
         switch (c) {
         case 'j':
             app_move_cursor(app, 1);
@@ -37,6 +174,10 @@ void curses_backend_update(void* data, app_t* app) {
             break;
         }
     }
+
+    if (backend->encoder) {
+        curses_backend_read_encoder(backend, app);
+    }
 }
 
 void curses_backend_render(void* data, app_t* app, const char* render_data) {
@@ -82,13 +223,46 @@ void curses_backend_get_screen_size(void* data, uint32_t* width, uint32_t* heigh
     }
 }
 
-app_backend_t* app_backend_curses() {
+// opens an encoder on the simulated chip named by the config, if there is one. returns 0 on failure
+int curses_backend_open_encoder(struct curses_backend_data* data,
+                                const struct robot_util_config* config) {
+    if (!config->gpio_chip || strncmp(config->gpio_chip, "sim", 3) != 0) {
+        return 1;
+    }
+
+    data->gpio_chip = gpio_chip_open(config->gpio_chip, "robot-util");
+    if (!data->gpio_chip || !gpio_chip_is_simulated(data->gpio_chip)) {
+        return 0;
+    }
+
+    memcpy(&data->pins, &config->encoder_pins, sizeof(struct rotary_encoder_pins));
+    memcpy(&data->button, &config->encoder_settings.button, sizeof(struct debounce_settings));
+
+    data->encoder =
+        rotary_encoder_open(data->gpio_chip, &config->encoder_pins, &config->encoder_settings);
+
+    return data->encoder != NULL;
+}
+
+app_backend_t* app_backend_curses(const struct robot_util_config* config) {
     struct curses_backend_data* data;
     app_backend_t* backend;
 
     setlocale(LC_ALL, "");
 
     data = (struct curses_backend_data*)malloc(sizeof(struct curses_backend_data));
+    memset(data, 0, sizeof(struct curses_backend_data));
+
+    // before curses takes the terminal, so that errors show
+    if (!curses_backend_open_encoder(data, config)) {
+        fprintf(stderr, "Failed to open simulated rotary encoder on %s\n", config->gpio_chip);
+
+        rotary_encoder_close(data->encoder);
+        gpio_chip_close(data->gpio_chip);
+
+        free(data);
+        return NULL;
+    }
 
     initscr();
     cbreak();
@@ -5,31 +5,50 @@
 #include "core/util.h"
 
 #include "ui/app.h"
+#include "ui/presenter.h"
 
 #include "protocol/gpio.h"
 #include "protocol/i2c.h"
 
 #include "devices/rotary_encoder.h"
+#include "devices/encoder_thread.h"
 #include "devices/hd44780/screen.h"
 
 #include <malloc.h>
 #include <string.h>
 
+#include <stdio.h>
 #include <time.h>
+#include <errno.h>
+
+#include <poll.h>
+
+#include <stdatomic.h>
 
 struct embedded_backend_data {
     gpio_chip_t* gpio_chip;
     i2c_bus_t* i2c_bus;
 
+    // null once handed to the encoder thread
     rotary_encoder_t* encoder;
+    encoder_thread_t* encoder_thread;
 
     i2c_device_t* screen_device;
     hd44780_t* screen;
 
-    int button_pressed;
+    // owns the screen while running
+    presenter_t* presenter;
+
+    // what is currently on screen, as space-padded rows. owned by the presenter thread
+    char* shown_rows;
 
-    struct timespec t0;
-    int timestamp_valid;
+    // applied by the presenter thread
+    atomic_int backlight_requested;
+    int dim_when_idle;
+
+    // readable when the encoder, or the encoder thread, has input queued
+    int encoder_fds[ROTARY_ENCODER_MAX_FDS];
+    size_t encoder_fd_count;
 };
 
 int embedded_backend_dim_screen(hd44780_t* screen) {
@@ -50,6 +69,10 @@ void embedded_backend_destroy(void* data) {
 
     backend = (struct embedded_backend_data*)data;
 
+    // stop uploading before touching the screen from this thread
+    presenter_destroy(backend->presenter);
+    free(backend->shown_rows);
+
     if (backend->screen) {
         embedded_backend_dim_screen(backend->screen);
         hd44780_close(backend->screen);
@@ -57,6 +80,7 @@ void embedded_backend_destroy(void* data) {
 
     i2c_device_close(backend->screen_device);
 
+    encoder_thread_stop(backend->encoder_thread);
     rotary_encoder_close(backend->encoder);
 
     i2c_bus_close(backend->i2c_bus);
@@ -66,86 +90,200 @@ void embedded_backend_destroy(void* data) {
 }
 
 int embedded_backend_sample_encoder(struct embedded_backend_data* data, app_t* app) {
-    int success;
-    int pressed, motion;
+    struct rotary_encoder_input input;
+    size_t i;
 
-    success = rotary_encoder_get(data->encoder, &pressed, &motion);
-    if (!success) {
+    if (!rotary_encoder_get(data->encoder, &input)) {
         return 0;
     }
 
-    if (motion != 0) {
-        app_move_cursor(app, (int32_t)motion);
+    if (input.motion != 0) {
+        app_scroll(app, input.motion, input.velocity);
     }
 
-    // trigger on release
-    if (!pressed && data->button_pressed) {
-        app_select(app);
+    for (i = 0; i < input.button_event_count; i++) {
+        app_handle_button(app, &input.button_events[i]);
     }
 
-    data->button_pressed = pressed;
     return 1;
 }
 
+int embedded_backend_drain_encoder_thread(struct embedded_backend_data* data, app_t* app) {
+    struct encoder_event events[16];
+    size_t event_count, i;
+
+    do {
+        event_count = encoder_thread_read(data->encoder_thread, events, ARRAYSIZE(events));
+
+        for (i = 0; i < event_count; i++) {
+            switch (events[i].type) {
+            case ENCODER_EVENT_MOTION:
+                app_scroll(app, events[i].motion.steps, events[i].motion.velocity);
+                break;
+            case ENCODER_EVENT_BUTTON:
+                app_handle_button(app, &events[i].button);
+                break;
+            }
+        }
+    } while (event_count == ARRAYSIZE(events));
+
+    return !encoder_thread_has_failed(data->encoder_thread);
+}
+
 void embedded_backend_update(void* data, app_t* app) {
-    static const uint32_t tick_interval_us = 5e3; // 5ms
+    struct embedded_backend_data* backend;
+    int success;
+
+    backend = (struct embedded_backend_data*)data;
+    if (backend->encoder_thread) {
+        success = embedded_backend_drain_encoder_thread(backend, app);
+    } else {
+        success = embedded_backend_sample_encoder(backend, app);
+    }
+
+    if (!success) {
+        fprintf(stderr, "Failed to read rotary encoder!\n");
+        app_request_exit(app, 1);
+    }
+
+    if (presenter_has_failed(backend->presenter)) {
+        fprintf(stderr, "Failed to upload frame to screen!\n");
+        app_request_exit(app, 1);
+    }
+}
 
+void embedded_backend_wait(void* data, uint32_t timeout_us) {
     struct embedded_backend_data* backend;
 
-    struct timespec t1, delta;
-    uint32_t delta_us;
+    struct pollfd fds[ROTARY_ENCODER_MAX_FDS];
+    size_t fd_count, i;
+    int timeout_ms;
 
     backend = (struct embedded_backend_data*)data;
-    if (!embedded_backend_sample_encoder(backend, app)) {
-        app_request_exit(app, 1);
+
+    // in poll mode, there is nothing to wait on
+    fd_count = backend->encoder_fd_count;
+    if (fd_count == 0) {
+        util_sleep_us(timeout_us);
+        return;
+    }
+
+    for (i = 0; i < fd_count; i++) {
+        fds[i].fd = backend->encoder_fds[i];
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
     }
 
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t1);
-    if (backend->timestamp_valid) {
-        util_time_diff(&backend->t0, &t1, &delta);
+    // wake as soon as an edge comes in
+    timeout_ms = (int)((timeout_us + 999) / 1000);
+    if (poll(fds, (nfds_t)fd_count, timeout_ms) < 0 && errno != EINTR) {
+        perror("poll");
+    }
+}
+
+// rewrites only the columns of a row which differ from what is on screen
+int embedded_backend_upload_row(struct embedded_backend_data* backend, uint8_t row,
+                                const char* line_data) {
+    uint8_t width, x;
+    size_t line_len;
+
+    char* shown;
+    int first, last;
+
+    hd44780_get_size(backend->screen, &width, NULL);
+    shown = backend->shown_rows + row * width;
+
+    char row_buffer[width + 1];
+    memset(row_buffer, ' ', width * sizeof(char));
+    row_buffer[width] = '\0';
 
-        if (delta.tv_sec == 0) {
-            delta_us = delta.tv_nsec / 1e3;
-            if (delta_us < tick_interval_us) {
-                util_sleep_us(tick_interval_us - delta_us);
+    if (line_data) {
+        line_len = strlen(line_data);
+        memcpy(row_buffer, line_data, (line_len < width ? line_len : width) * sizeof(char));
+    }
+
+    first = last = -1;
+    for (x = 0; x < width; x++) {
+        if (row_buffer[x] != shown[x]) {
+            if (first < 0) {
+                first = x;
             }
+
+            last = x;
         }
     }
 
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &backend->t0);
-    backend->timestamp_valid = 1;
+    if (first < 0) {
+        return 1;
+    }
+
+    // a marquee step touches one row, not the whole screen
+    row_buffer[last + 1] = '\0';
+    if (!hd44780_set_cursor_pos(backend->screen, (uint8_t)first, row)) {
+        return 0;
+    }
+
+    if (!hd44780_write(backend->screen, row_buffer + first)) {
+        return 0;
+    }
+
+    memcpy(shown + first, row_buffer + first, (last - first + 1) * sizeof(char));
+    return 1;
 }
 
-void embedded_backend_render(void* data, app_t* app, const char* render_data) {
+int embedded_backend_apply_backlight(struct embedded_backend_data* backend) {
+    struct hd44780_screen_config screen_config;
+    int backlight_on;
+
+    backlight_on = atomic_load(&backend->backlight_requested);
+    hd44780_get_config(backend->screen, &screen_config);
+
+    if (screen_config.backlight_on == backlight_on) {
+        return 1;
+    }
+
+    screen_config.backlight_on = backlight_on;
+    return hd44780_apply_config(backend->screen, &screen_config);
+}
+
+// called from the presenter thread
+int embedded_backend_upload(void* data, const char* render_data) {
     struct embedded_backend_data* backend;
 
     const char* line_data;
-    size_t line;
+    uint8_t line, height;
 
     backend = (struct embedded_backend_data*)data;
+    if (!embedded_backend_apply_backlight(backend)) {
+        return 0;
+    }
 
-    if (!hd44780_clear(backend->screen)) {
-        app_request_exit(app, 1);
-        return;
+    if (!render_data) {
+        return 1;
     }
 
-    line_data = render_data;
-    line = 0;
+    hd44780_get_size(backend->screen, NULL, &height);
 
-    while (*line_data != '\0') {
-        if (!hd44780_set_cursor_pos(backend->screen, 0, (uint8_t)line)) {
-            app_request_exit(app, 1);
-            return;
+    line_data = render_data;
+    for (line = 0; line < height; line++) {
+        // blank out rows past the end of the frame
+        if (!embedded_backend_upload_row(backend, line, *line_data != '\0' ? line_data : NULL)) {
+            return 0;
         }
 
-        if (!hd44780_write(backend->screen, line_data)) {
-            app_request_exit(app, 1);
-            return;
+        if (*line_data != '\0') {
+            line_data += strlen(line_data) + 1;
         }
-
-        line_data += strlen(line_data) + 1;
-        line++;
     }
+
+    return 1;
+}
+
+void embedded_backend_render(void* data, app_t* app, const char* render_data) {
+    struct embedded_backend_data* backend;
+
+    backend = (struct embedded_backend_data*)data;
+    presenter_publish(backend->presenter, render_data);
 }
 
 void embedded_backend_get_screen_size(void* data, uint32_t* width, uint32_t* height) {
@@ -164,6 +302,18 @@ void embedded_backend_get_screen_size(void* data, uint32_t* width, uint32_t* hei
     }
 }
 
+void embedded_backend_set_idle(void* data, int idle) {
+    struct embedded_backend_data* backend;
+
+    backend = (struct embedded_backend_data*)data;
+    if (!backend->dim_when_idle) {
+        return;
+    }
+
+    atomic_store(&backend->backlight_requested, !idle);
+    presenter_wake(backend->presenter);
+}
+
 int embedded_backend_get_cursor_character(void* data, char* cursor_character) {
     // appears as a left arrow on the HD44780
     *cursor_character = '\177';
@@ -176,20 +326,29 @@ app_backend_t* app_backend_embedded(const struct robot_util_config* config) {
     app_backend_t* backend;
 
     hd44780_io_t* screen_io;
+    uint8_t screen_width, screen_height;
 
     data = (struct embedded_backend_data*)malloc(sizeof(struct embedded_backend_data));
-    data->button_pressed = 0;
-    data->timestamp_valid = 0;
+    data->encoder_fd_count = 0;
 
     data->gpio_chip = NULL;
     data->i2c_bus = NULL;
 
     data->encoder = NULL;
+    data->encoder_thread = NULL;
 
     data->screen_device = NULL;
     data->screen = NULL;
 
-    data->gpio_chip = gpio_chip_open("/dev/gpiochip0", "robot-util");
+    data->presenter = NULL;
+    data->shown_rows = NULL;
+
+    atomic_init(&data->backlight_requested, 1);
+    data->dim_when_idle = config->idle.dim_backlight;
+
+    data->gpio_chip =
+        gpio_chip_open(config->gpio_chip ? config->gpio_chip : "/dev/gpiochip0", "robot-util");
+
     if (!data->gpio_chip) {
         embedded_backend_destroy(data);
         return NULL;
@@ -201,12 +360,34 @@ app_backend_t* app_backend_embedded(const struct robot_util_config* config) {
         return NULL;
     }
 
-    data->encoder = rotary_encoder_open(data->gpio_chip, &config->encoder_pins);
+    data->encoder =
+        rotary_encoder_open(data->gpio_chip, &config->encoder_pins, &config->encoder_settings);
+
     if (!data->encoder) {
         embedded_backend_destroy(data);
         return NULL;
     }
 
+    if (config->input_thread.enabled) {
+        data->encoder_thread = encoder_thread_start(data->encoder, &config->input_thread);
+        if (!data->encoder_thread) {
+            embedded_backend_destroy(data);
+            return NULL;
+        }
+
+        // the thread owns the encoder now. wait on its queue instead
+        data->encoder = NULL;
+        data->encoder_fds[0] = encoder_thread_get_fd(data->encoder_thread);
+        data->encoder_fd_count = 1;
+    } else {
+        data->encoder_fd_count =
+            rotary_encoder_get_fds(data->encoder, data->encoder_fds, ROTARY_ENCODER_MAX_FDS);
+
+        if (data->encoder_fd_count > ROTARY_ENCODER_MAX_FDS) {
+            data->encoder_fd_count = ROTARY_ENCODER_MAX_FDS;
+        }
+    }
+
     data->screen_device = i2c_device_open(data->i2c_bus, config->lcd_address);
     screen_io = hd44780_i2c_open(data->screen_device);
     data->screen = hd44780_open_20x4(screen_io);
@@ -216,14 +397,27 @@ app_backend_t* app_backend_embedded(const struct robot_util_config* config) {
         return NULL;
     }
 
+    // the screen is cleared when opened
+    hd44780_get_size(data->screen, &screen_width, &screen_height);
+    data->shown_rows = (char*)malloc(screen_width * screen_height * sizeof(char));
+    memset(data->shown_rows, ' ', screen_width * screen_height * sizeof(char));
+
+    data->presenter = presenter_create("display", embedded_backend_upload, data);
+    if (!data->presenter) {
+        embedded_backend_destroy(data);
+        return NULL;
+    }
+
     backend = (app_backend_t*)malloc(sizeof(app_backend_t));
     backend->data = data;
 
     backend->backend_destroy = embedded_backend_destroy;
     backend->backend_update = embedded_backend_update;
+    backend->backend_wait = embedded_backend_wait;
     backend->backend_render = embedded_backend_render;
     backend->backend_get_screen_size = embedded_backend_get_screen_size;
     backend->backend_get_cursor_character = embedded_backend_get_cursor_character;
+    backend->backend_set_idle = embedded_backend_set_idle;
 
     return backend;
 }
@@ -0,0 +1,35 @@
+#include "ui/backends/backends.h"
+
+#include "ui/app.h"
+
+#include <malloc.h>
+#include <string.h>
+
+// the largest screen robot-util runs on, so that menus lay out as they would on it
+#define NULL_BACKEND_WIDTH 20
+#define NULL_BACKEND_HEIGHT 4
+
+// the app still builds every frame, so that rendering is part of what gets measured
+void null_backend_render(void* data, app_t* app, const char* render_data) {}
+
+void null_backend_get_screen_size(void* data, uint32_t* width, uint32_t* height) {
+    if (width) {
+        *width = NULL_BACKEND_WIDTH;
+    }
+
+    if (height) {
+        *height = NULL_BACKEND_HEIGHT;
+    }
+}
+
+app_backend_t* app_backend_null() {
+    app_backend_t* backend;
+
+    backend = (app_backend_t*)malloc(sizeof(app_backend_t));
+    memset(backend, 0, sizeof(app_backend_t));
+
+    backend->backend_render = null_backend_render;
+    backend->backend_get_screen_size = null_backend_get_screen_size;
+
+    return backend;
+}
@@ -0,0 +1,241 @@
+#include "ui/backends/backends.h"
+
+#include "ui/app.h"
+#include "ui/input_log.h"
+
+#include "core/stats.h"
+#include "core/util.h"
+
+#include <stdio.h>
+#include <malloc.h>
+#include <string.h>
+
+struct replay_backend_data {
+    app_backend_t* inner;
+
+    input_log_t* log;
+    input_log_timing timing;
+
+    // the next event to feed, with its timestamp relative to the start of the recording
+    struct app_input_event next;
+    int has_next;
+    int finished;
+
+    uint64_t start_us;
+
+    // how late events were fed compared to the recording
+    uint64_t events_replayed;
+    uint64_t total_lag_us;
+    uint64_t max_lag_us;
+
+    int stats_id;
+};
+
+void replay_backend_destroy(void* data) {
+    struct replay_backend_data* backend;
+
+    backend = (struct replay_backend_data*)data;
+
+    stats_unregister(backend->stats_id);
+
+    if (backend->inner->backend_destroy) {
+        backend->inner->backend_destroy(backend->inner->data);
+    }
+
+    free(backend->inner);
+
+    input_log_close(backend->log);
+    free(backend);
+}
+
+// returns 1 on success, 0 on failure
+int replay_backend_advance(struct replay_backend_data* backend) {
+    int status;
+
+    status = input_log_read(backend->log, &backend->next);
+    if (status < 0) {
+        return 0;
+    }
+
+    backend->has_next = status > 0;
+    return 1;
+}
+
+void replay_backend_feed(struct replay_backend_data* backend, app_t* app, uint64_t now_us) {
+    struct app_input_event event;
+    uint64_t lag_us;
+
+    lag_us = now_us > backend->next.timestamp_us ? now_us - backend->next.timestamp_us : 0;
+
+    backend->events_replayed++;
+    backend->total_lag_us += lag_us;
+    if (lag_us > backend->max_lag_us) {
+        backend->max_lag_us = lag_us;
+    }
+
+    // handled as if it just happened
+    memcpy(&event, &backend->next, sizeof(struct app_input_event));
+    event.timestamp_us = util_get_monotonic_us();
+
+    app_handle_input(app, &event);
+}
+
+void replay_backend_update(void* data, app_t* app) {
+    struct replay_backend_data* backend;
+    uint64_t now_us;
+
+    backend = (struct replay_backend_data*)data;
+    if (backend->inner->backend_update) {
+        backend->inner->backend_update(backend->inner->data, app);
+
+        if (app_should_exit(app)) {
+            return;
+        }
+    }
+
+    // exit a tick after the last event, so that its result is rendered
+    if (backend->finished) {
+        fprintf(stderr, "Replayed %llu events in %.3f s\n",
+                (unsigned long long)backend->events_replayed,
+                (double)(util_get_monotonic_us() - backend->start_us) / 1e6);
+
+        app_request_exit(app, 0);
+        return;
+    }
+
+    now_us = util_get_monotonic_us() - backend->start_us;
+    while (backend->has_next) {
+        if (backend->timing == INPUT_LOG_TIMING_ORIGINAL && backend->next.timestamp_us > now_us) {
+            break;
+        }
+
+        replay_backend_feed(backend, app, now_us);
+        if (!replay_backend_advance(backend)) {
+            app_request_exit(app, 1);
+            return;
+        }
+
+        // one event per tick, so that each one goes through the whole pipeline
+        if (backend->timing == INPUT_LOG_TIMING_FAST) {
+            break;
+        }
+    }
+
+    backend->finished = !backend->has_next;
+}
+
+void replay_backend_wait(void* data, uint32_t timeout_us) {
+    struct replay_backend_data* backend;
+    uint64_t now_us, until_next_us;
+
+    backend = (struct replay_backend_data*)data;
+
+    if (backend->has_next) {
+        if (backend->timing == INPUT_LOG_TIMING_FAST) {
+            return;
+        }
+
+        // wake up in time for the next event
+        now_us = util_get_monotonic_us() - backend->start_us;
+        until_next_us =
+            backend->next.timestamp_us > now_us ? backend->next.timestamp_us - now_us : 0;
+
+        if (until_next_us < timeout_us) {
+            timeout_us = (uint32_t)until_next_us;
+        }
+    }
+
+    if (backend->inner->backend_wait) {
+        backend->inner->backend_wait(backend->inner->data, timeout_us);
+    } else {
+        util_sleep_us(timeout_us);
+    }
+}
+
+void replay_backend_render(void* data, app_t* app, const char* render_data) {
+    struct replay_backend_data* backend;
+
+    backend = (struct replay_backend_data*)data;
+    if (backend->inner->backend_render) {
+        backend->inner->backend_render(backend->inner->data, app, render_data);
+    }
+}
+
+void replay_backend_get_screen_size(void* data, uint32_t* width, uint32_t* height) {
+    struct replay_backend_data* backend;
+
+    backend = (struct replay_backend_data*)data;
+    backend->inner->backend_get_screen_size(backend->inner->data, width, height);
+}
+
+int replay_backend_get_cursor_character(void* data, char* cursor_character) {
+    struct replay_backend_data* backend;
+
+    backend = (struct replay_backend_data*)data;
+    if (!backend->inner->backend_get_cursor_character) {
+        return 0;
+    }
+
+    return backend->inner->backend_get_cursor_character(backend->inner->data, cursor_character);
+}
+
+void replay_backend_set_idle(void* data, int idle) {
+    struct replay_backend_data* backend;
+
+    backend = (struct replay_backend_data*)data;
+    if (backend->inner->backend_set_idle) {
+        backend->inner->backend_set_idle(backend->inner->data, idle);
+    }
+}
+
+void replay_backend_dump_stats(void* user_data, FILE* stream) {
+    struct replay_backend_data* backend;
+    uint64_t mean_lag_us;
+
+    backend = (struct replay_backend_data*)user_data;
+
+    mean_lag_us = 0;
+    if (backend->events_replayed > 0) {
+        mean_lag_us = backend->total_lag_us / backend->events_replayed;
+    }
+
+    fprintf(stream, "events replayed: %llu\n", (unsigned long long)backend->events_replayed);
+    fprintf(stream, "mean lag: %llu us\n", (unsigned long long)mean_lag_us);
+    fprintf(stream, "max lag: %llu us\n", (unsigned long long)backend->max_lag_us);
+}
+
+app_backend_t* app_backend_replay(app_backend_t* inner, const char* path, input_log_timing timing) {
+    struct replay_backend_data* data;
+    app_backend_t* backend;
+
+    data = (struct replay_backend_data*)malloc(sizeof(struct replay_backend_data));
+    memset(data, 0, sizeof(struct replay_backend_data));
+
+    data->timing = timing;
+    data->log = input_log_open(path, INPUT_LOG_MODE_READ);
+
+    if (!data->log || !replay_backend_advance(data)) {
+        fprintf(stderr, "Failed to open input log for replay!\n");
+
+        input_log_close(data->log);
+        free(data);
+        return NULL;
+    }
+
+    data->inner = inner;
+    data->start_us = util_get_monotonic_us();
+    data->stats_id = stats_register("replay", replay_backend_dump_stats, data);
+
+    backend = (app_backend_t*)malloc(sizeof(app_backend_t));
+    backend->data = data;
+
+    backend->backend_destroy = replay_backend_destroy;
+    backend->backend_update = replay_backend_update;
+    backend->backend_wait = replay_backend_wait;
+    backend->backend_render = replay_backend_render;
+    backend->backend_get_screen_size = replay_backend_get_screen_size;
+    backend->backend_get_cursor_character = replay_backend_get_cursor_character;
+    backend->backend_set_idle = replay_backend_set_idle;
+
+    return backend;
+}
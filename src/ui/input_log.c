@@ -0,0 +1,209 @@
+#include "ui/input_log.h"
+
+#include "core/util.h"
+
+#include <stdio.h>
+#include <malloc.h>
+#include <string.h>
+
+#define INPUT_LOG_MAGIC "RUIL"
+#define INPUT_LOG_VERSION 1
+
+struct input_log {
+    FILE* file;
+    input_log_mode mode;
+
+    // when recording started, and the time of the last record
+    uint64_t start_us;
+    uint64_t last_us;
+};
+
+int input_log_write_varint(FILE* file, uint64_t value) {
+    uint8_t byte;
+
+    // 7 bits per byte, low bits first. the top bit marks that more bytes follow
+    do {
+        byte = (uint8_t)(value & 0x7F);
+        value >>= 7;
+
+        if (value > 0) {
+            byte |= 0x80;
+        }
+
+        if (fputc(byte, file) == EOF) {
+            return 0;
+        }
+    } while (value > 0);
+
+    return 1;
+}
+
+// returns 1 on success, 0 at the end of the file, -1 if the value is cut off or too long
+int input_log_read_varint(FILE* file, uint64_t* value) {
+    uint32_t shift;
+    int c;
+
+    *value = 0;
+    for (shift = 0; shift < 64; shift += 7) {
+        c = fgetc(file);
+        if (c == EOF) {
+            return shift == 0 ? 0 : -1;
+        }
+
+        *value |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            return 1;
+        }
+    }
+
+    return -1;
+}
+
+int input_log_has_steps(app_input_type type) {
+    return type == APP_INPUT_MOVE_CURSOR || type == APP_INPUT_SCROLL;
+}
+
+input_log_t* input_log_open(const char* path, input_log_mode mode) {
+    input_log_t* log;
+    char magic[sizeof(INPUT_LOG_MAGIC) - 1];
+    int version;
+
+    log = (input_log_t*)malloc(sizeof(input_log_t));
+    log->mode = mode;
+    log->start_us = log->last_us = util_get_monotonic_us();
+
+    log->file = fopen(path, mode == INPUT_LOG_MODE_WRITE ? "wb" : "rb");
+    if (!log->file) {
+        perror("fopen");
+
+        free(log);
+        return NULL;
+    }
+
+    if (mode == INPUT_LOG_MODE_WRITE) {
+        fwrite(INPUT_LOG_MAGIC, sizeof(char), sizeof(magic), log->file);
+        fputc(INPUT_LOG_VERSION, log->file);
+
+        if (fflush(log->file) == EOF) {
+            perror("fflush");
+
+            input_log_close(log);
+            return NULL;
+        }
+
+        return log;
+    }
+
+    // replayed timestamps count from zero
+    log->last_us = 0;
+
+    version = -1;
+    if (fread(magic, sizeof(char), sizeof(magic), log->file) == sizeof(magic) &&
+        !memcmp(magic, INPUT_LOG_MAGIC, sizeof(magic))) {
+        version = fgetc(log->file);
+    }
+
+    if (version != INPUT_LOG_VERSION) {
+        fprintf(stderr, "%s is not a version %d input log\n", path, INPUT_LOG_VERSION);
+
+        input_log_close(log);
+        return NULL;
+    }
+
+    return log;
+}
+
+void input_log_close(input_log_t* log) {
+    if (!log) {
+        return;
+    }
+
+    fclose(log->file);
+    free(log);
+}
+
+int input_log_write(input_log_t* log, const struct app_input_event* event) {
+    uint64_t delta_us;
+    uint32_t steps;
+    uint8_t velocity[sizeof(float)];
+    int success;
+
+    if (log->mode != INPUT_LOG_MODE_WRITE) {
+        return 0;
+    }
+
+    delta_us = event->timestamp_us > log->last_us ? event->timestamp_us - log->last_us : 0;
+    log->last_us += delta_us;
+
+    success = fputc((int)event->type, log->file) != EOF;
+    success = success && input_log_write_varint(log->file, delta_us);
+
+    if (input_log_has_steps(event->type)) {
+        // zigzag, so that small negative steps stay short
+        steps = ((uint32_t)event->steps << 1) ^ (uint32_t)(event->steps >> 31);
+        success = success && input_log_write_varint(log->file, steps);
+    }
+
+    if (event->type == APP_INPUT_SCROLL) {
+        // the hosts we run on are little-endian
+        memcpy(velocity, &event->velocity, sizeof(float));
+        success = success && fwrite(velocity, 1, sizeof(velocity), log->file) == sizeof(velocity);
+    }
+
+    if (!success || fflush(log->file) == EOF) {
+        perror("input_log_write");
+        return 0;
+    }
+
+    return 1;
+}
+
+int input_log_read(input_log_t* log, struct app_input_event* event) {
+    uint64_t delta_us, steps;
+    uint8_t velocity[sizeof(float)];
+    int type, status;
+
+    if (log->mode != INPUT_LOG_MODE_READ) {
+        return -1;
+    }
+
+    type = fgetc(log->file);
+    if (type == EOF) {
+        return 0;
+    } else if (type > APP_INPUT_WAKE) {
+        fprintf(stderr, "Invalid input log record type: %d\n", type);
+        return -1;
+    }
+
+    memset(event, 0, sizeof(struct app_input_event));
+    event->type = (app_input_type)type;
+
+    status = input_log_read_varint(log->file, &delta_us);
+    if (status <= 0) {
+        fprintf(stderr, "Truncated input log record\n");
+        return -1;
+    }
+
+    log->last_us += delta_us;
+    event->timestamp_us = log->last_us;
+
+    if (input_log_has_steps(event->type)) {
+        if (input_log_read_varint(log->file, &steps) <= 0 || steps > UINT32_MAX) {
+            fprintf(stderr, "Truncated input log record\n");
+            return -1;
+        }
+
+        event->steps = (int32_t)((uint32_t)steps >> 1) ^ -(int32_t)(steps & 1);
+    }
+
+    if (event->type == APP_INPUT_SCROLL) {
+        if (fread(velocity, 1, sizeof(velocity), log->file) != sizeof(velocity)) {
+            fprintf(stderr, "Truncated input log record\n");
+            return -1;
+        }
+
+        memcpy(&event->velocity, velocity, sizeof(float));
+    }
+
+    return 1;
+}
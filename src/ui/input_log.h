@@ -0,0 +1,37 @@
+#ifndef INPUT_LOG_H
+#define INPUT_LOG_H
+
+#include "ui/app.h"
+
+typedef enum input_log_mode {
+    INPUT_LOG_MODE_WRITE = 0,
+    INPUT_LOG_MODE_READ,
+} input_log_mode;
+
+typedef enum input_log_timing {
+    // replay events as far apart as they were recorded
+    INPUT_LOG_TIMING_ORIGINAL = 0,
+
+    // replay one event per tick, without waiting
+    INPUT_LOG_TIMING_FAST,
+} input_log_timing;
+
+// a compact binary log of app input events. each record holds the type, the time since the
+// previous record as a varint, and steps and velocity only for the types which use them
+typedef struct input_log input_log_t;
+
+// opens a log for recording, truncating it, or for replaying. returns null on failure
+input_log_t* input_log_open(const char* path, input_log_mode mode);
+
+// closes a log, flushing recorded events
+void input_log_close(input_log_t* log);
+
+// appends an event, and flushes it so that the log survives a crash. returns 1 on success, 0 on
+// failure
+int input_log_write(input_log_t* log, const struct app_input_event* event);
+
+// reads the next event. its timestamp is relative to when recording started. returns 1 on success,
+// 0 at the end of the log, -1 on failure
+int input_log_read(input_log_t* log, struct app_input_event* event);
+
+#endif
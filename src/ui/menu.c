@@ -5,13 +5,13 @@
 #include <malloc.h>
 #include <string.h>
 
-typedef struct menu_item {
+struct menu_item {
     char* text;
     menu_item_callback_t action;
 
     void* user_data;
     menu_item_callback_t  free_callback;
-} menu_item_t;
+};
 
 struct menu {
     list_t* items;
@@ -58,9 +58,26 @@ void menu_set_user_data(menu_t* menu, void* user_data, menu_free_callback_t free
     menu->free_callback = free_callback;
 }
 
-void menu_add(menu_t* menu, const char* text, menu_item_callback_t action, void* user_data,
-              menu_item_callback_t free_callback) {
+void* menu_get_user_data(menu_t* menu) { return menu->user_data; }
+
+list_node_t* menu_find_item(menu_t* menu, menu_item_t* item) {
+    list_node_t* current_node;
+
+    for (current_node = list_begin(menu->items); current_node != NULL;
+         current_node = list_node_next(current_node)) {
+        if (list_node_get(current_node) == item) {
+            return current_node;
+        }
+    }
+
+    return NULL;
+}
+
+menu_item_t* menu_insert(menu_t* menu, menu_item_t* before, const char* text,
+                         menu_item_callback_t action, void* user_data,
+                         menu_item_callback_t free_callback) {
     menu_item_t* item;
+    list_node_t* previous;
     list_node_t* node;
 
     item = (menu_item_t*)malloc(sizeof(menu_item_t));
@@ -70,30 +87,96 @@ void menu_add(menu_t* menu, const char* text, menu_item_callback_t action, void*
     item->user_data = user_data;
     item->free_callback = free_callback;
 
-    node = list_insert(menu->items, list_end(menu->items), item);
+    previous = list_end(menu->items);
+    if (before) {
+        node = menu_find_item(menu, before);
+        if (node) {
+            previous = list_node_previous(node);
+        }
+    }
+
+    node = list_insert(menu->items, previous, item);
     if (!menu->current_item) {
         menu->current_item = node;
     }
+
+    return item;
 }
 
-void menu_clear(menu_t* menu) {
+menu_item_t* menu_add(menu_t* menu, const char* text, menu_item_callback_t action, void* user_data,
+                      menu_item_callback_t free_callback) {
+    return menu_insert(menu, NULL, text, action, user_data, free_callback);
+}
+
+void menu_item_free(menu_t* menu, menu_item_t* item) {
+    if (item->free_callback) {
+        item->free_callback(menu->user_data, item->user_data);
+    }
+
+    free(item->text);
+    free(item);
+}
+
+void menu_remove(menu_t* menu, menu_item_t* item) {
     list_node_t* current_node;
-    menu_item_t* item;
 
-    current_node = list_begin(menu->items);
-    do {
-        item = (menu_item_t*)list_node_get(current_node);
+    current_node = menu_find_item(menu, item);
+    if (!current_node) {
+        return;
+    }
 
-        if (item->free_callback) {
-            item->free_callback(menu->user_data, item->user_data);
+    if (menu->current_item == current_node) {
+        menu->current_item = list_node_next(current_node);
+        if (!menu->current_item) {
+            menu->current_item = list_node_previous(current_node);
         }
+    }
+
+    list_remove(menu->items, current_node);
+    menu_item_free(menu, item);
+}
+
+void menu_move(menu_t* menu, menu_item_t* item, menu_item_t* before) {
+    list_node_t* node;
+    list_node_t* previous;
+    int hovered;
+
+    node = menu_find_item(menu, item);
+    if (!node || item == before) {
+        return;
+    }
+
+    hovered = menu->current_item == node;
+    list_remove(menu->items, node);
+
+    previous = list_end(menu->items);
+    if (before) {
+        node = menu_find_item(menu, before);
+        if (node) {
+            previous = list_node_previous(node);
+        }
+    }
 
-        free(item->text);
-        free(item);
+    node = list_insert(menu->items, previous, item);
+    if (hovered) {
+        menu->current_item = node;
+    }
+}
+
+void menu_item_set_text(menu_item_t* item, const char* text) {
+    free(item->text);
+    item->text = strdup(text);
+}
 
+void menu_clear(menu_t* menu) {
+    list_node_t* current_node;
+
+    while ((current_node = list_begin(menu->items)) != NULL) {
+        menu_item_free(menu, (menu_item_t*)list_node_get(current_node));
         list_remove(menu->items, current_node);
-        current_node = list_begin(menu->items);
-    } while (current_node);
+    }
+
+    menu->current_item = NULL;
 }
 
 const char* menu_get_current_item_name(menu_t* menu) {
@@ -5,6 +5,7 @@
 #include <stdint.h>
 
 typedef struct menu menu_t;
+typedef struct menu_item menu_item_t;
 typedef void (*menu_item_callback_t)(void* user_data, void* item_data);
 typedef void (*menu_free_callback_t)(void* user_data);
 
@@ -12,9 +13,26 @@ menu_t* menu_create();
 void menu_free(menu_t* menu);
 
 void menu_set_user_data(menu_t* menu, void* user_data, menu_free_callback_t free_callback);
+void* menu_get_user_data(menu_t* menu);
 
-void menu_add(menu_t* menu, const char* text, menu_item_callback_t action, void* user_data,
-              menu_item_callback_t free_callback);
+// returns the new item, which is owned by the menu
+menu_item_t* menu_add(menu_t* menu, const char* text, menu_item_callback_t action, void* user_data,
+                      menu_item_callback_t free_callback);
+
+// same as menu_add, but places the item before another one. appends if before is null
+menu_item_t* menu_insert(menu_t* menu, menu_item_t* before, const char* text,
+                         menu_item_callback_t action, void* user_data,
+                         menu_item_callback_t free_callback);
+
+// removes and frees an item. if it was hovered, the cursor moves to the next one
+void menu_remove(menu_t* menu, menu_item_t* item);
+
+// moves an item before another one, or to the end if before is null. the cursor stays on the same
+// item
+void menu_move(menu_t* menu, menu_item_t* item, menu_item_t* before);
+
+// copies text
+void menu_item_set_text(menu_item_t* item, const char* text);
 
 void menu_clear(menu_t* menu);
 
@@ -4,58 +4,476 @@
 #include "ui/menu.h"
 
 #include "protocol/bluetooth.h"
+#include "protocol/bluetooth_cache.h"
+
+#include "core/config.h"
+#include "core/list.h"
+#include "core/stats.h"
+#include "core/util.h"
 
 #include <stdio.h>
 
 #include <malloc.h>
 #include <string.h>
 
+// how often the list is reranked and stale devices are dropped
+#define BLUETOOTH_MENU_RANK_INTERVAL_MS 500
+
 struct bluetooth_menu {
     bluetooth_t* bt;
     app_t* app;
+    menu_t* menu;
+
+    // devices from the last run, listed until bluez confirms or drops them. null if disabled
+    bluetooth_cache_t* cache;
+
+    // devices are listed above this
+    menu_item_t* back_item;
+
+    // shown until the connection is ready. null otherwise
+    menu_item_t* status_item;
+
+    // struct bluetooth_menu_device ptrs in menu order. the ranked devices, then cached records
+    // nothing live took the place of, then busy devices which fell out of the ranking
+    list_t* entries;
+
+    bluetooth_device_t** ranking;
+    size_t max_devices;
+    uint64_t stale_us;
+
+    int subscription;
+    int timer;
+
+    // how long building the menu and ranking took
+    uint64_t build_time_us;
+    uint64_t rankings;
+    uint64_t max_rank_time_us;
+    int stats_id;
+};
 
-    uint32_t device_count;
-    bluetooth_device_t** devices;
+struct bluetooth_menu_device {
+    struct bluetooth_menu* menu;
+
+    // exactly one of these is set. cached rows can't be paired or removed
+    bluetooth_device_t* device;
+    const struct bluetooth_cache_record* record;
+
+    // null if the device lost its name
+    menu_item_t* item;
+
+    // index in entries as of the last layout
+    size_t position;
+
+    // pairing or removing. null if idle
+    bluetooth_operation_t* operation;
+    int removing;
 };
 
-void bluetooth_menu_refresh(void* user_data, void* item_data) {
+// returns 0 if the device has no name
+int bluetooth_menu_format_device(struct bluetooth_menu_device* entry, char* buffer,
+                                 size_t buffer_size) {
+    char* device_name;
+    char status;
+
+    if (entry->record) {
+        status = entry->record->flags & BLUETOOTH_CACHE_RECORD_PAIRED ? '*' : ' ';
+
+        memset(buffer, 0, buffer_size);
+        snprintf(buffer, buffer_size, "%c%s", status, entry->record->name);
+
+        return entry->record->name[0] != '\0';
+    }
+
+    device_name = bluetooth_device_get_name(entry->device);
+    if (!device_name) {
+        return 0;
+    }
+
+    if (entry->operation) {
+        status = entry->removing ? '-' : '+';
+    } else {
+        status = bluetooth_device_is_paired(entry->device) ? '*' : ' ';
+    }
+
+    memset(buffer, 0, buffer_size);
+    snprintf(buffer, buffer_size, "%c%s", status, device_name);
+    free(device_name);
+
+    return 1;
+}
+
+void bluetooth_menu_select_device(void* user_data, void* item_data);
+
+// patches the device's row, adding or removing it as its name comes and goes
+void bluetooth_menu_update_device(struct bluetooth_menu_device* entry) {
     struct bluetooth_menu* data;
 
-    bluetooth_t* bt;
-    app_t* app;
+    uint32_t screen_width;
+    size_t name_buffer_size;
+    char* name_buffer;
 
-    menu_t* menu;
+    data = entry->menu;
+
+    app_get_screen_size(data->app, &screen_width, NULL);
+    name_buffer_size = (screen_width + 1) * sizeof(char);
+    name_buffer = (char*)malloc(name_buffer_size);
+
+    if (bluetooth_menu_format_device(entry, name_buffer, name_buffer_size)) {
+        if (entry->item) {
+            menu_item_set_text(entry->item, name_buffer);
+        } else {
+            entry->item = menu_insert(data->menu, data->back_item, name_buffer,
+                                      bluetooth_menu_select_device, entry, NULL);
+        }
+    } else if (entry->item) {
+        menu_remove(data->menu, entry->item);
+        entry->item = NULL;
+    }
+
+    free(name_buffer);
+    app_invalidate(data->app);
+}
+
+// does not remove the row
+void bluetooth_menu_free_device(struct bluetooth_menu_device* entry) {
+    bluetooth_operation_cancel(entry->operation);
+    free(entry);
+}
+
+// the cursor moves to the next row if this one was hovered
+void bluetooth_menu_remove_device(struct bluetooth_menu_device* entry) {
+    if (entry->item) {
+        menu_remove(entry->menu->menu, entry->item);
+    }
+
+    bluetooth_menu_free_device(entry);
+}
+
+struct bluetooth_menu_device* bluetooth_menu_find_device(struct bluetooth_menu* data,
+                                                         bluetooth_device_t* device,
+                                                         list_node_t** node) {
+    struct bluetooth_menu_device* entry;
+    list_node_t* current_node;
+
+    for (current_node = list_begin(data->entries); current_node != NULL;
+         current_node = list_node_next(current_node)) {
+        entry = (struct bluetooth_menu_device*)list_node_get(current_node);
+
+        if (entry->device == device) {
+            if (node) {
+                *node = current_node;
+            }
+
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+struct bluetooth_menu_device*
+bluetooth_menu_find_record(struct bluetooth_menu* data, const struct bluetooth_cache_record* record,
+                           list_node_t** node) {
+    struct bluetooth_menu_device* entry;
+    list_node_t* current_node;
+
+    for (current_node = list_begin(data->entries); current_node != NULL;
+         current_node = list_node_next(current_node)) {
+        entry = (struct bluetooth_menu_device*)list_node_get(current_node);
+
+        if (entry->record == record) {
+            *node = current_node;
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+// removes the device's or record's entry from the list and returns it, or creates one if it isn't
+// listed. pass one of device and record
+struct bluetooth_menu_device*
+bluetooth_menu_take_device(struct bluetooth_menu* data, bluetooth_device_t* device,
+                           const struct bluetooth_cache_record* record) {
+    struct bluetooth_menu_device* entry;
+    list_node_t* node;
+
+    if (device) {
+        entry = bluetooth_menu_find_device(data, device, &node);
+    } else {
+        entry = bluetooth_menu_find_record(data, record, &node);
+    }
+
+    if (entry) {
+        list_remove(data->entries, node);
+        return entry;
+    }
+
+    entry = (struct bluetooth_menu_device*)malloc(sizeof(struct bluetooth_menu_device));
+    entry->menu = data;
+    entry->device = device;
+    entry->record = record;
+    entry->item = NULL;
+    entry->position = (size_t)-1;
+    entry->operation = NULL;
+    entry->removing = 0;
+
+    return entry;
+}
+
+void bluetooth_menu_status(void* user_data, void* item_data) {
+    // nothing to do
+}
+
+// returns 1 if the connection is ready
+int bluetooth_menu_update_status(struct bluetooth_menu* data) {
+    const char* text;
+
+    switch (bluetooth_get_state(data->bt)) {
+    case BLUETOOTH_STATE_CONNECTING:
+        text = "Connecting...";
+        break;
+    case BLUETOOTH_STATE_FAILED:
+        text = "Unavailable";
+        break;
+    default:
+        text = NULL;
+        break;
+    }
+
+    if (text && data->status_item) {
+        menu_item_set_text(data->status_item, text);
+    } else if (text) {
+        data->status_item =
+            menu_insert(data->menu, data->back_item, text, bluetooth_menu_status, NULL, NULL);
+    } else if (data->status_item) {
+        menu_remove(data->menu, data->status_item);
+        data->status_item = NULL;
+    } else {
+        return 1;
+    }
+
+    app_invalidate(data->app);
+    return !text;
+}
+
+void bluetooth_menu_record_rank(struct bluetooth_menu* data, uint64_t rank_time_us) {
+    data->rankings++;
+    if (rank_time_us > data->max_rank_time_us) {
+        data->max_rank_time_us = rank_time_us;
+    }
+}
+
+// lists cached records after the ranked devices, unless one of those is the same device or bluez
+// has made the record obsolete
+void bluetooth_menu_list_cached(struct bluetooth_menu* data, list_t* entries, size_t count) {
+    struct bluetooth_menu_device* entry;
+    const struct bluetooth_cache_record* records;
+    uint32_t record_count, i;
+    bluetooth_state state;
+
+    uint8_t(*addresses)[6];
+    char* address;
+    size_t index, added;
+
+    if (!data->cache) {
+        return;
+    }
+
+    records = bluetooth_cache_get_records(data->cache, &record_count);
+    if (record_count == 0) {
+        return;
+    }
+
+    state = bluetooth_get_state(data->bt);
+
+    // live rows replace the records of the same devices
+    addresses = (uint8_t(*)[6])malloc((count + 1) * sizeof(*addresses));
+    for (index = 0; index < count; index++) {
+        address = bluetooth_device_get_address(data->ranking[index]);
+        if (!address || !bluetooth_cache_parse_address(address, addresses[index])) {
+            memset(addresses[index], 0, sizeof(*addresses));
+        }
+
+        free(address);
+    }
+
+    added = 0;
+    for (i = 0; i < record_count && count + added < data->max_devices; i++) {
+        if (!bluetooth_cache_record_is_current(data->cache, &records[i], state)) {
+            continue;
+        }
+
+        for (index = 0; index < count; index++) {
+            if (memcmp(addresses[index], records[i].address, sizeof(*addresses)) == 0) {
+                break;
+            }
+        }
+
+        if (index < count) {
+            continue;
+        }
+
+        entry = bluetooth_menu_take_device(data, NULL, &records[i]);
+        list_insert(entries, list_end(entries), entry);
+        added++;
+    }
+
+    free(addresses);
+}
+
+void bluetooth_menu_rank(void* user_data, app_t* app) {
+    struct bluetooth_menu* data;
+    struct bluetooth_menu_device* entry;
+
+    list_t* entries;
+    list_node_t* current_node;
+    size_t count, index;
+    int changed;
+    uint64_t start_us;
 
     data = (struct bluetooth_menu*)user_data;
 
-    // data is about to be freed by app_pop_menu
-    bt = data->bt;
-    app = data->app;
+    // cached rows fill in while connecting
+    start_us = util_get_monotonic_us();
+    if (bluetooth_menu_update_status(data)) {
+        count = bluetooth_rank_devices(data->bt, data->ranking, data->max_devices, data->stale_us);
+    } else if (data->cache) {
+        count = 0;
+    } else {
+        return;
+    }
+
+    entries = list_alloc();
+    for (index = 0; index < count; index++) {
+        entry = bluetooth_menu_take_device(data, data->ranking[index], NULL);
+        list_insert(entries, list_end(entries), entry);
+    }
+
+    bluetooth_menu_list_cached(data, entries, count);
+
+    // whatever is left fell out of the ranking. busy devices stay until they finish
+    changed = 0;
+    while ((current_node = list_begin(data->entries)) != NULL) {
+        entry = (struct bluetooth_menu_device*)list_node_get(current_node);
+        list_remove(data->entries, current_node);
+
+        if (entry->operation) {
+            list_insert(entries, list_end(entries), entry);
+        } else {
+            bluetooth_menu_remove_device(entry);
+            changed = 1;
+        }
+    }
+
+    list_free(data->entries);
+    data->entries = entries;
+
+    index = 0;
+    for (current_node = list_begin(entries); current_node != NULL;
+         current_node = list_node_next(current_node)) {
+        entry = (struct bluetooth_menu_device*)list_node_get(current_node);
 
-    app_pop_menu(app);
+        if (!entry->item) {
+            bluetooth_menu_update_device(entry);
+        }
 
-    menu = menus_bluetooth(bt, app);
-    if (!menu) {
-        fprintf(stderr, "Error while refreshing bluetooth device list\n");
+        changed |= entry->position != index;
+        entry->position = index++;
     }
 
-    app_push_menu(app, menu);
+    // nothing moved, so leave every row alone
+    if (changed) {
+        for (current_node = list_begin(entries); current_node != NULL;
+             current_node = list_node_next(current_node)) {
+            entry = (struct bluetooth_menu_device*)list_node_get(current_node);
+
+            if (entry->item) {
+                menu_move(data->menu, entry->item, data->back_item);
+            }
+        }
+
+        app_invalidate(data->app);
+    }
+
+    bluetooth_menu_record_rank(data, util_get_monotonic_us() - start_us);
+}
+
+void bluetooth_menu_device_event(bluetooth_device_t* device, bluetooth_device_event event,
+                                 void* user_data) {
+    struct bluetooth_menu* data;
+    struct bluetooth_menu_device* entry;
+    list_node_t* node;
+
+    data = (struct bluetooth_menu*)user_data;
+
+    // new devices are ranked right away rather than on the next tick
+    if (event == BLUETOOTH_DEVICES_CHANGED) {
+        bluetooth_menu_rank(data, data->app);
+        return;
+    }
+
+    // unlisted devices wait for the next ranking
+    entry = bluetooth_menu_find_device(data, device, &node);
+    if (!entry) {
+        return;
+    }
+
+    switch (event) {
+    case BLUETOOTH_DEVICE_REMOVED:
+        list_remove(data->entries, node);
+        bluetooth_menu_remove_device(entry);
+
+        app_invalidate(data->app);
+        break;
+    case BLUETOOTH_DEVICE_CHANGED:
+        bluetooth_menu_update_device(entry);
+        break;
+    default:
+        break;
+    }
+}
+
+void bluetooth_menu_operation_finished(bluetooth_operation_t* operation, int success,
+                                       void* user_data) {
+    struct bluetooth_menu_device* entry;
+
+    entry = (struct bluetooth_menu_device*)user_data;
+    entry->operation = NULL;
+
+    // a removed device disappears through its own event
+    bluetooth_menu_update_device(entry);
 }
 
 void bluetooth_menu_select_device(void* user_data, void* item_data) {
-    bluetooth_device_t* device;
-    int paired;
+    struct bluetooth_menu_device* entry;
+
+    entry = (struct bluetooth_menu_device*)item_data;
+
+    // there is nothing to pair with until bluez knows the device
+    if (!entry->device) {
+        return;
+    }
 
-    device = (bluetooth_device_t*)item_data;
-    paired = bluetooth_device_is_paired(device);
+    // selecting a busy device cancels whatever it was doing
+    if (entry->operation) {
+        bluetooth_operation_cancel(entry->operation);
+        entry->operation = NULL;
 
-    if (!paired) {
-        bluetooth_device_pair(device);
+        bluetooth_menu_update_device(entry);
+        return;
+    }
+
+    entry->removing = bluetooth_device_is_paired(entry->device);
+    if (entry->removing) {
+        entry->operation = bluetooth_device_remove_async(
+            entry->device, bluetooth_menu_operation_finished, entry);
     } else {
-        bluetooth_device_remove(device);
+        entry->operation = bluetooth_device_pair_async(entry->device,
+                                                       bluetooth_menu_operation_finished, entry);
     }
 
-    bluetooth_menu_refresh(user_data, NULL);
+    bluetooth_menu_update_device(entry);
 }
 
 void bluetooth_menu_back(void* user_data, void* item_data) {
@@ -65,58 +483,82 @@ void bluetooth_menu_back(void* user_data, void* item_data) {
     app_pop_menu(data->app);
 }
 
+void bluetooth_menu_dump_stats(void* user_data, FILE* stream) {
+    struct bluetooth_menu* data;
+
+    data = (struct bluetooth_menu*)user_data;
+
+    fprintf(stream, "build time: %llu us\n", (unsigned long long)data->build_time_us);
+    fprintf(stream, "rankings: %llu\n", (unsigned long long)data->rankings);
+    fprintf(stream, "max rank time: %llu us\n", (unsigned long long)data->max_rank_time_us);
+}
+
 void bluetooth_menu_free(void* user_data) {
     struct bluetooth_menu* data;
+    list_node_t* current_node;
 
     data = (struct bluetooth_menu*)user_data;
 
+    stats_unregister(data->stats_id);
+    bluetooth_unsubscribe(data->bt, data->subscription);
+    app_remove_timer(data->app, data->timer);
+    bluetooth_stop_discovery(data->bt);
+
+    // rows are already gone by the time the menu frees its user data
+    for (current_node = list_begin(data->entries); current_node != NULL;
+         current_node = list_node_next(current_node)) {
+        bluetooth_menu_free_device((struct bluetooth_menu_device*)list_node_get(current_node));
+    }
+
+    list_free(data->entries);
+    free(data->ranking);
     free(data);
 }
 
-menu_t* menus_bluetooth(bluetooth_t* bt, app_t* app) {
+menu_t* menus_bluetooth(const struct robot_util_config* config, bluetooth_t* bt,
+                        bluetooth_cache_t* cache, app_t* app) {
     struct bluetooth_menu* data;
     menu_t* menu;
+    uint64_t start_us;
 
-    uint32_t index;
-    bluetooth_device_t* device;
-    char* device_name;
-    int device_paired;
-
-    uint32_t screen_width;
-    size_t name_buffer_size;
-    char* name_buffer;
+    start_us = util_get_monotonic_us();
 
     data = (struct bluetooth_menu*)malloc(sizeof(struct bluetooth_menu));
     data->bt = bt;
     data->app = app;
-    data->devices = bluetooth_iterate_devices(bt, &data->device_count);
+    data->cache = cache;
 
-    menu = menu_create();
-    menu_set_user_data(menu, data, bluetooth_menu_free);
+    data->rankings = 0;
+    data->max_rank_time_us = 0;
 
-    menu_add(menu, "Refresh", bluetooth_menu_refresh, NULL, NULL);
+    data->entries = list_alloc();
+    data->max_devices = config->bluetooth.max_devices;
+    data->stale_us = (uint64_t)config->bluetooth.stale_timeout_ms * 1000;
+    data->ranking =
+        (bluetooth_device_t**)malloc((data->max_devices + 1) * sizeof(bluetooth_device_t*));
 
-    app_get_screen_size(app, &screen_width, NULL);
-    name_buffer_size = (screen_width + 1) * sizeof(char);
-    name_buffer = (char*)malloc(name_buffer_size);
+    menu = menu_create();
+    menu_set_user_data(menu, data, bluetooth_menu_free);
 
-    for (index = 0; index < data->device_count; index++) {
-        device = data->devices[index];
-        device_name = bluetooth_device_get_name(device);
-        device_paired = bluetooth_device_is_paired(device);
+    data->menu = menu;
+    data->back_item = NULL;
+    data->status_item = NULL;
 
-        if (device_name) {
-            memset(name_buffer, 0, name_buffer_size);
-            snprintf(name_buffer, screen_width + 1, "%c%s", device_paired ? '*' : ' ', device_name);
-            free(device_name);
+    // the radio only scans while someone is looking at the results
+    bluetooth_start_discovery(bt, &config->bluetooth.discovery);
+    bluetooth_menu_rank(data, app);
 
-            menu_add(menu, name_buffer, bluetooth_menu_select_device, device, NULL);
-        }
-    }
+    // added last, so that the cursor starts on the first device
+    data->back_item = menu_add(menu, "Back", bluetooth_menu_back, NULL, NULL);
 
-    free(name_buffer);
+    // listed rows are patched as devices change or go from here on
+    data->subscription = bluetooth_subscribe(bt, bluetooth_menu_device_event, data);
+    data->timer =
+        app_add_timer(app, BLUETOOTH_MENU_RANK_INTERVAL_MS, 0, bluetooth_menu_rank, data);
 
-    menu_add(menu, "Back", bluetooth_menu_back, NULL, NULL);
+    // stats are dumped on the ui thread, which is the only one touching these counters
+    data->build_time_us = util_get_monotonic_us() - start_us;
+    data->stats_id = stats_register("bluetooth menu", bluetooth_menu_dump_stats, data);
 
     return menu;
 }
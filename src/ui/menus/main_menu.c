@@ -6,6 +6,8 @@
 #include "core/config.h"
 
 #include "protocol/bluetooth.h"
+#include "protocol/bluetooth_cache.h"
+#include "protocol/bluetooth_reconnect.h"
 
 #include <malloc.h>
 #include <string.h>
@@ -15,11 +17,26 @@
 
 #include <curl/curl.h>
 
+// how often finished bluetooth operations are picked up
+#define BLUETOOTH_DISPATCH_INTERVAL_MS 50
+
 struct main_menu {
     const struct robot_util_config* config;
     app_t* app;
 
     bluetooth_t* bluetooth_client;
+    int bluetooth_timer;
+
+    // null if disabled
+    bluetooth_cache_t* bluetooth_cache;
+
+    // null once every controller is connected or given up on
+    bluetooth_reconnect_t* reconnect;
+    struct bluetooth_reconnect_progress reconnect_progress;
+
+    // shows reconnect progress. null while there is nothing to show
+    menu_t* menu;
+    menu_item_t* reconnect_item;
 };
 
 void main_menu_update_robot(void* user_data, void* item_data) {
@@ -80,7 +97,7 @@ void main_menu_open_bluetooth(void* user_data, void* item_data) {
     menu_t* menu;
 
     data = (struct main_menu*)user_data;
-    menu = menus_bluetooth(data->bluetooth_client, data->app);
+    menu = menus_bluetooth(data->config, data->bluetooth_client, data->bluetooth_cache, data->app);
     if (!menu) {
         fprintf(stderr, "Failed to open bluetooth menu!");
         return;
@@ -89,6 +106,10 @@ void main_menu_open_bluetooth(void* user_data, void* item_data) {
     app_push_menu(data->app, menu);
 }
 
+void menus_main_open_bluetooth(menu_t* menu) {
+    main_menu_open_bluetooth(menu_get_user_data(menu), NULL);
+}
+
 void main_menu_exit(void* user_data, void* item_data) {
     struct main_menu* data;
 
@@ -96,11 +117,77 @@ void main_menu_exit(void* user_data, void* item_data) {
     app_pop_menu(data->app);
 }
 
+void main_menu_reconnect_status(void* user_data, void* item_data) {
+    // nothing to do
+}
+
+void main_menu_update_reconnect(struct main_menu* data) {
+    struct bluetooth_reconnect_progress progress;
+    char text[32];
+    int active;
+
+    active = bluetooth_reconnect_update(data->reconnect);
+    bluetooth_reconnect_get_progress(data->reconnect, &progress);
+
+    if (!active) {
+        bluetooth_reconnect_destroy(data->reconnect);
+        data->reconnect = NULL;
+    }
+
+    // failures stay on screen. otherwise the row goes once there is nothing left to do
+    if (!active && progress.failed == 0) {
+        if (data->reconnect_item) {
+            menu_remove(data->menu, data->reconnect_item);
+            data->reconnect_item = NULL;
+
+            app_invalidate(data->app);
+        }
+
+        return;
+    }
+
+    if (active && memcmp(&progress, &data->reconnect_progress, sizeof(progress)) == 0) {
+        return;
+    }
+
+    memcpy(&data->reconnect_progress, &progress, sizeof(progress));
+
+    if (active) {
+        snprintf(text, sizeof(text), "Reconnecting %u/%u", progress.connected, progress.total);
+    } else {
+        snprintf(text, sizeof(text), "%u/%u reconnected", progress.connected, progress.total);
+    }
+
+    menu_item_set_text(data->reconnect_item, text);
+    app_invalidate(data->app);
+}
+
+void main_menu_dispatch_bluetooth(void* user_data, app_t* app) {
+    struct main_menu* data;
+
+    data = (struct main_menu*)user_data;
+    bluetooth_dispatch(data->bluetooth_client);
+
+    if (data->reconnect) {
+        main_menu_update_reconnect(data);
+    }
+
+    if (data->bluetooth_cache) {
+        bluetooth_cache_update(data->bluetooth_cache);
+    }
+}
+
 void free_main_menu(void* user_data) {
     struct main_menu* data;
 
     data = (struct main_menu*)user_data;
 
+    if (data->bluetooth_timer) {
+        app_remove_timer(data->app, data->bluetooth_timer);
+    }
+
+    bluetooth_reconnect_destroy(data->reconnect);
+    bluetooth_cache_destroy(data->bluetooth_cache);
     bluetooth_disconnect(data->bluetooth_client);
 
     free(data);
@@ -109,26 +196,53 @@ void free_main_menu(void* user_data) {
 menu_t* menus_main(const struct robot_util_config* config, app_t* app) {
     struct main_menu* data;
     menu_t* menu;
+    menu_item_t* bluetooth_item;
 
     data = (struct main_menu*)malloc(sizeof(struct main_menu));
     data->config = config;
     data->app = app;
+    data->bluetooth_timer = 0;
+    data->bluetooth_cache = NULL;
+    data->reconnect = NULL;
+    data->reconnect_item = NULL;
 
-    data->bluetooth_client = bluetooth_connect();
+    data->bluetooth_client = bluetooth_connect(config->bluetooth.bus_address);
     if (!data->bluetooth_client) {
         free_main_menu(data);
         return NULL;
     }
 
+    if (config->bluetooth.cache_path) {
+        data->bluetooth_cache = bluetooth_cache_create(
+            data->bluetooth_client, config->bluetooth.cache_path, config->bluetooth.max_devices,
+            (uint64_t)config->bluetooth.stale_timeout_ms * 1000);
+    }
+
+    // operations can finish while the screen is off, and their callbacks edit menus
+    data->bluetooth_timer =
+        app_add_timer(app, BLUETOOTH_DISPATCH_INTERVAL_MS, APP_TIMER_FLAG_RUN_WHEN_IDLE,
+                      main_menu_dispatch_bluetooth, data);
+
     menu = menu_create();
     menu_set_user_data(menu, data, free_main_menu);
+    data->menu = menu;
 
     if (config->update_url) {
         menu_add(menu, "Update robot", main_menu_update_robot, NULL, NULL);
     }
 
-    menu_add(menu, "Bluetooth", main_menu_open_bluetooth, NULL, NULL);
+    bluetooth_item = menu_add(menu, "Bluetooth", main_menu_open_bluetooth, NULL, NULL);
     menu_add(menu, "Exit", main_menu_exit, NULL, NULL);
 
+    // controllers come back after a reboot without anyone opening the bluetooth menu
+    if (config->bluetooth.reconnect.max_attempts > 0) {
+        data->reconnect =
+            bluetooth_reconnect_create(data->bluetooth_client, &config->bluetooth.reconnect);
+
+        memset(&data->reconnect_progress, 0, sizeof(struct bluetooth_reconnect_progress));
+        data->reconnect_item = menu_insert(menu, bluetooth_item, "Reconnecting...",
+                                           main_menu_reconnect_status, NULL, NULL);
+    }
+
     return menu;
 }
@@ -10,12 +10,20 @@ typedef struct app app_t;
 // from protocol/bluetooth.h
 typedef struct bluetooth bluetooth_t;
 
+// from protocol/bluetooth_cache.h
+typedef struct bluetooth_cache bluetooth_cache_t;
+
 // from core/config.h
 struct robot_util_config;
 
 // does not assume ownership of anything
 menu_t* menus_main(const struct robot_util_config* config, app_t* app);
 
-menu_t* menus_bluetooth(bluetooth_t* bt, app_t* app);
+// opens the bluetooth menu over menu, which must have come from menus_main
+void menus_main_open_bluetooth(menu_t* menu);
+
+// cache can be null
+menu_t* menus_bluetooth(const struct robot_util_config* config, bluetooth_t* bt,
+                        bluetooth_cache_t* cache, app_t* app);
 
 #endif
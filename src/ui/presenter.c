@@ -0,0 +1,218 @@
+#include "ui/presenter.h"
+
+#include "core/stats.h"
+
+#include <malloc.h>
+#include <string.h>
+
+#include <stdint.h>
+
+#include <pthread.h>
+
+struct presenter_buffer {
+    char* data;
+    size_t capacity;
+};
+
+struct presenter {
+    presenter_upload_callback_t upload;
+    void* user_data;
+
+    pthread_t thread;
+    int thread_started;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    // written by the ui thread. guarded by mutex
+    struct presenter_buffer back;
+    int frame_pending;
+    int wake_pending;
+    int should_stop;
+
+    // owned by the display thread
+    struct presenter_buffer front;
+
+    int failed;
+
+    uint64_t frames_published;
+    uint64_t frames_uploaded;
+    uint64_t frames_dropped;
+
+    int stats_id;
+};
+
+size_t presenter_get_render_data_size(const char* render_data) {
+    const char* cursor;
+
+    // each line is NUL-terminated, and the end of the data is denoted by an extra NUL
+    cursor = render_data;
+    while (*cursor != '\0') {
+        cursor += strlen(cursor) + 1;
+    }
+
+    return (cursor - render_data + 1) * sizeof(char);
+}
+
+void presenter_buffer_copy(struct presenter_buffer* buffer, const char* render_data) {
+    size_t size;
+
+    size = presenter_get_render_data_size(render_data);
+    if (size > buffer->capacity) {
+        buffer->data = (char*)realloc(buffer->data, size);
+        buffer->capacity = size;
+    }
+
+    memcpy(buffer->data, render_data, size);
+}
+
+void* presenter_run(void* arg) {
+    presenter_t* presenter;
+    struct presenter_buffer temp;
+
+    int has_frame;
+    int success;
+
+    presenter = (presenter_t*)arg;
+
+    pthread_mutex_lock(&presenter->mutex);
+    while (1) {
+        while (!presenter->frame_pending && !presenter->wake_pending && !presenter->should_stop) {
+            pthread_cond_wait(&presenter->cond, &presenter->mutex);
+        }
+
+        if (presenter->should_stop) {
+            break;
+        }
+
+        // swap buffers so that the ui thread can publish while we upload
+        has_frame = presenter->frame_pending;
+        if (has_frame) {
+            temp = presenter->front;
+            presenter->front = presenter->back;
+            presenter->back = temp;
+        }
+
+        presenter->frame_pending = 0;
+        presenter->wake_pending = 0;
+
+        if (presenter->failed) {
+            continue;
+        }
+
+        pthread_mutex_unlock(&presenter->mutex);
+
+        success =
+            presenter->upload(presenter->user_data, has_frame ? presenter->front.data : NULL);
+
+        pthread_mutex_lock(&presenter->mutex);
+
+        if (!success) {
+            presenter->failed = 1;
+        } else if (has_frame) {
+            presenter->frames_uploaded++;
+        }
+    }
+
+    pthread_mutex_unlock(&presenter->mutex);
+    return NULL;
+}
+
+void presenter_dump_stats(void* user_data, FILE* stream) {
+    presenter_t* presenter;
+
+    presenter = (presenter_t*)user_data;
+
+    pthread_mutex_lock(&presenter->mutex);
+
+    fprintf(stream, "frames published: %llu\n", (unsigned long long)presenter->frames_published);
+    fprintf(stream, "frames uploaded: %llu\n", (unsigned long long)presenter->frames_uploaded);
+    fprintf(stream, "frames dropped: %llu\n", (unsigned long long)presenter->frames_dropped);
+
+    pthread_mutex_unlock(&presenter->mutex);
+}
+
+presenter_t* presenter_create(const char* name, presenter_upload_callback_t upload,
+                              void* user_data) {
+    presenter_t* presenter;
+
+    presenter = (presenter_t*)malloc(sizeof(presenter_t));
+    memset(presenter, 0, sizeof(presenter_t));
+
+    presenter->upload = upload;
+    presenter->user_data = user_data;
+
+    pthread_mutex_init(&presenter->mutex, NULL);
+    pthread_cond_init(&presenter->cond, NULL);
+
+    if (pthread_create(&presenter->thread, NULL, presenter_run, presenter)) {
+        perror("pthread_create");
+
+        presenter_destroy(presenter);
+        return NULL;
+    }
+
+    presenter->thread_started = 1;
+    presenter->stats_id = stats_register(name, presenter_dump_stats, presenter);
+
+    return presenter;
+}
+
+void presenter_destroy(presenter_t* presenter) {
+    if (!presenter) {
+        return;
+    }
+
+    stats_unregister(presenter->stats_id);
+
+    if (presenter->thread_started) {
+        pthread_mutex_lock(&presenter->mutex);
+        presenter->should_stop = 1;
+        pthread_cond_signal(&presenter->cond);
+        pthread_mutex_unlock(&presenter->mutex);
+
+        pthread_join(presenter->thread, NULL);
+    }
+
+    pthread_cond_destroy(&presenter->cond);
+    pthread_mutex_destroy(&presenter->mutex);
+
+    free(presenter->front.data);
+    free(presenter->back.data);
+    free(presenter);
+}
+
+void presenter_publish(presenter_t* presenter, const char* render_data) {
+    pthread_mutex_lock(&presenter->mutex);
+
+    // latest frame wins
+    if (presenter->frame_pending) {
+        presenter->frames_dropped++;
+    }
+
+    presenter_buffer_copy(&presenter->back, render_data);
+    presenter->frame_pending = 1;
+    presenter->frames_published++;
+
+    pthread_cond_signal(&presenter->cond);
+    pthread_mutex_unlock(&presenter->mutex);
+}
+
+void presenter_wake(presenter_t* presenter) {
+    pthread_mutex_lock(&presenter->mutex);
+
+    presenter->wake_pending = 1;
+
+    pthread_cond_signal(&presenter->cond);
+    pthread_mutex_unlock(&presenter->mutex);
+}
+
+int presenter_has_failed(presenter_t* presenter) {
+    int failed;
+
+    pthread_mutex_lock(&presenter->mutex);
+    failed = presenter->failed;
+    pthread_mutex_unlock(&presenter->mutex);
+
+    return failed;
+}
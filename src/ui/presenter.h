@@ -0,0 +1,27 @@
+#ifndef PRESENTER_H
+#define PRESENTER_H
+
+typedef struct presenter presenter_t;
+
+// called from the presenter thread. render_data is laid out as described for backend_render, and
+// is null if the presenter was woken without a new frame. returns 1 on success, 0 on failure
+typedef int (*presenter_upload_callback_t)(void* user_data, const char* render_data);
+
+// starts a display thread which uploads published frames. does not assume ownership of user_data
+presenter_t* presenter_create(const char* name, presenter_upload_callback_t upload,
+                              void* user_data);
+
+// stops the display thread. frames which have not been uploaded yet are discarded
+void presenter_destroy(presenter_t* presenter);
+
+// publishes a frame. copies render_data. if the display thread has not picked up the previous
+// frame yet, the previous frame is dropped in favor of this one
+void presenter_publish(presenter_t* presenter, const char* render_data);
+
+// wakes the display thread without publishing a frame
+void presenter_wake(presenter_t* presenter);
+
+// returns 1 if an upload has failed. the display thread stops uploading after the first failure
+int presenter_has_failed(presenter_t* presenter);
+
+#endif